@@ -3,6 +3,7 @@
 CSVquery::CSVquery()
     :_oldRec(nullptr)
     ,_newRec(nullptr)
+    ,_cursors(nullptr)
     ,_begin(0)
     ,_end(0)
     ,_format(formatJson)
@@ -21,6 +22,7 @@ CSVquery::~CSVquery(){
     delete _columns;
     delete _oldRec;
     delete _newRec;
+    delete _cursors;
 }
 
 bool    CSVquery::setup(){
@@ -417,8 +419,12 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
         }
         _oldRec = new IotaLogRecord;
         _newRec = new IotaLogRecord;
+        _oldRec->setAccums(outputs->accums());
+        _newRec->setAccums(outputs->accums());
+        _cursors = new logCursors;
         _newRec->UNIXtime = _begin;
-        logReadKey(_newRec);
+        logReadKey(_newRec, _cursors);
+        *_oldRec = *_newRec;
         _firstLine = true;
         _lastLine = false;
     }
@@ -463,50 +469,63 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
             _lastLine = true;
         }
 
-            // Process next group
+            // Process groups, reading the log through to the end of the range or
+            // until the output is enough to fill the caller's buf.
+            // Fixed length groups are read as one range, calendar groups one at a time.
 
         else {
-
-                // Age the log record
-            
-            IotaLogRecord* swapRec = _oldRec;
-            _oldRec = _newRec;
-            _newRec = swapRec;
-
-                // Read group end record
-
-            _newRec->UNIXtime = (uint32_t)nextGroup((time_t)_oldRec->UNIXtime, _groupUnits, _groupMult);
-            if(_newRec->UNIXtime >= histLog.firstKey()){
-                logReadKey(_newRec);
+            uint32_t begin = (uint32_t)nextGroup((time_t)_newRec->UNIXtime, _groupUnits, _groupMult);
+            if(begin < histLog.firstKey()){
+                _newRec->UNIXtime = begin;
+                writeLine();
+                *_oldRec = *_newRec;
+            }
+            else {
+                uint32_t step = 0;
+                if(_groupUnits <= tUnitsHours){
+                    step = (uint32_t)nextGroup((time_t)begin, _groupUnits, _groupMult) - begin;
+                }
+                int demand = len - written;
+                logReadRange(_newRec, begin, _end, step, [this, demand](IotaLogRecord*, int) {
+                    writeLine();
+                    *_oldRec = *_newRec;
+                    return _buffer.available() < demand;
+                }, _cursors);
             }
+        }
+    }
+}
 
-                // If there is data or not skipping missing data, 
-                // Generate a line.             
+//*****************************************************************************************
+//                  writeLine - output the group ending with _newRec
+//*****************************************************************************************
+void    CSVquery::writeLine(){
 
-            if( ! (_newRec->logHours == _oldRec->logHours && _missingSkip)){
+        // If there is data or not skipping missing data, 
+        // Generate a line.             
 
-                if( ! _firstLine){
-                    if(_format == formatJson){
-                        _buffer.print(",\r\n");
-                    }
-                    if(_format == formatCSV){
-                        _buffer.print("\r\n");
-                    }
-                }
+    if( ! (_newRec->logHours == _oldRec->logHours && _missingSkip)){
 
-                if(_format == formatJson){
-                    _buffer.print('[');
-                }
+        if( ! _firstLine){
+            if(_format == formatJson){
+                _buffer.print(",\r\n");
+            }
+            if(_format == formatCSV){
+                _buffer.print("\r\n");
+            }
+        }
 
-                buildLine();
+        if(_format == formatJson){
+            _buffer.print('[');
+        }
 
-                if(_format == formatJson){
-                    _buffer.print(']');
-                }
+        buildLine();
 
-                _firstLine = false;
-            }
+        if(_format == formatJson){
+            _buffer.print(']');
         }
+
+        _firstLine = false;
     }
 }
 
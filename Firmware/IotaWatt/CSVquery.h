@@ -2,6 +2,8 @@
 
 #include "iotawatt.h"
 
+struct logCursors;
+
 class  CSVquery {
 
     public:
@@ -28,6 +30,7 @@ class  CSVquery {
 
         IotaLogRecord*  _oldRec;                // -> aged logRecord
         IotaLogRecord*  _newRec;                // -> new logRecord
+        logCursors*     _cursors;               // -> read cursors on the combined log
         xbuf            _buffer;                // work buffer to build response lines
 
         uint32_t    _begin;                     // Beginning time - UTC
@@ -77,6 +80,7 @@ class  CSVquery {
 
         void        buildHeader();
         void        buildLine();
+        void        writeLine();
         time_t      nextGroup(time_t time, tUnits units, int32_t mult);
         time_t      parseTimeArg(String timeArg);
         int         parseInt(char** ptr);
@@ -48,6 +48,7 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
 
   static IotaLogRecord* logRecord = nullptr;
   static IotaLogRecord* lastRecord = nullptr;
+  static logCursors* cursors = nullptr;
   static size_t   chunkSize = 1600;
   static char* buf = nullptr;
   static size_t bufPos = 0;
@@ -56,7 +57,6 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
   static uint32_t startUnixTime;
   static uint32_t endUnixTime;
   static uint32_t intervalSeconds;
-  static uint32_t UnixTime;
   static uint32_t lastReqTime = 0;
   static uint32_t processInterval;
   static uint32_t startTime;
@@ -146,13 +146,16 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
           
       logRecord = new IotaLogRecord;
       lastRecord = new IotaLogRecord;
+      logRecord->setAccums(outputs->accums());
+      lastRecord->setAccums(outputs->accums());
+      cursors = new logCursors;
      
       if(startUnixTime >= histLog.firstKey()){   
         lastRecord->UNIXtime = startUnixTime - intervalSeconds;
       } else {
         lastRecord->UNIXtime = histLog.firstKey();
       }
-      logReadKey(lastRecord);
+      logReadKey(lastRecord, cursors);
       
           // Using String for a large buffer abuses the heap
           // and takes up a lot of time. We will build 
@@ -168,19 +171,15 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
       server.setContentLength(CONTENT_LENGTH_UNKNOWN);
       server.send(200,"application/octet-stream","");
       *replyData= "[";
-      UnixTime = startUnixTime;
       state = process;
     }
   
     case process: {
       trace(T_GFD,1);
 
-          // Loop to generate entries
+          // Generate an entry for each interval as it is read
       
-      while(UnixTime <= endUnixTime) {
-        int rtc;
-        logRecord->UNIXtime = UnixTime;
-        logReadKey(logRecord);
+      logReadRange(logRecord, startUnixTime, endUnixTime, intervalSeconds, [](IotaLogRecord*, int rtc) {
         trace(T_GFD,2);
         *replyData += '[';  //  + String(UnixTime) + "000,";
         double elapsedHours = logRecord->logHours - lastRecord->logHours;
@@ -240,10 +239,7 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
         } 
            
         replyData->setCharAt(replyData->length()-1,']');
-        IotaLogRecord* swapRecord = lastRecord;
-        lastRecord = logRecord;
-        logRecord = swapRecord;
-        UnixTime += intervalSeconds;
+        *lastRecord = *logRecord;
 
             // If not enough room in buffer for this segment, 
             // Write the buffer chunk.
@@ -261,7 +257,8 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
         replyData->remove(0);
         
         *replyData += ',';
-      }
+        return true;
+      }, cursors);
       trace(T_GFD,7);
 
           // All entries generated, terminate Json and send.
@@ -287,6 +284,8 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
       logRecord = nullptr;
       delete lastRecord;
       lastRecord = nullptr;
+      delete cursors;
+      cursors = nullptr;
       state = setup;
       serverAvailable = true;
       return 0;                                       // Done for now, return without scheduling.
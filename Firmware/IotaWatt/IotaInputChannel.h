@@ -1,6 +1,8 @@
 #ifndef IotaInputChannel_h
 #define IotaInputChannel_h
 
+#define HARMONICS_SELECTED 4        // Odd harmonics kept per channel, 3rd through 9th
+
 enum channelTypes:byte {channelTypeUndefined=0,
                         channelTypeVoltage=1,
                         channelTypePower=2};
@@ -12,6 +14,10 @@ union dataBuckets {
         double accum1;
         double accum2;
 		    uint32 timeThen;
+        double value3;                        // THD percent (analyseHarmonics)
+        double accum3;
+        double value4;                        // VAR of a power channel, signed (+ lagging)
+        double accum4;
       };
       struct {
         double  volts;
@@ -30,7 +36,37 @@ union dataBuckets {
       ,value2(0)
       ,accum1(0)
       ,accum2(0)
-      ,timeThen(millis()){}
+      ,timeThen(millis())
+      ,value3(0)
+      ,accum3(0)
+      ,value4(0)
+      ,accum4(0){}
+};
+
+      // Sampling quality of a channel: sampleCycles' attempts and results since restart.
+
+enum sampleRejects:byte {sampleLowCount=0,              // Too few samples (interrupted)
+                         sampleImbalance=1,             // Half cycles differ
+                         sampleTimeout=2,               // No crossing (no voltage reference)
+                         sampleMaxSamples=3};           // Over MAX_SAMPLES
+#define SAMPLE_REJECTS 4
+
+struct sampleQuality {
+      uint32_t  attempts;
+      uint32_t  successes;
+      uint32_t  rejects[SAMPLE_REJECTS];      // By sampleRejects
+      uint64_t  sumSamples;                   // Samples per cycle of the successes
+      uint16_t  minSamples;
+      uint16_t  maxSamples;
+      uint32_t  lastSuccessMs;
+      sampleQuality() {memset(this, 0, sizeof(*this));}
+      void      success(int16_t samples){
+                  successes++;
+                  sumSamples += samples;
+                  if(samples < minSamples || minSamples == 0) minSamples = samples;
+                  if(samples > maxSamples) maxSamples = samples;
+                  lastSuccessMs = millis();
+                }
 };
 	
 class IotaInputChannel {
@@ -42,7 +78,15 @@ class IotaInputChannel {
     float        _calibration;                // Calibration factor
     float        _phase;                      // Phase correction in degrees (+lead, - lag);
     float        _vphase;                     // Phase offset for 3-phase voltage reference
-    float        _lastPhase; 
+    float        _lastPhase;                  // Last phase estimate (CT - VT), used to sample the next cycle
+    float        _sampleMean;                 // Moving mean and variance of sampled watts (volts)
+    float        _sampleVar;
+    float        _sampleRate;                 // Samples per second (statService)
+    uint32_t     _sampleMs;                   // Last sampled (or tried)
+    uint16_t     _sampleCount;                // Samples since statService last looked
+    uint16_t     _harmonicCount;              // Samples since harmonic analysis
+    float        _harmonic[HARMONICS_SELECTED]; // Last analysed 3rd, 5th... harmonic, percent of fundamental
+    sampleQuality _quality;                   // Sampling attempts and results (/status?stats)
     int16_t*     _p50;                        // -> 50Hz phase correction array
     int16_t*     _p60;                        // -> 60Hz phase correction array
     uint16_t     _turns;                      // Turns ratio of current type CT	
@@ -70,6 +114,15 @@ class IotaInputChannel {
     ,_calibration(0)
     ,_phase(0)
     ,_vphase(0)
+    ,_lastPhase(0)
+    ,_sampleMean(0)
+    ,_sampleVar(0)
+    ,_sampleRate(0)
+    ,_sampleMs(0)
+    ,_sampleCount(0)
+    ,_harmonicCount(0)
+    ,_harmonic()
+    ,_quality()
     ,_p50(nullptr)
     ,_p60(nullptr)
     ,_turns(0)
@@ -87,7 +140,8 @@ class IotaInputChannel {
     void    setVoltage(float volts, float Hz);
     void    setVoltage(float volts);
     void    setHz(float Hz);
-    void    setPower(float watts, float VA);	
+    void    setPower(float watts, float VA, float VAR = 0);	
+    void    sampled(float value);
     bool    isActive(){return _active;}
     void    active(bool _active_){_active = _active_;}
     double  getVoltage(){return dataBucket.volts;}	
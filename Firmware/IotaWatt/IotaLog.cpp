@@ -7,11 +7,47 @@ struct {
   uint32_t UNIXtime;
   uint32_t serial; 
 } record;
+static uint32_t heapUsed = 0;               // Cache pages, tail rings and commit buffers of all logs (Heap budget)
+
+uint32_t IotaLog::heapUsed(){return ::heapUsed;}
+
 int IotaLog::begin (const char* path ){
   if(IotaFile) return 0;	
   String logPath = String(path) + ".log";
+  String filePath = String(path) + ".";
+
+					// A log is segmented if it was created so (see Segments in IotaLog.h).
+
+  delete[] _segmentDir;
+  _segmentDir = nullptr;
+  _segmentCount = 0;
+  _segmentNumber = 0;
+  _segmentRecords = 0;
+  _segmentStart = 0;
+  if( ! SD.exists(logPath) && (SD.exists(path) || (_newSegmentDays && ! _newCompress))){
+		_segmentDir = new char[strlen(path)+1];
+		strcpy(_segmentDir, path);
+		filePath = String(path) + "/log.";
+		if( ! beginSegments()){
+			return 2;
+		}
+		logPath = segmentPath(_segmentNumber);
+  }
+  delete[] _path;
 	_path = new char[logPath.length()+1];
 	strcpy(_path, logPath.c_str());
+  String headerPath = filePath + "hdr";
+  delete[] _headerPath;
+	_headerPath = new char[headerPath.length()+1];
+	strcpy(_headerPath, headerPath.c_str());
+  String indexPath = filePath + "ndx";
+  delete[] _indexPath;
+	_indexPath = new char[indexPath.length()+1];
+	strcpy(_indexPath, indexPath.c_str());
+  String blockPath = filePath + "bix";
+  delete[] _blockPath;
+	_blockPath = new char[blockPath.length()+1];
+	strcpy(_blockPath, blockPath.c_str());
   if(!SD.exists(_path)){
 		if(logPath.lastIndexOf('/') > 0){
 			String  dir = logPath.substring(0,logPath.lastIndexOf('/'));
@@ -20,124 +56,2152 @@ int IotaLog::begin (const char* path ){
 				return 2;
 			}
 		}
-		IotaFile = SD.open(_path, FILE_WRITE);
-		if(!IotaFile){
-			return 2;
+		IotaFile = SD.open(_path, FILE_WRITE);
+		if(!IotaFile){
+			return 2;
+		}
+		IotaFile.close();
+		SD.remove(_headerPath);
+		SD.remove(_indexPath);
+		SD.remove(_blockPath);
+  }
+  IotaFile = SD.open(_path, FILE_WRITE);
+	if(!IotaFile){
+		return 2;
+  }
+
+					// The format block gives the record layout.  A new file gets one with the
+					// current channel map; a file without one predates it.
+
+  if(IotaFile.size() == 0){
+		newFormat();
+		writeFormat();
+  }
+  else if( ! readFormat()){
+		_channels = IOTALOG_ALL_CHANNELS;
+		_accums = 0;
+		_recordSize = IOTALOG_RECORD_V1;
+		_dataStart = 0;
+		_checked = false;
+		_compressed = false;
+		_blockMaps = false;
+  }
+  _pageSize = (IOTALOG_PAGE_BYTES / _recordSize) * _recordSize;
+  if(_segmentDir){
+		if(_segmentRecords == 0){
+			rebuildSegments();
+		}
+		_segmentBytes = _segmentRecords * _recordSize;
+  }
+  
+					// A compressed log resumes from its block index.
+					// Otherwise, normally the header has the state of the log as of the last checkpoint,
+					// so there are only a few records written since to roll forward.
+					// If not, scan the file.
+
+  if(_compressed){
+		BlockFile = SD.open(_blockPath, FILE_WRITE);
+		if( ! BlockFile){
+			IotaFile.close();
+			return 2;
+		}
+		if( ! readBlocks()){
+			rebuildBlocks();
+		}
+  }
+  else if( ! readHeader()){
+		scanFile();
+  }
+
+					// A segmented log has the state of its newest segment so far.  Its serials must
+					// follow on from the full segments.  If they don't add up, the whole file is repaired.
+
+  bool bad = (uint32_t)(_lastSerial - _firstSerial + 1) != _entries;
+  if(_segmentDir){
+		bad |= _entries && _segmentCount && _firstSerial != fileSerial();
+		joinSegments();
+  }
+
+  setDays(_days);
+  _repair = false;
+  
+  if(bad){
+		log("IotaLog: file damaged %s\r\n", _path);
+		repairFile();
+		return 0;
+	}
+	
+	clearCache();
+
+					// Otherwise a bad record at either end (as a write cut short leaves) is mended
+					// before the log is used, reading and rewriting just the damaged range.
+
+  bool repaired = false;
+  int32_t serial;
+  for(int pass=0; pass<2 && (serial = checkEnds()) >= 0; pass++){
+		log("IotaLog: bad record %s, serial %d\r\n", _path, serial);
+		_repair = true;
+		_repairLow = _repairHigh = serial;
+		repair();
+		repaired = true;
+  }
+  if(repaired){
+		SD.remove(_indexPath);
+  }
+	writeHeader();
+	loadIndex();
+
+  return 0;
+}
+
+/*******************************************************************************************************
+ * repair - mend the damaged range noted by damaged() or begin() (see Repair in IotaLog.h), for up to
+ * ms milliseconds (0 to finish).  The range grows back from the bad record to the good record before
+ * it and forward to the first good one after with room for the keys between, then the records in it
+ * are rewritten.  Progress is kept as serials, so writes can carry on between calls.
+ * Returns 1 while there is more to do.
+ * repairing - a damaged range is waiting for repair().
+ *******************************************************************************************************/
+int IotaLog::repair(uint32_t ms){
+  if( ! _repair || ! IotaFile || _compressed || _entries == 0){
+		_repair = false;
+		return 0;
+  }
+  uint32_t started = millis();
+  commit();
+  int32_t lowest = fileSerial();
+  _repairLow = max(_repairLow, lowest);
+  _repairHigh = max(_repairHigh, _repairLow);
+  if(_repairLow > _lastSerial){
+		_repair = false;
+		return 0;
+  }
+  uint8_t prev[IOTALOG_RECORD_MAX];
+  uint8_t next[IOTALOG_RECORD_MAX];
+  uint32_t prevKey = 0;
+  uint32_t nextKey = 0;
+  bool hasPrev = false;
+  bool hasNext = false;
+  while(_repairLow > lowest && ! (hasPrev = goodRecord(prev, _repairLow - 1))){
+		_repairLow--;
+		if(ms && (millis() - started) >= ms){
+			return 1;
+		}
+  }
+  if(hasPrev){
+		memcpy(&prevKey, prev, sizeof(prevKey));
+  }
+  while(_repairHigh <= _lastSerial){
+		if(goodRecord(next, _repairHigh)){
+			memcpy(&nextKey, next, sizeof(nextKey));
+			if( ! hasPrev || nextKey >= prevKey + (uint32_t)(_repairHigh - _repairLow + 1) * _interval){
+				hasNext = true;
+				break;
+			}
+		}
+		_repairHigh++;
+		if(ms && (millis() - started) >= ms){
+			return 1;
+		}
+  }
+  _repair = false;
+  if( ! hasPrev && ! hasNext){
+		log("IotaLog: no good records, starting over %s\r\n", _path);
+		splitSegments();
+		startOver();
+		return 0;
+  }
+
+					// Replace the range with copies of the good record before it carrying the following
+					// keys, or at the start of the file, of the one after it with the keys before.
+
+  uint32_t run = _repairHigh - _repairLow;
+  if(run == 0){
+		return 0;
+  }
+  uint32_t key = 0;
+  for(uint32_t j=0; j<run; j++){
+		int32_t serial = _repairLow + j;
+		key = hasPrev ? prevKey + (j + 1) * _interval : nextKey - (run - j) * _interval;
+		rewriteRecord(hasPrev ? prev : next, serialPos(serial) - _segmentStart, key, serial);
+  }
+  IotaFile.flush();
+  if( ! hasPrev){
+		_segmentKey = nextKey - run * _interval;
+		if(_repairLow == _firstSerial){
+			_firstKey = _segmentKey;
+		}
+  }
+  if( ! hasNext){
+		_lastKey = key;
+  }
+  clearCache();
+  if(_indexValid){
+		reindex(_repairLow, _repairHigh);
+  }
+  writeHeader();
+  log("IotaLog: repaired %s, serials %d-%d replaced, %dms\r\n", _path, _repairLow, _repairHigh - 1, millis() - started);
+  return 0;
+}
+
+bool IotaLog::repairing(){return _repair;}
+
+/*******************************************************************************************************
+ * repairFile - make a log whose state can't be established consistent in place, keeping its good
+ * records.  One pass over the file finds the newest good record.  A second, starting after it,
+ * replaces bad records and renumbers serials.  A log with no good records is started over.
+ * Returns the number of records replaced or dropped.
+ * startOver - empty the file being written.
+ *******************************************************************************************************/
+int IotaLog::repairFile(){
+  if( ! IotaFile || _compressed){
+		return 0;
+  }
+  uint32_t started = millis();
+  commit();
+  splitSegments();
+  setLedCycle(LED_DUMPING_LOG);
+  uint32_t physicalSize = IotaFile.size() > _dataStart ? IotaFile.size() - _dataStart : 0;
+  physicalSize -= physicalSize % _recordSize;
+  uint8_t* buffer = new uint8_t[_pageSize];
+  uint32_t key;
+  int32_t serial;
+
+					// Find the newest good record, and whether there are any after it.
+
+  uint32_t newestPos = 0;
+  uint32_t newestKey = 0;
+  int32_t newestSerial = 0;
+  uint32_t lastGoodPos = 0;
+  for(uint32_t pagePos=0; pagePos<physicalSize; pagePos+=_pageSize){
+		uint32_t len = min(_pageSize, physicalSize - pagePos);
+		IotaFile.seek(_dataStart + pagePos);
+		IotaFile.read(buffer, len);
+		for(uint32_t offset=0; offset<len; offset+=_recordSize){
+			memcpy(&key, buffer + offset, sizeof(key));
+			memcpy(&serial, buffer + offset + sizeof(key), sizeof(serial));
+			if(key && (key % _interval) == 0 && checkRecord(buffer + offset)){
+				lastGoodPos = pagePos + offset;
+				if(key > newestKey){
+					newestKey = key;
+					newestPos = lastGoodPos;
+					newestSerial = serial;
+				}
+			}
+		}
+		yield();
+  }
+
+  if(newestKey == 0){
+		log("IotaLog: no good records, starting over %s\r\n", _path);
+		delete[] buffer;
+		startOver();
+		endLedCycle();
+		return physicalSize / _recordSize;
+  }
+
+					// If the newest good record is the last, the log starts at the beginning of the file
+					// and anything after it is dropped.  Otherwise the log starts after it.
+					// A segment doesn't wrap, and its serials follow on from the full segments.
+
+  uint32_t size = physicalSize;
+  uint32_t start = newestPos + _recordSize;
+  if(lastGoodPos == newestPos || _segmentDir){
+		size = newestPos + _recordSize;
+		start = 0;
+  }
+  start %= size;
+  uint32_t entries = size / _recordSize;
+  int32_t firstSerial = newestSerial - (int32_t)(entries - 1);
+  if(_segmentCount){
+		firstSerial = fileSerial();
+  }
+
+					// Accept good records with increasing keys, leaving room for the keys of any bad
+					// records before them, and replace the bad records with copies of the good record
+					// before (or for the oldest, after) them.
+
+  uint8_t prev[IOTALOG_RECORD_MAX];
+  uint32_t prevKey = 0;
+  uint32_t firstKey = 0;
+  uint32_t run = 0;
+  uint32_t replaced = (physicalSize - size) / _recordSize;
+  uint32_t renumbered = 0;
+  uint32_t bufferPos = 0;
+  uint32_t bufferLen = 0;
+  for(uint32_t i=0; i<entries; i++){
+		uint32_t pos = (start + i * _recordSize) % size;
+		if(pos < bufferPos || pos >= bufferPos + bufferLen){
+			bufferPos = pos;
+			bufferLen = min(_pageSize, size - pos);
+			IotaFile.seek(_dataStart + bufferPos);
+			IotaFile.read(buffer, bufferLen);
+			yield();
+		}
+		uint8_t* data = buffer + (pos - bufferPos);
+		memcpy(&key, data, sizeof(key));
+		memcpy(&serial, data + sizeof(key), sizeof(serial));
+		if( ! key || (key % _interval) || ! checkRecord(data) ||
+			 (prevKey && (key <= prevKey || (key - prevKey) / _interval <= run))){
+			run++;
+			continue;
+		}
+		for(uint32_t j=0; j<run; j++){
+			uint32_t fill = i - run + j;
+			if(prevKey){
+				rewriteRecord(prev, (start + fill * _recordSize) % size, prevKey + (j + 1) * _interval, firstSerial + fill);
+			} else {
+				rewriteRecord(data, (start + fill * _recordSize) % size, key - (run - j) * _interval, firstSerial + fill);
+			}
+			replaced++;
+		}
+		if( ! prevKey){
+			firstKey = key - run * _interval;
+		}
+		if(serial != firstSerial + (int32_t)i){
+			rewriteRecord(data, pos, key, firstSerial + i);
+			renumbered++;
+		}
+		memcpy(prev, data, _recordSize);
+		prevKey = key;
+		run = 0;
+  }
+  for(uint32_t j=0; j<run; j++){
+		uint32_t fill = entries - run + j;
+		prevKey += _interval;
+		rewriteRecord(prev, (start + fill * _recordSize) % size, prevKey, firstSerial + fill);
+		replaced++;
+  }
+  IotaFile.flush();
+  delete[] buffer;
+
+  _fileSize = size;
+  _entries = entries;
+  _wrap = start;
+  _firstKey = firstKey;
+  _firstSerial = firstSerial;
+  _lastKey = prevKey;
+  _lastSerial = firstSerial + entries - 1;
+  joinSegments();
+  setDays(_days);
+  SD.remove(_indexPath);
+  clearCache();
+  writeHeader();
+  loadIndex();
+  _repair = false;
+  endLedCycle();
+  log("IotaLog: repaired %s, %d records replaced, %d renumbered, %dms\r\n", _path, replaced, renumbered, millis() - started);
+  return replaced;
+}
+
+void IotaLog::startOver(){
+  IotaFile.close();
+  SD.remove(_path);
+  IotaFile = SD.open(_path, FILE_WRITE);
+  if(_segmentCount == 0){
+		newFormat();
+  }
+  writeFormat();
+  _fileSize = _entries = _wrap = 0;
+  _firstKey = _lastKey = 0;
+  _firstSerial = 0;
+  _lastSerial = -1;
+  joinSegments();
+  SD.remove(_indexPath);
+  clearCache();
+  writeHeader();
+  loadIndex();
+  _repair = false;
+}
+
+/*******************************************************************************************************
+ * rewriteRecord - write a copy of a stored record with a new key and serial.
+ *******************************************************************************************************/
+void IotaLog::rewriteRecord(uint8_t* source, uint32_t pos, uint32_t key, int32_t serial){
+  uint8_t data[IOTALOG_RECORD_MAX];
+  memcpy(data, source, _recordSize);
+  memcpy(data, &key, sizeof(key));
+  memcpy(data + sizeof(key), &serial, sizeof(serial));
+  if(_checked){
+		uint32_t crc = crc32(data, _recordSize - IOTALOG_RECORD_CRC);
+		memcpy(data + _recordSize - IOTALOG_RECORD_CRC, &crc, sizeof(crc));
+  }
+  IotaFile.seek(_dataStart + pos);
+  IotaFile.write(data, _recordSize);
+}
+
+/*******************************************************************************************************
+ * checkRecord - true if a stored record's crc is good (or it hasn't one), of the file being written or
+ *               of size.
+ * goodRecord - read the record with a serial from the file being written, true if it is good: crc,
+ *              key on the interval and the serial of its place in the log.
+ * damaged - note a bad record found by a reader, for repair().
+ * checkEnds - serial of a bad first or last record of the file being written at begin(), -1 if none.
+ * fileSerial - serial of the first record in the file being written.
+ * serialPos - log position of the record with a serial.  In a segmented log, that of the segment
+ *             holding it plus its place there, at the segment's record size.
+ *******************************************************************************************************/
+bool IotaLog::checkRecord(const uint8_t* data){return checkRecord(data, _recordSize);}
+
+bool IotaLog::checkRecord(const uint8_t* data, uint16_t size){
+  if( ! _checked){
+		return true;
+  }
+  uint32_t crc;
+  memcpy(&crc, data + size - IOTALOG_RECORD_CRC, sizeof(crc));
+  return crc == crc32(data, size - IOTALOG_RECORD_CRC);
+}
+
+bool IotaLog::goodRecord(uint8_t* data, int32_t serial){
+  IotaFile.seek(_dataStart + serialPos(serial) - _segmentStart);
+  if(IotaFile.read(data, _recordSize) != _recordSize){
+		return false;
+  }
+  uint32_t key;
+  int32_t stored;
+  memcpy(&key, data, sizeof(key));
+  memcpy(&stored, data + sizeof(key), sizeof(stored));
+  return key && (key % _interval) == 0 && stored == serial && checkRecord(data);
+}
+
+void IotaLog::damaged(uint32_t pos){
+  if( ! _repair){
+		log("IotaLog: bad record %s at %d\r\n", _path, pos);
+		_repair = pos >= _segmentStart;
+		_repairLow = _repairHigh = _segmentDir ? fileSerial() + (int32_t)((pos - _segmentStart) / _recordSize) :
+															 _firstSerial + ((pos + _fileSize - _wrap) % _fileSize) / _recordSize;
+  }
+}
+
+int32_t IotaLog::checkEnds(){
+  if( ! _checked || fileSerial() > _lastSerial){
+		return -1;
+  }
+  uint8_t data[IOTALOG_RECORD_MAX];
+  if( ! goodRecord(data, fileSerial())){
+		return fileSerial();
+  }
+  if( ! goodRecord(data, _lastSerial)){
+		return _lastSerial;
+  }
+  return -1;
+}
+
+int32_t IotaLog::fileSerial(){
+  if(_segmentCount == 0){
+		return _firstSerial;
+  }
+  return _segments[_segmentCount-1].firstSerial + (int32_t)_segments[_segmentCount-1].records;
+}
+
+uint32_t IotaLog::serialPos(int32_t serial){
+  if( ! _segmentDir){
+		return ((serial - _firstSerial) * _recordSize + _wrap) % _fileSize;
+  }
+  if(serial >= fileSerial()){
+		return _segmentStart + (serial - fileSerial()) * _recordSize;
+  }
+  int low = 0;
+  int high = _segmentCount - 1;
+  while(low < high){
+		int mid = (low + high + 1) / 2;
+		if(_segments[mid].firstSerial <= serial){
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+  }
+  return _segments[low].start + (serial - _segments[low].firstSerial) * storedSize(_segments[low].map, true);
+}
+
+/*******************************************************************************************************
+ * scanFile - establish the log state from the file itself.
+ * Reads the first and last records, trims trailing zero records and, if the file has wrapped,
+ * binary searches for the wrap point.
+ *******************************************************************************************************/
+void IotaLog::scanFile(){
+  _fileSize = IotaFile.size() > _dataStart ? IotaFile.size() - _dataStart : 0;
+  _fileSize -= _fileSize % _recordSize;
+  _wrap = 0;
+
+  if(_fileSize){
+		IotaFile.seek(_dataStart);
+		IotaFile.read(&record, sizeof(record));
+		_firstKey = record.UNIXtime;
+		_firstSerial = record.serial;
+		IotaFile.seek(_dataStart + _fileSize - _recordSize);
+		IotaFile.read(&record, sizeof(record));
+		_lastKey = record.UNIXtime;
+		_lastSerial = record.serial;
+		_entries = _fileSize / _recordSize;
+  }
+
+					// If there are trailing zero records at the end - preallocated, or not written
+					// before a crash - find the logical end of file by bisection.
+
+	if(_fileSize && _lastKey == 0){
+		int32_t low = -1;																	// Last record known written
+		int32_t high = _entries - 1;											// First record known zero
+		while(high - low > 1){
+			int32_t mid = (low + high) / 2;
+			IotaFile.seek(_dataStart + mid * _recordSize);
+			IotaFile.read(&record, sizeof(record));
+			if(record.UNIXtime == 0){
+				high = mid;
+			} else {
+				low = mid;
+			}
+		}
+		_entries = high;
+		_fileSize = _entries * _recordSize;
+		if(_fileSize){
+			IotaFile.seek(_dataStart + _fileSize - _recordSize);
+			IotaFile.read(&record, sizeof(record));
+			_lastSerial = record.serial;
+			_lastKey = record.UNIXtime;
+		}
+	}
+	if(_fileSize == 0){
+		_firstKey = _lastKey = 0;
+		_firstSerial = 0;
+		_lastSerial = -1;
+	}
+	if(_dataStart + _fileSize != IotaFile.size()){
+		Serial.printf("physical %d, logical %d\r\n", IotaFile.size() - _dataStart, _fileSize);
+	}
+	
+  if(_firstKey > _lastKey){
+		_wrap = findWrap(0,_firstKey, _fileSize - _recordSize, _lastKey);
+		IotaFile.seek(_dataStart + _wrap);
+		IotaFile.read(&record, sizeof(record));
+		_firstKey = record.UNIXtime;
+		_firstSerial = record.serial;
+		IotaFile.seek(_dataStart + _wrap - _recordSize);
+		IotaFile.read(&record, sizeof(record));
+		_lastKey = record.UNIXtime;
+		_lastSerial = record.serial;
+  }
+}
+
+/*******************************************************************************************************
+ * readHeader - restore the log state from the header (.hdr) file.
+ * The header is a checkpoint written every IOTALOG_HEADER_WRITES writes and at end().  It is accepted
+ * if the checksum is good and the first and last records it describes are where it says they are.
+ * Records written after the checkpoint are then rolled forward, just as write() would have
+ * accounted for them.  Returns false if the file has to be scanned instead.
+ *******************************************************************************************************/
+bool IotaLog::readHeader(){
+  IotaLogHeader header;
+  File headerFile = SD.open(_headerPath, FILE_READ);
+  if( ! headerFile){
+		return false;
+  }
+  int len = headerFile.read(&header, sizeof(header));
+  headerFile.close();
+  uint32_t physicalSize = IotaFile.size() > _dataStart ? IotaFile.size() - _dataStart : 0;
+  if(len != sizeof(header) ||
+     header.id != IOTALOG_HEADER_ID ||
+     header.version != IOTALOG_HEADER_VERSION ||
+     header.recordSize != _recordSize ||
+     header.interval != _interval ||
+     header.checksum != crc32(&header, offsetof(IotaLogHeader, checksum)) ||
+     header.fileSize > physicalSize ||
+     header.fileSize % _recordSize ||
+     header.wrap % _recordSize ||
+     (header.wrap && header.wrap >= header.fileSize) ||
+     header.entries != header.fileSize / _recordSize){
+		return false;
+  }
+
+					// The first and last records must agree with the header, unless they are bad
+					// (begin() mends them).
+
+  if(header.fileSize){
+		uint8_t data[IOTALOG_RECORD_MAX];
+		IotaFile.seek(_dataStart + header.wrap);
+		IotaFile.read(data, _recordSize);
+		memcpy(&record, data, sizeof(record));
+		if(checkRecord(data) && (record.UNIXtime != header.firstKey || (int32_t)record.serial != header.firstSerial)){
+			return false;
+		}
+		IotaFile.seek(_dataStart + (header.wrap + header.fileSize - _recordSize) % header.fileSize);
+		IotaFile.read(data, _recordSize);
+		memcpy(&record, data, sizeof(record));
+		if(checkRecord(data) && (record.UNIXtime != header.lastKey || (int32_t)record.serial != header.lastSerial)){
+			return false;
+		}
+  }
+  _fileSize = header.fileSize;
+  _entries = header.entries;
+  _wrap = header.wrap;
+  _firstKey = header.firstKey;
+  _firstSerial = header.firstSerial;
+  _lastKey = header.lastKey;
+  _lastSerial = header.lastSerial;
+
+					// Roll forward.  An unwrapped file is appended until it reaches _maxFileSize,
+					// then (and always after that) the record at _wrap is overwritten.
+
+  uint32_t rolled = 0;
+  while(true){
+		if(_wrap == 0 && (_fileSize + _recordSize) <= physicalSize){
+			IotaFile.seek(_dataStart + _fileSize);
+			IotaFile.read(&record, sizeof(record));
+			if((int32_t)record.serial == _lastSerial + 1 && record.UNIXtime > _lastKey){
+				_fileSize += _recordSize;
+				_entries++;
+				_lastKey = record.UNIXtime;
+				_lastSerial = record.serial;
+				if(++rolled > IOTALOG_HEADER_ROLL) return false;
+				continue;
+			}
+		}
+		if(_fileSize == 0) break;
+		IotaFile.seek(_dataStart + _wrap);
+		IotaFile.read(&record, sizeof(record));
+		if((int32_t)record.serial != _lastSerial + 1 || record.UNIXtime <= _lastKey) break;
+		_wrap = (_wrap + _recordSize) % _fileSize;
+		_lastKey = record.UNIXtime;
+		_lastSerial = record.serial;
+		if(++rolled > IOTALOG_HEADER_ROLL) return false;
+  }
+  if(rolled && _fileSize){
+		IotaFile.seek(_dataStart + _wrap);
+		IotaFile.read(&record, sizeof(record));
+		_firstKey = record.UNIXtime;
+		_firstSerial = record.serial;
+  }
+  if(_fileSize == 0){
+		_firstKey = _lastKey = 0;
+		_firstSerial = 0;
+		_lastSerial = -1;
+  }
+  return true;
+}
+
+/*******************************************************************************************************
+ * writeHeader - checkpoint the log state to the header (.hdr) file.
+ * For a segmented log, the state of the newest segment.
+ *******************************************************************************************************/
+void IotaLog::writeHeader(){
+  _headerWrites = 0;
+  if( ! IotaFile || ! _headerPath || _compressed) return;
+  IotaLogHeader header;
+  header.id = IOTALOG_HEADER_ID;
+  header.version = IOTALOG_HEADER_VERSION;
+  header.recordSize = _recordSize;
+  header.interval = _interval;
+  header.fileSize = _fileSize - _segmentStart;
+  header.entries = (_fileSize - _segmentStart) / _recordSize;
+  header.wrap = _wrap;
+  header.firstKey = _segmentStart ? _segmentKey : _firstKey;
+  header.firstSerial = _segmentStart ? _lastSerial + 1 - (int32_t)header.entries : _firstSerial;
+  header.lastKey = _lastKey;
+  header.lastSerial = _lastSerial;
+  header.checksum = crc32(&header, offsetof(IotaLogHeader, checksum));
+  File headerFile = SD.open(_headerPath, FILE_WRITE);
+  if( ! headerFile){
+		return;
+  }
+  headerFile.seek(0);
+  headerFile.write((char*)&header, sizeof(header));
+  headerFile.close();
+}
+
+/*******************************************************************************************************
+ * readFormat - get the record layout from the format block at the start of the file.
+ * Returns false if there isn't a valid one, meaning a version 1 file of whole records.
+ *******************************************************************************************************/
+bool IotaLog::readFormat(){
+  IotaLogFormat format;
+  IotaFile.seek(0);
+  if(IotaFile.read(&format, sizeof(format)) != sizeof(format) ||
+     format.id != IOTALOG_FORMAT_ID ||
+     (format.version != IOTALOG_FORMAT_VERSION && format.version != IOTALOG_FORMAT_PACKED && 
+      format.version != IOTALOG_FORMAT_BLOCKS && format.version != IOTALOG_FORMAT_MAPPED) ||
+     format.checksum != crc32(&format, offsetof(IotaLogFormat, checksum))){
+		return false;
+  }
+  uint32_t channels = format.channels & IOTALOG_ALL_CHANNELS;
+  uint32_t accums = format.channels & IOTALOG_ACCUMS_MASK;
+  if(channels == 0 || (format.channels & ~(IOTALOG_ALL_CHANNELS | IOTALOG_ACCUMS_MASK)) ||
+     format.recordSize != storedSize(format.channels, format.version == IOTALOG_FORMAT_VERSION)){
+		return false;
+  }
+  _channels = channels;
+  _accums = accums;
+  _recordSize = format.recordSize;
+  _dataStart = IOTALOG_FORMAT_SIZE;
+  _checked = format.version == IOTALOG_FORMAT_VERSION;
+  _compressed = format.version == IOTALOG_FORMAT_BLOCKS || format.version == IOTALOG_FORMAT_MAPPED;
+  _blockMaps = format.version == IOTALOG_FORMAT_MAPPED;
+  return true;
+}
+
+/*******************************************************************************************************
+ * newFormat - take up the channels set by setChannels() and compression set by setCompress() for a
+ * new file.
+ * remap - take up the channels and accumulators set since, at the start of a block of a compressed log
+ * with a map per block or of a segment.  The tail ring and commit buffer hold records of the old size,
+ * so they are given back.
+ * storedSize - size of a stored record with a channel map word, with or without crc.
+ * writeFormat - start a new file with the format block for its layout.
+ *******************************************************************************************************/
+void IotaLog::newFormat(){
+  _channels = _newChannels;
+  _accums = _newAccums;
+  _compressed = _newCompress;
+  _checked = ! _compressed;
+  _blockMaps = _compressed;
+  _recordSize = storedSize(_channels | _accums, _checked);
+  _dataStart = IOTALOG_FORMAT_SIZE;
+}
+
+void IotaLog::remap(){
+  if((_channels | _accums) == (_newChannels | _newAccums)){
+		return;
+  }
+  freeTail();
+  freeCommit();
+  _channels = _newChannels;
+  _accums = _newAccums;
+  _recordSize = storedSize(_channels | _accums, _checked);
+  _pageSize = (IOTALOG_PAGE_BYTES / _recordSize) * _recordSize;
+  if(_segmentDir){
+		_segmentBytes = _segmentRecords * _recordSize;
+		_maxFileSize = max((uint32_t)(_days * _recordSize * (86400UL / _interval)), (uint32_t)(_recordSize * (3600UL / _interval)));
+  }
+}
+
+uint16_t IotaLog::storedSize(uint32_t map, bool checked){
+  return IOTALOG_RECORD_HEAD + 
+         (2 + __builtin_popcount(map & IOTALOG_ACCUMS_MASK)) * sizeof(double) * __builtin_popcount(map & IOTALOG_ALL_CHANNELS) +
+         (checked ? IOTALOG_RECORD_CRC : 0);
+}
+
+void IotaLog::writeFormat(){
+  uint8_t block[IOTALOG_FORMAT_SIZE];
+  memset(block, 0, sizeof(block));
+  IotaLogFormat* format = (IotaLogFormat*)block;
+  format->id = IOTALOG_FORMAT_ID;
+  format->version = _blockMaps ? IOTALOG_FORMAT_MAPPED : _compressed ? IOTALOG_FORMAT_BLOCKS : IOTALOG_FORMAT_VERSION;
+  format->recordSize = _recordSize;
+  format->channels = _channels | _accums;
+  format->checksum = crc32(format, offsetof(IotaLogFormat, checksum));
+  IotaFile.seek(0);
+  IotaFile.write(block, sizeof(block));
+  IotaFile.flush();
+}
+
+/*******************************************************************************************************
+ * IotaLogRecord - accum3 and accum4 are allocated by setAccums() as wanted, and copied by value.
+ *******************************************************************************************************/
+IotaLogRecord::IotaLogRecord(const IotaLogRecord& other)
+  :accum3(nullptr)
+  ,accum4(nullptr)
+  ,logged(0){
+  *this = other;
+}
+
+IotaLogRecord::~IotaLogRecord(){
+  delete[] accum3;
+  delete[] accum4;
+}
+
+IotaLogRecord& IotaLogRecord::operator=(const IotaLogRecord& other){
+  if(this == &other){
+		return *this;
+  }
+  UNIXtime = other.UNIXtime;
+  serial = other.serial;
+  logHours = other.logHours;
+  memcpy(accum1, other.accum1, sizeof(accum1));
+  memcpy(accum2, other.accum2, sizeof(accum2));
+  logged = other.logged;
+  double** accum[] = {&accum3, &accum4};
+  double* const otherAccum[] = {other.accum3, other.accum4};
+  for(int a=0; a<2; a++){
+		if(otherAccum[a]){
+			if( ! *accum[a]){
+				*accum[a] = new double[IOTALOG_CHANNELS];
+			}
+			memcpy(*accum[a], otherAccum[a], IOTALOG_CHANNELS * sizeof(double));
+		}
+		else if(*accum[a]){
+			memset(*accum[a], 0, IOTALOG_CHANNELS * sizeof(double));
+		}
+  }
+  return *this;
+}
+
+void IotaLogRecord::setAccums(uint32_t accums){
+  double** accum[] = {&accum3, &accum4};
+  for(int a=0; a<2; a++){
+		if(accums & (IOTALOG_ACCUM_THD << a)){
+			if( ! *accum[a]){
+				*accum[a] = new double[IOTALOG_CHANNELS];
+				memset(*accum[a], 0, IOTALOG_CHANNELS * sizeof(double));
+			}
+		}
+		else {
+			delete[] *accum[a];
+			*accum[a] = nullptr;
+			logged &= ~(IOTALOG_ACCUM_THD << a);
+		}
+  }
+}
+
+/*******************************************************************************************************
+ * recordAccum - accumulator n (0 to 3 for accum1 to accum4) of a record, nullptr if not allocated.
+ * storedAccum - whether the open file stores accumulator n.
+ *******************************************************************************************************/
+static double* recordAccum(const IotaLogRecord* callerRecord, int n){
+  switch(n){
+		case 0: return (double*)callerRecord->accum1;
+		case 1: return (double*)callerRecord->accum2;
+		case 2: return callerRecord->accum3;
+		default: return callerRecord->accum4;
+  }
+}
+
+bool IotaLog::storedAccum(int n){
+  return n < 2 || (_accums & (IOTALOG_ACCUM_THD << (n - 2)));
+}
+
+/*******************************************************************************************************
+ * pack - IotaLogRecord to stored record, with its crc.  Accumulators the record doesn't have are
+ *        stored as zero.
+ * unpack - stored record to IotaLogRecord, zeroing unmapped channels and accumulators the file (or a
+ *          segment with channel map word map) doesn't have, and noting in logged those it does.
+ *******************************************************************************************************/
+void IotaLog::pack(uint8_t* data, const IotaLogRecord* callerRecord){
+  uint16_t size = _recordSize - (_checked ? IOTALOG_RECORD_CRC : 0);
+  memcpy(data, callerRecord, IOTALOG_RECORD_HEAD);
+  uint8_t* stored = data + IOTALOG_RECORD_HEAD;
+  for(int n=0; n<IOTALOG_ACCUMS; n++){
+		if( ! storedAccum(n)) continue;
+		const double* accum = recordAccum(callerRecord, n);
+		if(accum && _channels == IOTALOG_ALL_CHANNELS){
+			memcpy(stored, accum, IOTALOG_CHANNELS * sizeof(double));
+			stored += IOTALOG_CHANNELS * sizeof(double);
+			continue;
+		}
+		for(int i=0; i<IOTALOG_CHANNELS; i++){
+			if(_channels & (1UL << i)){
+				double value = accum ? accum[i] : 0.0;
+				memcpy(stored, &value, sizeof(double));
+				stored += sizeof(double);
+			}
+		}
+  }
+  if(_checked){
+		uint32_t crc = crc32(data, size);
+		memcpy(data + size, &crc, sizeof(crc));
+  }
+}
+
+void IotaLog::unpack(IotaLogRecord* callerRecord, const uint8_t* data){unpack(callerRecord, data, _channels | _accums);}
+
+void IotaLog::unpack(IotaLogRecord* callerRecord, const uint8_t* data, uint32_t map){
+  memcpy((void*)callerRecord, data, IOTALOG_RECORD_HEAD);
+  const uint8_t* stored = data + IOTALOG_RECORD_HEAD;
+  uint32_t channels = map & IOTALOG_ALL_CHANNELS;
+  callerRecord->logged = 0;
+  for(int n=0; n<IOTALOG_ACCUMS; n++){
+		double* accum = recordAccum(callerRecord, n);
+		bool inFile = n < 2 || (map & (IOTALOG_ACCUM_THD << (n - 2)));
+		if(n >= 2 && accum && inFile){
+			callerRecord->logged |= IOTALOG_ACCUM_THD << (n - 2);
+		}
+		if( ! inFile){
+			if(accum){
+				memset(accum, 0, IOTALOG_CHANNELS * sizeof(double));
+			}
+			continue;
+		}
+		if(channels == IOTALOG_ALL_CHANNELS){
+			if(accum){
+				memcpy(accum, stored, IOTALOG_CHANNELS * sizeof(double));
+			}
+			stored += IOTALOG_CHANNELS * sizeof(double);
+			continue;
+		}
+		for(int i=0; i<IOTALOG_CHANNELS; i++){
+			if(channels & (1UL << i)){
+				if(accum){
+					memcpy(&accum[i], stored, sizeof(double));
+				}
+				stored += sizeof(double);
+			}
+			else if(accum){
+				accum[i] = 0;
+			}
+		}
+  }
+}
+
+/*******************************************************************************************************
+ * Block compression - varints are 7 bits per byte, low order first, high bit set on all but the last.
+ * Signed deltas are zig-zag coded so that small negative values are short too.
+ *******************************************************************************************************/
+static int putVarint(uint8_t* data, uint64_t value){
+  int len = 0;
+  while(value >= 0x80){
+		data[len++] = value | 0x80;
+		value >>= 7;
+  }
+  data[len++] = value;
+  return len;
+}
+
+static uint64_t zigzag(int64_t value){return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);}
+static int64_t unzigzag(uint64_t value){return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);}
+
+int IotaLog::fixedCount(uint32_t map){
+  return 1 + (storedSize(map, false) - IOTALOG_RECORD_HEAD) / sizeof(double);
+}
+
+void IotaLog::toFixed(int64_t* fixed, const IotaLogRecord* callerRecord, uint32_t map){
+  *fixed++ = llround(callerRecord->logHours * IOTALOG_HOURS_SCALE);
+  for(int n=0; n<IOTALOG_ACCUMS; n++){
+		if(n >= 2 && ! (map & (IOTALOG_ACCUM_THD << (n - 2)))) continue;
+		const double* accum = recordAccum(callerRecord, n);
+		for(int i=0; i<IOTALOG_CHANNELS; i++){
+			if(map & (1UL << i)){
+				*fixed++ = accum ? llround(accum[i] * IOTALOG_ACCUM_SCALE) : 0;
+			}
+		}
+  }
+}
+
+void IotaLog::fromFixed(IotaLogRecord* callerRecord, const int64_t* fixed, uint32_t map){
+  callerRecord->logHours = *fixed++ / IOTALOG_HOURS_SCALE;
+  callerRecord->logged = 0;
+  for(int n=0; n<IOTALOG_ACCUMS; n++){
+		double* accum = recordAccum(callerRecord, n);
+		bool inFile = n < 2 || (map & (IOTALOG_ACCUM_THD << (n - 2)));
+		if(n >= 2 && accum && inFile){
+			callerRecord->logged |= IOTALOG_ACCUM_THD << (n - 2);
+		}
+		for(int i=0; i<IOTALOG_CHANNELS; i++){
+			if(inFile && (map & (1UL << i))){
+				if(accum){
+					accum[i] = *fixed / IOTALOG_ACCUM_SCALE;
+				}
+				fixed++;
+			}
+			else if(accum){
+				accum[i] = 0;
+			}
+		}
+  }
+}
+
+/*******************************************************************************************************
+ * readBlocks - establish the state of a compressed log from its block index and last block.
+ * The index entry for a block is written before its first record, so a restart can leave an entry
+ * with no complete record after it.  Such entries are dropped, and anything after the last complete
+ * record is overwritten by the next write().  Returns false if the index has to be rebuilt.
+ *******************************************************************************************************/
+bool IotaLog::readBlocks(){
+  uint32_t physicalSize = IotaFile.size();
+  _blocks = BlockFile.size() / sizeof(uint32_t);
+  _fileSize = physicalSize - _dataStart;            // Decode to the physical end
+  _entries = 0;
+  _wrap = 0;
+  _firstSerial = 0;
+  _lastSerial = -1;
+  _firstKey = _lastKey = 0;
+  clearCache();
+  if(_blocks == 0){
+		return physicalSize == _dataStart;
+  }
+  if(_cursor->blockOffset(0) != _dataStart){
+		return false;
+  }
+  while(_blocks){
+		uint32_t pos = _cursor->blockOffset(_blocks - 1);
+		if(pos > physicalSize || (_blocks > 1 && pos <= _cursor->blockOffset(_blocks - 2))){
+			return false;
+		}
+		_cursor->_blockPos = pos;
+		_cursor->_blockSerial = (int32_t)(_blocks - 1) * IOTALOG_BLOCK_RECORDS - 1;
+		int32_t blockSerial = _cursor->_blockSerial;
+		while((_cursor->_blockSerial - blockSerial) < IOTALOG_BLOCK_RECORDS && _cursor->decodeNext());
+		if(_cursor->_blockSerial > blockSerial){
+			break;
+		}
+		_blocks--;
+  }
+  if(_blocks == 0){
+		return false;
+  }
+  _lastKey = _cursor->_blockKey;
+  _lastSerial = _cursor->_blockSerial;
+  _entries = _lastSerial + 1;
+  _fileSize = _cursor->_blockPos - _dataStart;
+  if( ! _writeFixed){
+		_writeFixed = new int64_t[IOTALOG_FIXED_MAX];
+  }
+  if(_blockMaps){
+		_channels = _cursor->_blockMap & IOTALOG_ALL_CHANNELS;
+		_accums = _cursor->_blockMap & IOTALOG_ACCUMS_MASK;
+		_recordSize = storedSize(_cursor->_blockMap, false);
+		_pageSize = (IOTALOG_PAGE_BYTES / _recordSize) * _recordSize;
+  }
+  memcpy(_writeFixed, _cursor->_blockFixed, fixedCount(_cursor->_blockMap) * sizeof(int64_t));
+  _writeKey = _lastKey;
+  _cursor->_blockPos = _dataStart;
+  _cursor->_blockSerial = -1;
+  _cursor->decodeNext();
+  _firstKey = _cursor->_blockKey;
+  clearCache();
+  return true;
+}
+
+/*******************************************************************************************************
+ * rebuildBlocks - recreate the block index by decoding the whole log, then resume as readBlocks().
+ *******************************************************************************************************/
+void IotaLog::rebuildBlocks(){
+  log("IotaLog: rebuilding block index %s\r\n", _blockPath);
+  BlockFile.close();
+  SD.remove(_blockPath);
+  BlockFile = SD.open(_blockPath, FILE_WRITE);
+  _blocks = 0;
+  _fileSize = IotaFile.size() - _dataStart;
+  clearCache();
+  _cursor->_blockPos = _dataStart;
+  _cursor->_blockSerial = -1;
+  while(true){
+		uint32_t pos = _cursor->_blockPos;
+		if( ! _cursor->decodeNext()){
+			break;
+		}
+		if((_cursor->_blockSerial % IOTALOG_BLOCK_RECORDS) == 0){
+			appendBlock(pos, false);
+			yield();
+		}
+  }
+  BlockFile.flush();
+  readBlocks();
+}
+
+void IotaLog::appendBlock(uint32_t pos, bool flush){
+  BlockFile.seek(_blocks * sizeof(uint32_t));
+  BlockFile.write((uint8_t*)&pos, sizeof(pos));
+  if(flush){
+		BlockFile.flush();
+  }
+  _blocks++;
+}
+
+/*******************************************************************************************************
+ * writeBlock - write() for a compressed log.
+ *******************************************************************************************************/
+int IotaLog::writeBlock(IotaLogRecord* callerRecord, bool hole){
+  int32_t serial = callerRecord->serial;
+  uint32_t pos = _dataStart + _fileSize;
+  uint32_t map = _channels | _accums;
+  int count = fixedCount(map);
+  if( ! _writeFixed){
+		_writeFixed = new int64_t[IOTALOG_FIXED_MAX];
+  }
+  uint8_t data[IOTALOG_BLOCK_RECORD_MAX];
+  int len = 0;
+  if(((serial - _firstSerial) % IOTALOG_BLOCK_RECORDS) == 0){
+		appendBlock(pos, _commitRecords == 1);
+		_writeKey = 0;
+		memset(_writeFixed, 0, count * sizeof(int64_t));
+		if(_blockMaps){
+			len = putVarint(data, map);
+		}
+  }
+  int64_t fixed[IOTALOG_FIXED_MAX];
+  toFixed(fixed, callerRecord, map);
+  len += putVarint(data + len, callerRecord->UNIXtime - _writeKey);
+  for(int i=0; i<count; i++){
+		len += putVarint(data + len, zigzag(fixed[i] - _writeFixed[i]));
+  }
+  data[len] = crc32(data, len, crc32(&serial, sizeof(serial)));
+  len++;
+  IotaFile.seek(pos);
+  IotaFile.write(data, len);
+  if(_commitRecords > 1){
+		if(_commitCount++ == 0){
+			_commitKey = callerRecord->UNIXtime;
+		}
+  }
+  else {
+		IotaFile.flush();
+  }
+  memcpy(_writeFixed, fixed, count * sizeof(int64_t));
+  _writeKey = callerRecord->UNIXtime;
+  _fileSize += len;
+  _entries++;
+  _lastKey = callerRecord->UNIXtime;
+  _lastSerial = serial;
+  if(_firstKey == 0){
+		_firstKey = _lastKey;
+  }
+  if(hole && _indexValid){
+		addIndex(_lastKey, _lastSerial);
+		appendIndex();
+  }
+  if(_commitCount && (_commitCount >= _commitRecords || (_lastKey - _commitKey) >= _commitSeconds)){
+		commit();
+  }
+  return 0;
+}
+
+/*******************************************************************************************************
+ * serialKey - key of the record with a given serial, for findHoles().
+ *******************************************************************************************************/
+uint32_t IotaLog::serialKey(int32_t serial){
+  if(_compressed || _segmentDir){
+		IotaLogRecord* callerRecord = new IotaLogRecord;
+		_cursor->readSerial(callerRecord, serial);
+		uint32_t key = callerRecord->UNIXtime;
+		delete callerRecord;
+		return key;
+  }
+  IotaFile.seek(_dataStart + ((serial - _firstSerial) * _recordSize + _wrap) % _fileSize);
+  IotaFile.read(&record, sizeof(record));
+  return record.UNIXtime;
+}
+
+/*******************************************************************************************************
+ * crc32 - standard (zip) CRC-32 of len bytes, using a 16 entry table to keep it small.
+ *******************************************************************************************************/
+uint32_t IotaLog::crc32(const void* data, size_t len, uint32_t crc){
+  static const uint32_t table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+  const uint8_t* byte = (const uint8_t*)data;
+  crc = ~crc;
+  while(len--){
+		crc = table[(crc ^ *byte) & 0x0F] ^ (crc >> 4);
+		crc = table[(crc ^ (*byte++ >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+/*******************************************************************************************************
+ * loadIndex - load the hole index (.ndx) at begin().
+ * Entries that have wrapped out of the log are dropped, as is anything beyond the end of the log or
+ * out of order.  If the last run of the index doesn't reach the end of the log arithmetically, there
+ * are unindexed holes (no index yet, or a restart between writing a record and its index entry) and
+ * they are found with findHoles().  The file is rewritten if it changed.
+ *******************************************************************************************************/
+void IotaLog::loadIndex(){
+  _indexCount = 0;
+  _indexFloor = 0;
+  _indexValid = false;
+  bool rewrite = true;
+  File indexFile = SD.open(_indexPath, FILE_READ);
+  if(indexFile){
+		IotaLogIndexHeader header;
+		IotaLogIndex entry[IOTALOG_INDEX_GROW];
+		if(indexFile.read(&header, sizeof(header)) == sizeof(header) &&
+			 header.id == IOTALOG_INDEX_ID && header.interval == _interval){
+			rewrite = false;
+			_indexFloor = header.floor;
+			int len;
+			bool bad = false;
+			while( ! bad && (len = indexFile.read(entry, sizeof(entry))) >= (int)sizeof(IotaLogIndex)){
+				for(int i=0; i<len / (int)sizeof(IotaLogIndex); i++){
+					if(entry[i].serial <= _firstSerial){
+						rewrite = true;
+						continue;
+					}
+					if(entry[i].serial > _lastSerial || entry[i].key > _lastKey || 
+						 (_indexCount && (entry[i].serial <= _index[_indexCount-1].serial || entry[i].key <= _index[_indexCount-1].key))){
+						rewrite = bad = true;
+						break;
+					}
+					addIndex(entry[i].key, entry[i].serial);
+				}
+			}
+		}
+		indexFile.close();
+  }
+  if(_entries){
+		uint32_t lowKey = _indexCount ? _index[_indexCount-1].key : _firstKey;
+		int32_t lowSerial = _indexCount ? _index[_indexCount-1].serial : _firstSerial;
+		if((_lastKey - lowKey) != (uint32_t)(_lastSerial - lowSerial) * _interval){
+			findHoles(lowKey, lowSerial, _lastKey, _lastSerial);
+			rewrite = true;
+		}
+  }
+  if(rewrite){
+		saveIndex();
+  }
+  _indexValid = true;
+}
+
+void IotaLog::saveIndex(){
+  SD.remove(_indexPath);
+  File indexFile = SD.open(_indexPath, FILE_WRITE);
+  if( ! indexFile){
+		return;
+  }
+  IotaLogIndexHeader header;
+  header.id = IOTALOG_INDEX_ID;
+  header.interval = _interval;
+  header.floor = _indexFloor;
+  indexFile.write((char*)&header, sizeof(header));
+  if(_indexCount){
+		indexFile.write((char*)_index, _indexCount * sizeof(IotaLogIndex));
+  }
+  indexFile.close();
+}
+
+/*******************************************************************************************************
+ * addIndex - add a hole to the end of the index, dropping the oldest when full.
+ *******************************************************************************************************/
+void IotaLog::addIndex(uint32_t key, int32_t serial){
+  if(_indexCount == IOTALOG_INDEX_MAX){
+		_indexFloor = _index[0].serial;
+		memmove(_index, _index + 1, --_indexCount * sizeof(IotaLogIndex));
+  }
+  if(_indexCount == _indexAlloc){
+		_indexAlloc = min(_indexAlloc + IOTALOG_INDEX_GROW, IOTALOG_INDEX_MAX);
+		IotaLogIndex* index = new IotaLogIndex[_indexAlloc];
+		if(_indexCount){
+			memcpy(index, _index, _indexCount * sizeof(IotaLogIndex));
+		}
+		delete[] _index;
+		_index = index;
+  }
+  _index[_indexCount].key = key;
+  _index[_indexCount++].serial = serial;
+}
+
+/*******************************************************************************************************
+ * appendIndex - persist the hole just added by write().
+ * Once the index is full, each new hole drops an old one, so the file is rewritten to record the floor.
+ *******************************************************************************************************/
+void IotaLog::appendIndex(){
+  File indexFile = SD.open(_indexPath, FILE_WRITE);
+  if( ! indexFile || indexFile.size() == 0 || _indexCount == IOTALOG_INDEX_MAX){
+		indexFile.close();
+		saveIndex();
+		return;
+  }
+  indexFile.write((char*)&_index[_indexCount-1], sizeof(IotaLogIndex));
+  indexFile.close();
+}
+
+/*******************************************************************************************************
+ * pruneIndex - drop holes that have wrapped out of the log.
+ * They stay in the file until the next begin().
+ *******************************************************************************************************/
+void IotaLog::pruneIndex(){
+  int drop = 0;
+  while(drop < _indexCount && _index[drop].serial <= _firstSerial){
+		drop++;
+  }
+  if(drop){
+		_indexCount -= drop;
+		memmove(_index, _index + drop, _indexCount * sizeof(IotaLogIndex));
+  }
+}
+
+/*******************************************************************************************************
+ * reindex - index the holes at either end of a range of records repair() has rewritten.  There are
+ * none inside it, as the records replaced follow on from the key before or lead into the key after.
+ *******************************************************************************************************/
+void IotaLog::reindex(int32_t low, int32_t high){
+  int count = 0;
+  for(int i=0; i<_indexCount; i++){
+		if(_index[i].serial < low || _index[i].serial > high){
+			_index[count++] = _index[i];
+		}
+  }
+  _indexCount = count;
+  int32_t ends[] = {low, high};
+  for(int32_t serial : ends){
+		if(serial <= _firstSerial || serial > _lastSerial || serial <= _indexFloor){
+			continue;
+		}
+		uint32_t key = serialKey(serial);
+		if(key == serialKey(serial - 1) + _interval){
+			continue;
+		}
+		if(_indexCount == IOTALOG_INDEX_MAX && serial < _index[0].serial){
+			_indexFloor = _index[0].serial;
+			continue;
+		}
+		addIndex(key, serial);
+		for(int i=_indexCount-1; i>0 && _index[i-1].serial > serial; i--){
+			IotaLogIndex swap = _index[i];
+			_index[i] = _index[i-1];
+			_index[i-1] = swap;
+		}
+  }
+  saveIndex();
+}
+
+/*******************************************************************************************************
+ * findHoles - add the holes between two records to the index by bisection.
+ * There is no hole in a range whose keys are exactly one interval per serial apart,
+ * so the cost is about log2(range) reads per hole.
+ *******************************************************************************************************/
+void IotaLog::findHoles(uint32_t lowKey, int32_t lowSerial, uint32_t highKey, int32_t highSerial){
+  if((highKey - lowKey) == (uint32_t)(highSerial - lowSerial) * _interval){
+		return;
+  }
+  if((highSerial - lowSerial) == 1){
+		addIndex(highKey, highSerial);
+		return;
+  }
+  int32_t midSerial = lowSerial + (highSerial - lowSerial) / 2;
+  uint32_t midKey = serialKey(midSerial);
+  yield();
+  findHoles(lowKey, lowSerial, midKey, midSerial);
+  findHoles(midKey, midSerial, highKey, highSerial);
+}
+
+uint32_t IotaLog::findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos, uint32_t lowKey){
+  struct {
+	uint32_t UNIXtime;
+	uint32_t serial; 
+  } record;
+  
+  if((lowPos - highPos) == _recordSize) {
+		return lowPos;
+  }
+  uint32_t midPos = (highPos + lowPos) / 2;
+  midPos -= midPos % _recordSize;
+  IotaFile.seek(_dataStart + midPos);
+  IotaFile.read(&record, sizeof(record));
+  uint32_t midKey = record.UNIXtime;
+  if(midKey > highKey){
+		return findWrap(midPos, midKey, lowPos, lowKey);
+  }
+  return findWrap(highPos, highKey, midPos, midKey);
+}
+
+int IotaLog::readKey(IotaLogRecord* callerRecord){return _cursor->readKey(callerRecord);}
+int IotaLog::readSerial(IotaLogRecord* callerRecord, int32_t serial){return _cursor->readSerial(callerRecord, serial);}
+int IotaLog::readNext(IotaLogRecord* callerRecord){return _cursor->readNext(callerRecord);}
+uint32_t IotaLog::readRange(IotaLogRecord* callerRecord, uint32_t begin, uint32_t end, uint32_t step, IotaLogRangeCallback callback){
+  return _cursor->readRange(callerRecord, begin, end, step, callback);
+}
+
+void IotaLog::clearCache(){
+  for(IotaLogCursor* cursor = _cursors; cursor; cursor = cursor->_next){
+		cursor->clearCache();
+  }
+  freeTail();
+}
+
+int IotaLog::end(){
+  commit();
+  freeCommit();
+  writeHeader();
+  IotaFile.close();
+  BlockFile.close();
+  clearCache();
+  return 0;
+}
+
+boolean IotaLog::isOpen(){
+  if(IotaFile) return true;
+  return false;
+}
+
+uint32_t IotaLog::firstKey(){return _firstKey;}
+int32_t IotaLog::firstSerial(){return _firstSerial;}
+uint32_t IotaLog::lastKey(){return _lastKey;}
+int32_t IotaLog::lastSerial(){return _lastSerial;}
+uint32_t IotaLog::fileSize(){return _fileSize;}
+uint32_t IotaLog::readKeyIO(){return _readKeyIO;}
+uint32_t IotaLog::interval(){return _interval;}
+uint32_t IotaLog::channels(){return _channels;}
+uint32_t IotaLog::accums(){return _accums;}
+bool IotaLog::compressed(){return _compressed;}
+bool IotaLog::remaps(){return _blockMaps || _segmentDir;}
+uint16_t IotaLog::recordSize(){return _recordSize;}
+
+/*******************************************************************************************************
+ * setChannels - set the channel map used if begin() creates the file.  An open file keeps its map,
+ * unless it is a compressed log with a map per block or a segmented log (remaps()), which takes it up
+ * at its next block or in a new segment at its next write().
+ *******************************************************************************************************/
+uint32_t IotaLog::setChannels(uint32_t channels){
+  channels &= IOTALOG_ALL_CHANNELS;
+  _newChannels = channels ? channels : IOTALOG_ALL_CHANNELS;
+  return _newChannels;
+}
+
+/*******************************************************************************************************
+ * setAccums - set the accumulators beyond accum1 and accum2 (IOTALOG_ACCUM_THD, IOTALOG_ACCUM_VAR)
+ * stored if begin() creates the file.  An open file keeps its own, as for setChannels().
+ *******************************************************************************************************/
+uint32_t IotaLog::setAccums(uint32_t accums){
+  _newAccums = accums & IOTALOG_ACCUMS_MASK;
+  return _newAccums;
+}
+
+/*******************************************************************************************************
+ * setCompress - set whether begin() creates a block compressed file.  An open file keeps its format.
+ *******************************************************************************************************/
+bool IotaLog::setCompress(bool compress){
+  _newCompress = compress;
+  return _newCompress;
+}
+
+/*******************************************************************************************************
+ * setDays - set the retention of the log.  A single file can't be made smaller than it is;
+ * a segmented log drops any segments it no longer needs at once.
+ *******************************************************************************************************/
+uint32_t IotaLog::setDays(uint32_t days){
+	_days = days;
+	_maxFileSize = days * _recordSize * (86400UL / _interval);
+	if( ! _segmentDir){
+		_maxFileSize = max(_fileSize, _maxFileSize);
+	}
+	_maxFileSize = max(_maxFileSize, (uint32_t)(_recordSize * (3600UL / _interval)));
+	if(_segmentDir && IotaFile){
+		trimSegments();
+	}
+	return _maxFileSize / (_recordSize * (86400 / _interval));
+}
+  
+int IotaLog::write (IotaLogRecord* callerRecord){
+
+  if(!IotaFile){
+		return 2;
+  }
+  if(callerRecord->UNIXtime <= _lastKey) {
+		return 1;
+  }
+  if(_segmentDir && (_fileSize - _segmentStart >= _segmentBytes || (_channels | _accums) != (_newChannels | _newAccums)) &&
+     ! newSegment()){
+		return 2;
+  }
+  bool hole = _entries && callerRecord->UNIXtime != _lastKey + _interval;
+  callerRecord->serial = ++_lastSerial;
+  if(_blockMaps && ((_lastSerial - _firstSerial) % IOTALOG_BLOCK_RECORDS) == 0){
+		remap();
+  }
+  uint8_t data[IOTALOG_RECORD_MAX];
+  pack(data, callerRecord);
+  writeTail(data);
+  if(_compressed){
+		return writeBlock(callerRecord, hole);
+  }
+  uint32_t pos;
+  if( ! _segmentDir && (_wrap || _fileSize >= _maxFileSize)){
+		pos = _wrap;
+		_wrap = (_wrap + _recordSize) % _fileSize;
+  }
+  else {
+		pos = _fileSize;
+		_fileSize += _recordSize;
+		_entries++;
+		if(_extent && _dataStart + _fileSize - _segmentStart > IotaFile.size()){
+			extend();
+		}
+		if(pos == _segmentStart){
+			_segmentKey = callerRecord->UNIXtime;
+		}
+  }
+  if(_commitRecords > 1 && (_commitBuffer || commitAlloc())){
+		if(_commitCount && pos != _commitPos + _commitCount * _recordSize){
+			commit();
+		}
+		if(_commitCount == 0){
+			_commitPos = pos;
+			_commitKey = callerRecord->UNIXtime;
+		}
+		memcpy(_commitBuffer + _commitCount++ * _recordSize, data, _recordSize);
+  }
+  else {
+		IotaFile.seek(_dataStart + pos - _segmentStart);
+		IotaFile.write(data, _recordSize);
+		IotaFile.flush();
+  }
+  for(IotaLogCursor* cursor = _cursors; cursor; cursor = cursor->_next){
+		cursor->writeCache(data, pos);
+  }
+  _headerWrites++;
+  _lastKey = callerRecord->UNIXtime;
+  _lastSerial = callerRecord->serial;
+  if(_firstKey == 0){
+		_firstKey = callerRecord->UNIXtime;
+  }
+  else if( ! _segmentDir && (_wrap || _fileSize == _maxFileSize)){
+		IotaFile.seek(_dataStart + _wrap);
+		IotaFile.read((char*)callerRecord,8);
+		_firstKey = callerRecord->UNIXtime;
+		_firstSerial = callerRecord->serial;
+		callerRecord->UNIXtime = _lastKey;
+		callerRecord->serial = _lastSerial;
+		pruneIndex();
+  }
+  if(hole && _indexValid){
+		addIndex(_lastKey, _lastSerial);
+		appendIndex();
+  }
+
+					// Commit the group when full, when it ends on a group boundary (so that later
+					// groups are aligned) or when the oldest record has waited long enough.
+					// The header is only checkpointed with nothing buffered.
+
+  if(_commitCount && (_commitCount >= _commitRecords || 
+		 ((pos - _segmentStart + _recordSize) % (_commitRecords * _recordSize)) == 0 ||
+		 (_lastKey - _commitKey) >= _commitSeconds)){
+		commit();
+  }
+  if(_headerWrites >= IOTALOG_HEADER_WRITES && _commitCount == 0){
+		writeHeader();
+  }
+  
+  return 0;
+}
+
+/*******************************************************************************************************
+ * setCommit - set group commit.
+ * write() buffers up to records records, or records spanning seconds, and writes them to the file
+ * with one write and flush.  records = 1 writes and flushes each record (the default).
+ * A compressed log writes each record as it comes, and flushes it and the block index per group.
+ * Buffered records are visible to readers, but are lost if the IotaWatt restarts without end().
+ * Returns the records per commit.
+ *******************************************************************************************************/
+uint32_t IotaLog::setCommit(uint32_t records, uint32_t seconds){
+  commit();
+  freeCommit();
+  _commitRecords = constrain(records, 1, IOTALOG_COMMIT_MAX);
+  _commitSeconds = seconds;
+  return _commitRecords;
+}
+
+/*******************************************************************************************************
+ * commitAlloc - allocate the group commit buffer of an uncompressed log, at its first buffered write,
+ *               within the heap budget.  False if it can't, and write() writes through.
+ * freeCommit - give back the buffer, which must be empty.
+ *******************************************************************************************************/
+bool IotaLog::commitAlloc(){
+  uint32_t size = _commitRecords * _recordSize;
+  if(::heapUsed + size > IOTALOG_HEAP_BUDGET){
+		return false;
+  }
+  _commitBuffer = new uint8_t[size];
+  if( ! _commitBuffer){
+		return false;
+  }
+  _commitBytes = size;
+  ::heapUsed += size;
+  return true;
+}
+
+void IotaLog::freeCommit(){
+  if(_commitBuffer){
+		::heapUsed -= _commitBytes;
+		delete[] _commitBuffer;
+  }
+  _commitBuffer = nullptr;
+  _commitBytes = 0;
+}
+
+/*******************************************************************************************************
+ * commit - write any buffered records to the file.
+ *******************************************************************************************************/
+int IotaLog::commit(){
+  if(_commitCount == 0){
+		return 0;
+  }
+  if(!IotaFile){
+		return 2;
+  }
+  if(_compressed){																						// Records written, not flushed
+		IotaFile.flush();
+		BlockFile.flush();
+		_commitCount = 0;
+		return 0;
+  }
+  IotaFile.seek(_dataStart + _commitPos - _segmentStart);
+  IotaFile.write(_commitBuffer, _commitCount * _recordSize);
+  IotaFile.flush();
+  _commitCount = 0;
+  return 0;
+}
+
+/*******************************************************************************************************
+ * setPreallocate - grow an unwrapped log bytes at a time ahead of write() (0 = as written).
+ * extend - preallocate the next extent, zero filled, up to the maximum file (or segment) size.
+ *******************************************************************************************************/
+uint32_t IotaLog::setPreallocate(uint32_t bytes){
+  _extent = bytes;
+  return _extent;
+}
+
+void IotaLog::extend(){
+  uint32_t size = IotaFile.size();
+  uint32_t limit = _segmentDir ? _segmentBytes : _maxFileSize;
+  uint32_t end = max(_dataStart + _fileSize - _segmentStart, min(size + _extent, _dataStart + limit));
+  uint8_t* zeros = new uint8_t[512];
+  memset(zeros, 0, 512);
+  IotaFile.seek(size);
+  while(size < end){
+		uint32_t len = min(512 - (size % 512), end - size);
+		IotaFile.write(zeros, len);
+		size += len;
+  }
+  IotaFile.flush();
+  delete[] zeros;
+}
+
+/*******************************************************************************************************
+ * setSegmentDays - create the log as segments of days each if begin() creates it (0 = one file).
+ * segmentPath - path of segment file number.
+ *******************************************************************************************************/
+uint32_t IotaLog::setSegmentDays(uint32_t days){
+  _newSegmentDays = days;
+  return _newSegmentDays;
+}
+
+String IotaLog::segmentPath(uint32_t number){
+  char name[26];                                      // "/", up to 20 digits of %lu, ".log"
+  snprintf(name, sizeof(name), "/%08lu.log", (unsigned long)number);
+  return String(_segmentDir) + name;
+}
+
+/*******************************************************************************************************
+ * beginSegments - find the segment being written at begin(), from the segment index or failing that
+ * the directory.  A listed index is completed by rebuildSegments() once the record format is known.
+ * readSegments - load the segment index.  Returns false if it is missing or inconsistent.
+ * listSegments - list the segment files in the directory.  The newest is the one being written.
+ *******************************************************************************************************/
+bool IotaLog::beginSegments(){
+  if( ! SD.mkdir(_segmentDir)){
+		Serial.printf_P(PSTR("mkdir failed: %s\r\n"), _segmentDir);
+		return false;
+  }
+  if( ! readSegments()){
+		listSegments();
+  }
+  return true;
+}
+
+bool IotaLog::readSegments(){
+  File indexFile = SD.open(String(_segmentDir) + IOTALOG_SEGMENT_INDEX, FILE_READ);
+  if( ! indexFile){
+		return false;
+  }
+  IotaLogSegmentHeader header;
+  IotaLogSegment entry;
+  bool good = indexFile.read(&header, sizeof(header)) == sizeof(header) && header.id == IOTALOG_SEGMENT_ID &&
+              header.interval == _interval && header.records && header.number;
+  while(good && indexFile.read(&entry, sizeof(entry)) == sizeof(entry)){
+		if(entry.number >= header.number || entry.records == 0 || entry.records > header.records ||
+			 (entry.map & IOTALOG_ALL_CHANNELS) == 0 || (entry.map & ~(IOTALOG_ALL_CHANNELS | IOTALOG_ACCUMS_MASK)) ||
+			 (_segmentCount && (entry.number <= _segments[_segmentCount-1].number || entry.firstSerial != fileSerial()))){
+			good = false;
+		}
+		addSegment(entry.number, entry.firstKey, entry.firstSerial, entry.records, entry.map);
+  }
+  indexFile.close();
+  if( ! good){
+		_segmentCount = 0;
+		return false;
+  }
+  _segmentNumber = header.number;
+  _segmentRecords = header.records;
+  return true;
+}
+
+void IotaLog::listSegments(){
+  _segmentCount = 0;
+  File dir = SD.open(_segmentDir);
+  if(dir && dir.isDirectory()){
+		while(File entry = dir.openNextFile()){
+			const char* name = entry.name();
+			uint32_t number = 0;
+			int digits = 0;
+			while(digits < 8 && isdigit(name[digits])){
+				number = number * 10 + name[digits++] - '0';
+			}
+			if(digits == 8 && number && strcasecmp(name + 8, ".log") == 0){
+				addSegment(number, 0, 0, 0, 0);
+				for(int i=_segmentCount-1; i>0 && _segments[i-1].number > number; i--){
+					IotaLogSegment swap = _segments[i];
+					_segments[i] = _segments[i-1];
+					_segments[i-1] = swap;
+				}
+			}
+			entry.close();
+		}
+  }
+  dir.close();
+  _segmentNumber = _segmentCount ? _segments[--_segmentCount].number : 1;
+}
+
+/*******************************************************************************************************
+ * rebuildSegments - complete a segment index listed from the directory with the map, first key, serial
+ * and records of each full segment, from its format block and records.  Zero filled records preallocated
+ * past the last are not counted.  The records per segment are the most in a full segment or, if there
+ * isn't one, setSegmentDays() of them but no fewer than the segment being written has room for.
+ * Only the newest run of full segments with consecutive serials is kept.
+ *******************************************************************************************************/
+void IotaLog::rebuildSegments(){
+  for(int i=0; i<_segmentCount; i++){
+		File segmentFile = SD.open(segmentPath(_segments[i].number), FILE_READ);
+		IotaLogFormat format;
+		if(segmentFile && segmentFile.read(&format, sizeof(format)) == sizeof(format) &&
+			 format.id == IOTALOG_FORMAT_ID && format.version == IOTALOG_FORMAT_VERSION &&
+			 format.checksum == crc32(&format, offsetof(IotaLogFormat, checksum)) &&
+			 (format.channels & IOTALOG_ALL_CHANNELS) && format.recordSize == storedSize(format.channels, true) &&
+			 segmentFile.size() >= (uint32_t)(IOTALOG_FORMAT_SIZE + format.recordSize)){
+			uint32_t size = format.recordSize;
+			uint32_t low = 1;
+			uint32_t high = (segmentFile.size() - IOTALOG_FORMAT_SIZE) / size;
+			while(low < high){
+				uint32_t mid = (low + high + 1) / 2;
+				segmentFile.seek(IOTALOG_FORMAT_SIZE + (mid - 1) * size);
+				segmentFile.read(&record, sizeof(record));
+				if(record.UNIXtime){
+					low = mid;
+				} else {
+					high = mid - 1;
+				}
+			}
+			segmentFile.seek(IOTALOG_FORMAT_SIZE);
+			segmentFile.read(&record, sizeof(record));
+			_segments[i].firstKey = record.UNIXtime;
+			_segments[i].firstSerial = record.serial;
+			_segments[i].records = low;
+			_segments[i].map = format.channels;
+			_segmentRecords = max(_segmentRecords, low);
+		}
+		segmentFile.close();
+  }
+  if(_segmentRecords == 0){
+		uint32_t perPage = _pageSize / _recordSize;
+		uint32_t records = max(_newSegmentDays, (uint32_t)1) * (86400UL / _interval);
+		if(IotaFile.size() > _dataStart){
+			records = max(records, (IotaFile.size() - _dataStart) / _recordSize);
+		}
+		_segmentRecords = ((records + perPage - 1) / perPage) * perPage;
+  }
+  int first = _segmentCount;
+  while(first && _segments[first-1].firstKey && _segments[first-1].records &&
+        (first == _segmentCount ||
+         _segments[first-1].firstSerial + (int32_t)_segments[first-1].records == _segments[first].firstSerial)){
+		first--;
+  }
+  if(first){
+		log("IotaLog: %d segments out of sequence %s\r\n", first, _segmentDir);
+		_segmentCount -= first;
+		memmove(_segments, _segments + first, _segmentCount * sizeof(IotaLogSegment));
+  }
+  for(int i=0; i<_segmentCount; i++){
+		_segments[i].start = i ? _segments[i-1].start + _segments[i-1].records * storedSize(_segments[i-1].map, true) : 0;
+  }
+  saveSegments();
+}
+
+/*******************************************************************************************************
+ * saveSegments - write the segment index.
+ * addSegment - add a full segment to the end of the index, starting where the one before it ends.
+ * segmentAt - index of the full segment holding log position pos, or _segmentCount for the one being
+ *             written.
+ * layout - record size of the segment holding pos, with its map and the log positions it spans.
+ *******************************************************************************************************/
+void IotaLog::saveSegments(){
+  String indexPath = String(_segmentDir) + IOTALOG_SEGMENT_INDEX;
+  SD.remove(indexPath);
+  File indexFile = SD.open(indexPath, FILE_WRITE);
+  if( ! indexFile){
+		return;
+  }
+  IotaLogSegmentHeader header;
+  header.id = IOTALOG_SEGMENT_ID;
+  header.interval = _interval;
+  header.records = _segmentRecords;
+  header.number = _segmentNumber;
+  indexFile.write((char*)&header, sizeof(header));
+  if(_segmentCount){
+		indexFile.write((char*)_segments, _segmentCount * sizeof(IotaLogSegment));
+  }
+  indexFile.close();
+}
+
+void IotaLog::addSegment(uint32_t number, uint32_t firstKey, int32_t firstSerial, uint32_t records, uint32_t map){
+  if(_segmentCount == _segmentAlloc){
+		_segmentAlloc += IOTALOG_SEGMENT_GROW;
+		IotaLogSegment* segments = new IotaLogSegment[_segmentAlloc];
+		if(_segmentCount){
+			memcpy(segments, _segments, _segmentCount * sizeof(IotaLogSegment));
+		}
+		delete[] _segments;
+		_segments = segments;
+  }
+  IotaLogSegment& segment = _segments[_segmentCount];
+  segment.number = number;
+  segment.firstKey = firstKey;
+  segment.firstSerial = firstSerial;
+  segment.records = records;
+  segment.map = map;
+  segment.start = 0;
+  if(_segmentCount){
+		IotaLogSegment& prev = _segments[_segmentCount-1];
+		segment.start = prev.start + prev.records * storedSize(prev.map, true);
+  }
+  _segmentCount++;
+}
+
+int IotaLog::segmentAt(uint32_t pos){
+  if(pos >= _segmentStart){
+		return _segmentCount;
+  }
+  int low = 0;
+  int high = _segmentCount - 1;
+  while(low < high){
+		int mid = (low + high + 1) / 2;
+		if(_segments[mid].start <= pos){
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+  }
+  return low;
+}
+
+uint16_t IotaLog::layout(uint32_t pos, uint32_t& start, uint32_t& end, uint32_t& map){
+  int i = _segmentDir ? segmentAt(pos) : _segmentCount;
+  if(i == _segmentCount){
+		start = _segmentStart;
+		end = _fileSize;
+		map = _channels | _accums;
+		return _recordSize;
+  }
+  uint16_t size = storedSize(_segments[i].map, true);
+  start = _segments[i].start;
+  end = start + _segments[i].records * size;
+  map = _segments[i].map;
+  return size;
+}
+
+/*******************************************************************************************************
+ * newSegment - start the next segment when the one being written is full, or has a map other than
+ * that set by setChannels() and setAccums().  The new segment takes up the new map.  An empty segment
+ * is started over rather than left in the index.
+ * The file is created before the index records it, so after a restart in between the full segment
+ * is still the one being written and the next write() starts the new one again.
+ * trimSegments - delete the oldest segments while the rest hold setDays() of records.  Log positions
+ * move down by the size of the segments deleted, so the cursors' caches are cleared.
+ *******************************************************************************************************/
+bool IotaLog::newSegment(){
+  commit();
+  if(_fileSize > _segmentStart){
+		addSegment(_segmentNumber++, _segmentKey, fileSerial(), (_fileSize - _segmentStart) / _recordSize, _channels | _accums);
+		_segmentStart = _fileSize;
+  }
+  String segmentFile = segmentPath(_segmentNumber);
+  delete[] _path;
+  _path = new char[segmentFile.length()+1];
+  strcpy(_path, segmentFile.c_str());
+  IotaFile.close();
+  SD.remove(_path);
+  IotaFile = SD.open(_path, FILE_WRITE);
+  if( ! IotaFile){
+		return false;
+  }
+  if((_channels | _accums) != (_newChannels | _newAccums)){
+		remap();
+  }
+  writeFormat();
+  saveSegments();
+  trimSegments();
+  writeHeader();
+  return true;
+}
+
+void IotaLog::trimSegments(){
+  uint32_t maxRecords = _maxFileSize / _recordSize;
+  if(_segmentCount == 0 || _entries - _segments[0].records < maxRecords){
+		return;
+  }
+  commit();
+  while(_segmentCount && _entries - _segments[0].records >= maxRecords){
+		SD.remove(segmentPath(_segments[0].number));
+		uint32_t bytes = _segmentCount > 1 ? _segments[1].start : _segmentStart;
+		_entries -= _segments[0].records;
+		memmove(_segments, _segments + 1, --_segmentCount * sizeof(IotaLogSegment));
+		for(int i=0; i<_segmentCount; i++){
+			_segments[i].start -= bytes;
+		}
+		_fileSize -= bytes;
+		_segmentStart -= bytes;
+  }
+  _firstKey = _segmentCount ? _segments[0].firstKey : _segmentKey;
+  _firstSerial = _segmentCount ? _segments[0].firstSerial : _lastSerial + 1 - (int32_t)_entries;
+  saveSegments();
+  pruneIndex();
+  for(IotaLogCursor* cursor = _cursors; cursor; cursor = cursor->_next){
+		cursor->clearCache();
+  }
+}
+
+/*******************************************************************************************************
+ * joinSegments - extend the state of the newest segment, as found by begin() or repair(), to the whole
+ * log, with the full segments before it.  If the newest segment is empty, the last record is the last
+ * of the full segment before it.
+ * splitSegments - back to the state of the newest segment alone, for repair().
+ *******************************************************************************************************/
+void IotaLog::joinSegments(){
+  _segmentKey = _firstKey;
+  if( ! _segmentDir || _segmentCount == 0){
+		return;
+  }
+  IotaLogSegment& last = _segments[_segmentCount-1];
+  if(_fileSize == 0){
+		File segmentFile = SD.open(segmentPath(last.number), FILE_READ);
+		segmentFile.seek(IOTALOG_FORMAT_SIZE + (last.records - 1) * storedSize(last.map, true));
+		segmentFile.read(&record, sizeof(record));
+		segmentFile.close();
+		_lastKey = record.UNIXtime;
+		_lastSerial = record.serial;
+  }
+  _segmentStart = last.start + last.records * storedSize(last.map, true);
+  _fileSize += _segmentStart;
+  _entries += fileSerial() - _segments[0].firstSerial;
+  _firstKey = _segments[0].firstKey;
+  _firstSerial = _segments[0].firstSerial;
+}
+
+void IotaLog::splitSegments(){
+  if(_segmentStart == 0){
+		return;
+  }
+  _fileSize -= _segmentStart;
+  _segmentStart = 0;
+  _entries = _fileSize / _recordSize;
+  _firstKey = _segmentKey;
+  _firstSerial = _lastSerial + 1 - (int32_t)_entries;
+  if(_fileSize == 0){
+		_firstKey = _lastKey = 0;
+		_firstSerial = 0;
+		_lastSerial = -1;
+  }
+}
+
+/*******************************************************************************************************
+ * setTail - keep the records written in the last seconds in RAM, as far as IOTALOG_TAIL_BYTES allows.
+ *******************************************************************************************************/
+uint32_t IotaLog::setTail(uint32_t seconds){
+  _tailSeconds = seconds;
+  freeTail();
+  return _tailSeconds;
+}
+
+/*******************************************************************************************************
+ * writeTail - add a stored record, just written, to the tail ring.
+ * freeTail - empty the ring and give back its heap.
+ * readTail - get a record by serial from the ring, false if it isn't there.
+ * searchTail - get the record with a key, or the next lower key, from the ring.  False if the key
+ *              precedes the ring.
+ *******************************************************************************************************/
+void IotaLog::writeTail(const uint8_t* data){
+  if( ! _tail){
+		uint32_t budget = ::heapUsed < IOTALOG_HEAP_BUDGET ? IOTALOG_HEAP_BUDGET - ::heapUsed : 0;
+		_tailRecords = min(_tailSeconds / _interval, (uint32_t)(min((uint32_t)IOTALOG_TAIL_BYTES, budget) / _recordSize));
+		if(_tailRecords == 0){
+			return;
+		}
+		_tail = new uint8_t[_tailRecords * _recordSize];
+		if( ! _tail){
+			_tailRecords = 0;
+			return;
 		}
-		IotaFile.close();
+		::heapUsed += _tailRecords * _recordSize;
+		_tailCount = 0;
+		_tailNext = 0;
   }
-  IotaFile = SD.open(_path, FILE_WRITE);
-	if(!IotaFile){
-		return 2;
+  memcpy(_tail + _tailNext * _recordSize, data, _recordSize);
+  _tailNext = (_tailNext + 1) % _tailRecords;
+  if(_tailCount < _tailRecords){
+		_tailCount++;
   }
-  
-  _fileSize = IotaFile.size();
+}
 
-  if(_fileSize){
-		IotaFile.seek(0);
-		IotaFile.read(&record, sizeof(record));
-		_firstKey = record.UNIXtime;
-		_firstSerial = record.serial;
-		IotaFile.seek(_fileSize - sizeof(IotaLogRecord));
-		IotaFile.read(&record, sizeof(record));
-		_lastKey = record.UNIXtime;
-		_lastSerial = record.serial;
-		_entries = _fileSize / sizeof(IotaLogRecord);
+void IotaLog::freeTail(){
+  if(_tail){
+		::heapUsed -= _tailRecords * _recordSize;
+		delete[] _tail;
   }
+  _tail = nullptr;
+  _tailRecords = 0;
+  _tailCount = 0;
+  _tailNext = 0;
+}
 
-					// If there are trailing zero records at the end,
-					// try to adjust _filesize down to match logical end of file.
+bool IotaLog::readTail(IotaLogRecord* callerRecord, int32_t serial){
+  if(serial > _lastSerial || serial <= _lastSerial - _tailCount){
+		return false;
+  }
+  uint16_t slot = (_tailNext + _tailRecords - 1 - (_lastSerial - serial)) % _tailRecords;
+  unpack(callerRecord, _tail + slot * _recordSize);
+  return true;
+}
 
-	while(_fileSize && _lastSerial == 0){
-		IotaLogRecord* record = new IotaLogRecord;
-		_fileSize -= sizeof(IotaLogRecord);
-		IotaFile.seek(_fileSize - sizeof(IotaLogRecord));
-		IotaFile.read((char*)record, sizeof(IotaLogRecord));
-		_lastSerial = record->serial;
-		_lastKey = record->UNIXtime;
-		_entries--;	 
-		delete record;
-	}
-	if(_fileSize != IotaFile.size()){
-		Serial.printf("physical %d, logical %d\r\n", IotaFile.size(), _fileSize);
-	}
-	
-  if(_firstKey > _lastKey){
-		_wrap = findWrap(0,_firstKey, _fileSize - sizeof(IotaLogRecord), _lastKey);
-		IotaFile.seek(_wrap);
-		IotaFile.read(&record, sizeof(record));
-		_firstKey = record.UNIXtime;
-		_firstSerial = record.serial;
-		IotaFile.seek(_wrap - sizeof(IotaLogRecord));
-		IotaFile.read(&record, sizeof(record));
-		_lastKey = record.UNIXtime;
-		_lastSerial = record.serial;
+bool IotaLog::searchTail(IotaLogRecord* callerRecord, uint32_t key){
+  if(_tailCount == 0){
+		return false;
+  }
+  uint16_t oldest = (_tailNext + _tailRecords - _tailCount) % _tailRecords;
+  uint32_t slotKey;
+  memcpy(&slotKey, _tail + oldest * _recordSize, sizeof(slotKey));
+  if(key < slotKey){
+		return false;
+  }
+  int low = 0;
+  int high = _tailCount - 1;
+  while(low < high){
+		int mid = (low + high + 1) / 2;
+		memcpy(&slotKey, _tail + ((oldest + mid) % _tailRecords) * _recordSize, sizeof(slotKey));
+		if(slotKey <= key){
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
   }
+  unpack(callerRecord, _tail + ((oldest + low) % _tailRecords) * _recordSize);
+  return true;
+}
 
-  _lastReadKey = _firstKey;
-  _lastReadSerial = _firstSerial;
-  _maxFileSize = max(_fileSize, _maxFileSize);
-  
-  if(((int32_t) _lastSerial - _firstSerial + 1) != _entries){
-		log("IotaLog: file damaged %s\r\n", _path);
-		log("IotaLog: Creating diagnostic file.");
-		dumpFile();
-		log("IotaLog: Deleting %s and restarting.\r\n", _path);	
-		IotaFile.close();
-		SD.remove(_path);
-		ESP.restart();
-	}
-	
-	for(int i=0; i<_cacheSize; i++){
-		_cacheKey[i] = _firstKey;
-		_cacheSerial[i] = _firstSerial;
+/*******************************************************************************************************
+ * readCommit - overlay buffered records onto data read from file position pos.
+ *******************************************************************************************************/
+void IotaLog::readCommit(uint8_t* data, uint32_t pos, uint32_t len){
+  if(_commitCount == 0){
+		return;
+  }
+  uint32_t start = max(pos, _commitPos);
+  uint32_t end = min(pos + len, _commitPos + _commitCount * _recordSize);
+  if(start < end){
+		memcpy(data + (start - pos), _commitBuffer + (start - _commitPos), end - start);
+  }
+}
+
+void IotaLog::dumpFile(){
+	setLedCycle(LED_DUMPING_LOG);
+	char diagPath[] = "iotaWatt/logDiag.txt";
+	SD.remove(diagPath);
+	File logDiag = SD.open(diagPath, FILE_WRITE);
+	if(logDiag){
+		DateTime now = DateTime(localTime());
+    logDiag.printf_P(PSTR("%d/%02d/%02d %02d:%02d:%02d\r\nfilesize %d, entries %d\r\n"),
+    now.month(), now.day(), now.year()%100, now.hour(), now.minute(), now.second(),
+		IotaFile.size(), _entries);
+		logDiag.close();
 	}
+	uint32_t dataSize = IotaFile.size() > _dataStart ? IotaFile.size() - _dataStart : 0;
+	IotaFile.seek(_dataStart);
+	IotaFile.read(&record,sizeof(record));
+  uint32_t begKey = record.UNIXtime;
+  uint32_t begSerial = record.serial;
+	uint32_t endKey = record.UNIXtime;
+	uint32_t endSerial = record.serial;
+  uint32_t filePos = 0;
+  do {
+		filePos += _recordSize;
+		IotaFile.seek(_dataStart + filePos);
+		IotaFile.read(&record,sizeof(record));
+		if(record.UNIXtime - endKey != _interval || record.serial - endSerial != 1 || filePos >= _fileSize - _segmentStart){
+			Serial.printf_P(PSTR("%d,%d,%d,%d\r\n"), begKey, begSerial, endKey, endSerial);
+			logDiag = SD.open(diagPath, FILE_WRITE);
+			if(logDiag){
+				logDiag.printf_P(PSTR("%d,%d,%d,%d\r\n"), begKey, begSerial, endKey, endSerial);
+				if(filePos >= dataSize){
+					logDiag.printf_P(PSTR("End of file\r\n"));
+				}
+				logDiag.close();
+			}
+			begKey = record.UNIXtime;
+			begSerial = record.serial;
+		}
+		endKey = record.UNIXtime;
+		endSerial = record.serial;
+	} while(filePos < dataSize);
+	endLedCycle();
+}
 
-  return 0;
+/*******************************************************************************************************
+********************************************************************************************************
+IotaLogCursor
+********************************************************************************************************
+********************************************************************************************************/
+IotaLogCursor::IotaLogCursor(IotaLog& log, int pages){
+  _log = &log;
+  _next = _log->_cursors;
+  _log->_cursors = this;
+  _cacheSize = 10;
+  _cacheWrap = 0;
+  _cacheKey = new uint32_t[_cacheSize];
+  _cacheSerial = new int32_t[_cacheSize];
+  _pageCount = pages;
+  _pages = new IotaLogPage[_pageCount];
+  _blockFixed = nullptr;
+  _blockMap = 0;
+  _blockIndex = nullptr;
+  _fileNumber = 0;
+  clearCache();
 }
 
-uint32_t IotaLog::findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos, uint32_t lowKey){
-  struct {
-	uint32_t UNIXtime;
-	uint32_t serial; 
-  } record;
-  
-  if((lowPos - highPos) == sizeof(IotaLogRecord)) {
-		return lowPos;
+IotaLogCursor::~IotaLogCursor(){
+  IotaLogCursor** link = &_log->_cursors;
+  while(*link && *link != this){
+		link = &(*link)->_next;
   }
-  uint32_t midPos = (highPos + lowPos) / 2;
-  midPos += midPos % sizeof(IotaLogRecord);
-  IotaFile.seek(midPos);
-  IotaFile.read(&record, sizeof(record));
-  uint32_t midKey = record.UNIXtime;
-  if(midKey > highKey){
-		return findWrap(midPos, midKey, lowPos, lowKey);
+  if(*link){
+		*link = _next;
   }
-  return findWrap(highPos, highKey, midPos, midKey);
+  delete[] _cacheKey;
+  delete[] _cacheSerial;
+  for(int i=0; i<_pageCount; i++){
+		::heapUsed -= _pages[i].size;
+  }
+  delete[] _pages;
+  delete[] _blockFixed;
+  delete[] _blockIndex;
+  _file.close();
 }
 
-int IotaLog::readKey (IotaLogRecord* callerRecord){
-	uint32_t key = callerRecord->UNIXtime - (callerRecord->UNIXtime % _interval);
-  if(!IotaFile) return 2;
-  if(_entries == 0) return 1;
-	if(key < _firstKey){													// Before the beginning of time
-		readSerial(callerRecord, _firstSerial);
+int IotaLogCursor::readKey (IotaLogRecord* callerRecord){
+	uint32_t key = callerRecord->UNIXtime - (callerRecord->UNIXtime % _log->_interval);
+  if(!_log->IotaFile) return 2;
+  if(_log->_entries == 0) return 1;
+	if(key < _log->_firstKey){													// Before the beginning of time
+		readSerial(callerRecord, _log->_firstSerial);
 		callerRecord->UNIXtime = key;
 		return 1;
 	}
-	if(key >= _lastKey){														// Back to the future
-		readSerial(callerRecord, _lastSerial);
+	if(key >= _log->_lastKey){														// Back to the future
+		readSerial(callerRecord, _log->_lastSerial);
 		callerRecord->UNIXtime = key;
-		if(key = _lastKey) return 0;
+		if(key == _log->_lastKey) return 0;
 		return 1;
 	}
-	//Serial.printf("search %d, highKey %d\r\n", key, _firstKey);
-	uint32_t lowKey = _firstKey;
-	int32_t lowSerial = _firstSerial;
-	uint32_t highKey = _lastKey;
-	int32_t highSerial = _lastSerial;
+	if(_log->searchTail(callerRecord, key)){										// Recent, from RAM
+		_rangeKey = callerRecord->UNIXtime;
+		_rangeSerial = callerRecord->serial;
+		callerRecord->UNIXtime = key;
+		return 0;
+	}
+	if(searchIndex(callerRecord, key)){
+		callerRecord->UNIXtime = key;
+		return 0;
+	}
+	//Serial.printf("search %d, highKey %d\r\n", key, _log->_firstKey);
+	uint32_t lowKey = _log->_firstKey;
+	int32_t lowSerial = _log->_firstSerial;
+	uint32_t highKey = _log->_lastKey;
+	int32_t highSerial = _log->_lastSerial;
 	
-	for(int i=0; i<_cacheSize; i++){
+	for(uint32_t i=0; i<_cacheSize; i++){
 		uint32_t cacheKey = _cacheKey[i];
 		if(cacheKey == key){												// Deja Vu
 			_cacheWrap = (_cacheWrap + _cacheSize - 1) % _cacheSize;
@@ -164,10 +2228,10 @@ int IotaLog::readKey (IotaLogRecord* callerRecord){
 	return 0;
 }
 
-void IotaLog::searchKey(IotaLogRecord* callerRecord, const uint32_t key, const uint32_t lowKey, const int32_t lowSerial, const uint32_t highKey, const int32_t highSerial){
+void IotaLogCursor::searchKey(IotaLogRecord* callerRecord, const uint32_t key, const uint32_t lowKey, const int32_t lowSerial, const uint32_t highKey, const int32_t highSerial){
 
-  int32_t floorSerial = max(lowSerial, highSerial - (int32_t)((highKey - key) / _interval));
-	int32_t ceilingSerial = min(highSerial, lowSerial + (int32_t)((key - lowKey) / _interval));
+  int32_t floorSerial = max(lowSerial, highSerial - (int32_t)((highKey - key) / _log->_interval));
+	int32_t ceilingSerial = min(highSerial, lowSerial + (int32_t)((key - lowKey) / _log->_interval));
 
 	//Serial.printf("low %d(%d), high %d(%d), floor %d, Ceiling %d\r\n", lowKey, lowSerial, highKey, highSerial,floorSerial, ceilingSerial); 
 
@@ -193,7 +2257,7 @@ void IotaLog::searchKey(IotaLogRecord* callerRecord, const uint32_t key, const u
 		return;
   }
   readSerial(callerRecord, (lowSerial + highSerial) / 2);
-  _readKeyIO++;
+  _log->_readKeyIO++;
   if(callerRecord->UNIXtime == key){
 		return;
   }
@@ -205,124 +2269,404 @@ void IotaLog::searchKey(IotaLogRecord* callerRecord, const uint32_t key, const u
   return;
 }
 
-int IotaLog::readNext(IotaLogRecord* callerRecord){
-  if(!IotaFile) return 2;
-  if(callerRecord->serial == _lastSerial) return 1;
+int IotaLogCursor::readNext(IotaLogRecord* callerRecord){
+  if(!_log->IotaFile) return 2;
+  if(callerRecord->serial == _log->_lastSerial) return 1;
   return readSerial(callerRecord, callerRecord->serial + 1);
 }
 
-int IotaLog::end(){
-  IotaFile.close();
+int IotaLogCursor::readSerial(IotaLogRecord* callerRecord, int32_t serial){
+  if(serial < _log->_firstSerial || serial > _log->_lastSerial){
+		return 1;
+  }
+  if(_log->readTail(callerRecord, serial)){
+		// Recent, from RAM
+  }
+  else if(_log->_compressed){
+		if( ! readBlock(callerRecord, serial)){
+			return 1;
+		}
+  }
+  else {
+		readCache(callerRecord, _log->serialPos(serial));
+  }
+	_cacheKey[_cacheWrap] = callerRecord->UNIXtime;
+	_cacheSerial[_cacheWrap++] = callerRecord->serial;
+	_cacheWrap %= _cacheSize;
+  _rangeKey = callerRecord->UNIXtime;
+  _rangeSerial = callerRecord->serial;
   return 0;
+};
+
+/*******************************************************************************************************
+ * readRange - read begin, begin + step ... end, passing each record to callback.  See IotaLog.h.
+ * readStep - readKey() continuing from the last record read, when key is at or after it.
+ *******************************************************************************************************/
+uint32_t IotaLogCursor::readRange(IotaLogRecord* callerRecord, uint32_t begin, uint32_t end, uint32_t step, IotaLogRangeCallback callback){
+  uint32_t count = 0;
+  if(!_log->IotaFile) return 0;
+  for(uint32_t key=begin; key<=end; key+=step){
+		int rtc = readStep(callerRecord, key);
+		count++;
+		if( ! callback(callerRecord, rtc) || step == 0 || key > end - step){
+			break;
+		}
+  }
+  return count;
 }
 
-boolean IotaLog::isOpen(){
-  if(IotaFile) return true;
-  return false;
+int IotaLogCursor::readStep(IotaLogRecord* callerRecord, uint32_t key){
+  key -= key % _log->_interval;
+  if(_rangeSerial >= _log->_firstSerial && key >= _rangeKey && key < _log->_lastKey){
+		int32_t serial = _rangeSerial + (key - _rangeKey) / _log->_interval;
+		if(serial <= _log->_lastSerial){
+			readSerial(callerRecord, serial);
+			if(callerRecord->UNIXtime == key){
+				return 0;
+			}
+		}
+  }
+  callerRecord->UNIXtime = key;																// Start of range or a hole
+  return readKey(callerRecord);
 }
 
-uint32_t IotaLog::firstKey(){return _firstKey;}
-int32_t IotaLog::firstSerial(){return _firstSerial;}
-uint32_t IotaLog::lastKey(){return _lastKey;}
-int32_t IotaLog::lastSerial(){return _lastSerial;}
-uint32_t IotaLog::fileSize(){return _fileSize;}
-uint32_t IotaLog::readKeyIO(){return _readKeyIO;}
-uint32_t IotaLog::interval(){return _interval;}
+/*******************************************************************************************************
+ * readCache - get the record at file position pos, from the page cache when possible.
+ * A miss within a page of the last record read is taken to be a scan and reads the whole page.
+ * Other misses read just the record, so a keyed search doesn't pay a page per probe.
+ * Pages are laid out from the start of the segment holding pos, in whole records of its size.
+ *******************************************************************************************************/
+void IotaLogCursor::readCache(IotaLogRecord* callerRecord, uint32_t pos){
+  uint32_t start, end, map;
+  uint16_t size = _log->layout(pos, start, end, map);
+  uint32_t pageSize = (IOTALOG_PAGE_BYTES / size) * size;
+  uint32_t pagePos = pos - ((pos - start) % pageSize);
+  IotaLogPage* page = nullptr;
+  IotaLogPage* oldest = &_pages[0];
+  for(int i=0; i<_pageCount; i++){
+		if(_pages[i].len && _pages[i].pos == pagePos){
+			page = &_pages[i];
+			break;
+		}
+		if(_pages[i].lastUse < oldest->lastUse){
+			oldest = &_pages[i];
+		}
+  }
+  uint32_t distance = (pos > _lastReadPos) ? pos - _lastReadPos : _lastReadPos - pos;
+  _lastReadPos = pos;
+  if(page && (pos - pagePos) < page->len){								// Hit
+		page->lastUse = ++_pageUse;
+		readRecord(callerRecord, page->data + (pos - pagePos), pos, size, map);
+		return;
+  }
+  _log->_readKeyIO++;
+  if( ! page && distance > pageSize){										// Random read
+		uint8_t data[IOTALOG_RECORD_MAX];
+		logFile(pos, size).read(data, size);
+		_log->readCommit(data, pos, size);
+		readRecord(callerRecord, data, pos, size, map);
+		return;
+  }
+  if( ! page){
+		page = oldest;
+		if( ! pageAlloc(page, false)){								// Over budget, the oldest page it has
+			page = nullptr;
+			for(int i=0; i<_pageCount; i++){
+				if(_pages[i].data && ( ! page || _pages[i].lastUse < page->lastUse)){
+					page = &_pages[i];
+				}
+			}
+			if( ! page){
+				uint8_t data[IOTALOG_RECORD_MAX];
+				logFile(pos, size).read(data, size);
+				_log->readCommit(data, pos, size);
+				readRecord(callerRecord, data, pos, size, map);
+				return;
+			}
+		}
+  }
+  page->pos = pagePos;
+  page->len = min(pageSize, end - pagePos);
+  page->lastUse = ++_pageUse;
+  logFile(pagePos, page->len).read(page->data, page->len);
+  _log->readCommit(page->data, pagePos, page->len);
+  readRecord(callerRecord, page->data + (pos - pagePos), pos, size, map);
+}
 
-uint32_t IotaLog::setDays(uint32_t days){
-	_maxFileSize = max(_fileSize, (uint32_t)(days * _recordSize * (86400UL / _interval)));
-	_maxFileSize = max(_maxFileSize, (uint32_t)(_recordSize * (3600UL / _interval)));
-	return _maxFileSize / (_recordSize * (86400 / _interval));
+/*******************************************************************************************************
+ * pageAlloc - allocate page's data if it has none: IOTALOG_PAGE_BYTES within the heap budget, otherwise
+ * IOTALOG_PAGE_MIN if small will do.  Returns false if the page has no data.
+ *******************************************************************************************************/
+bool IotaLogCursor::pageAlloc(IotaLogPage* page, bool small){
+  if(page->data){
+		return true;
+  }
+  uint32_t size = IOTALOG_PAGE_BYTES;
+  if(::heapUsed + size > IOTALOG_HEAP_BUDGET){
+		if( ! small){
+			return false;
+		}
+		size = IOTALOG_PAGE_MIN;
+  }
+  page->data = new uint8_t[size];
+  if( ! page->data){
+		return false;
+  }
+  page->size = size;
+  ::heapUsed += size;
+  return true;
 }
-  
-int IotaLog::readSerial(IotaLogRecord* callerRecord, int32_t serial){
-  if(serial < _firstSerial || serial > _lastSerial){
-		return 1;
+
+/*******************************************************************************************************
+ * logFile - the cursor's own handle on the log, positioned to read len bytes at log position pos.
+ * It is reopened if the log has grown past the size the handle knows of, or for a segmented log if
+ * pos is in another segment.  The SD library follows a file's cluster chain from a handle's current
+ * position when seeking forward and from the start of the file when seeking back, so with a handle of
+ * its own a reader moving forward through the log doesn't walk the chain from the start every time the
+ * writer moves the shared handle past it.  Compressed logs, which grow with every write, share IotaFile.
+ *******************************************************************************************************/
+File& IotaLogCursor::logFile(uint32_t pos, uint32_t len){
+  if(_log->_compressed){
+		_log->IotaFile.seek(_log->_dataStart + pos);
+		return _log->IotaFile;
   }
-  IotaFile.seek(((serial - _firstSerial) * sizeof(IotaLogRecord) + _wrap) % _fileSize);
-	IotaFile.read(callerRecord, sizeof(IotaLogRecord));
-	_cacheKey[_cacheWrap] = callerRecord->UNIXtime;
-	_cacheSerial[_cacheWrap++] = callerRecord->serial;
-	_cacheWrap %= _cacheSize;
-	_readKeyIO++;
-  return 0;
-};
-   
-int IotaLog::write (IotaLogRecord* callerRecord){
+  uint32_t number = _log->_segmentNumber;
+  uint32_t offset = _log->_dataStart + pos - _log->_segmentStart;
+  if(_log->_segmentDir){
+		int segment = _log->segmentAt(pos);
+		if(segment < _log->_segmentCount){
+			number = _log->_segments[segment].number;
+			offset = IOTALOG_FORMAT_SIZE + pos - _log->_segments[segment].start;
+		}
+  }
+  if( ! _file || number != _fileNumber || 
+     (_file.size() < offset + len && (number != _log->_segmentNumber || _log->IotaFile.size() > _file.size()))){
+		_file.close();
+		_file = SD.open(number == _log->_segmentNumber ? String(_log->_path) : _log->segmentPath(number), FILE_READ);
+		_fileNumber = number;
+  }
+  _file.seek(offset);
+  return _file;
+}
 
-  if(!IotaFile){
-		return 2;
+void IotaLogCursor::readRecord(IotaLogRecord* callerRecord, const uint8_t* data, uint32_t pos, uint16_t size, uint32_t map){
+  if( ! _log->checkRecord(data, size)){
+		_log->damaged(pos);
   }
-  if(callerRecord->UNIXtime <= _lastKey) {
-		return 1;
+  _log->unpack(callerRecord, data, map);
+}
+
+/*******************************************************************************************************
+ * writeCache - keep any cached copy of file position pos current after write().
+ * Appending to the end of a partial page extends it.
+ *******************************************************************************************************/
+void IotaLogCursor::writeCache(const uint8_t* data, uint32_t pos){
+  uint32_t pagePos = pos - ((pos - _log->_segmentStart) % _log->_pageSize);
+  for(int i=0; i<_pageCount; i++){
+		IotaLogPage* page = &_pages[i];
+		if(page->len && page->pos == pagePos){
+			if((pos - pagePos) <= page->len){
+				memcpy(page->data + (pos - pagePos), data, _log->_recordSize);
+				page->len = max(page->len, pos - pagePos + _log->_recordSize);
+			} else {
+				page->len = 0;
+			}
+		}
   }
-  callerRecord->serial = ++_lastSerial;
-  if(_wrap || _fileSize >= _maxFileSize){
-		IotaFile.seek(_wrap);
-		_wrap = (_wrap + sizeof(IotaLogRecord)) % _fileSize;
+}
+
+/*******************************************************************************************************
+ * searchIndex - readKey() using the hole index.
+ * Finds the run containing key and reads the record computed from its start.  Keys in a hole get the
+ * last record before the hole.  If the record read isn't the one expected, the index is bad;
+ * it is deleted to be rebuilt at the next begin() and readKey() falls back to searching.
+ *******************************************************************************************************/
+bool IotaLogCursor::searchIndex(IotaLogRecord* callerRecord, uint32_t key){
+  if( ! _log->_indexValid){
+		return false;
   }
-  else {
-		IotaFile.seek(_fileSize);
-		_fileSize += sizeof(IotaLogRecord);
-		_entries++;
+  int low = 0;
+  int high = _log->_indexCount;
+  while(low < high){
+		int mid = (low + high) / 2;
+		if(_log->_index[mid].key <= key){
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
   }
-  IotaFile.write((char*)callerRecord, sizeof(IotaLogRecord));
-  IotaFile.flush();
-  _lastKey = callerRecord->UNIXtime;
-  _lastSerial = callerRecord->serial;
-  if(_firstKey == 0){
-		_firstKey = callerRecord->UNIXtime;
+  uint32_t runKey = _log->_firstKey;
+  int32_t runSerial = _log->_firstSerial;
+  if(low){
+		runKey = _log->_index[low-1].key;
+		runSerial = _log->_index[low-1].serial;
   }
-  else if(_wrap || _fileSize == _maxFileSize){
-		IotaFile.seek(_wrap);
-		IotaFile.read((char*)callerRecord,8);
-		_firstKey = callerRecord->UNIXtime;
-		_firstSerial = callerRecord->serial;
-		callerRecord->UNIXtime = _lastKey;
-		callerRecord->serial = _lastSerial;
+  else if(_log->_firstSerial < _log->_indexFloor){
+		return false;
   }
-  
-  return 0;
+  int32_t endSerial = (low < _log->_indexCount) ? _log->_index[low].serial - 1 : _log->_lastSerial;
+  int32_t serial = min(endSerial, runSerial + (int32_t)((key - runKey) / _log->_interval));
+  readSerial(callerRecord, serial);
+  if(callerRecord->UNIXtime == runKey + (uint32_t)(serial - runSerial) * _log->_interval){
+		return true;
+  }
+  log("IotaLog: index mismatch %s, serial %d\r\n", _log->_indexPath, serial);
+  _log->_indexValid = false;
+  SD.remove(_log->_indexPath);
+  return false;
 }
 
-void IotaLog::dumpFile(){
-	setLedCycle(LED_DUMPING_LOG);
-	char diagPath[] = "iotaWatt/logDiag.txt";
-	SD.remove(diagPath);
-	File logDiag = SD.open(diagPath, FILE_WRITE);
-	if(logDiag){
-		DateTime now = DateTime(localTime());
-    logDiag.printf_P(PSTR("%d/%02d/%02d %02d:%02d:%02d\r\nfilesize %d, entries %d\r\n"),
-    now.month(), now.day(), now.year()%100, now.hour(), now.minute(), now.second(),
-		IotaFile.size(), _entries);
-		logDiag.close();
+/*******************************************************************************************************
+ * clearCache - empty the page cache and reset the key cache to the start of the log.
+ * Called by the log whenever it is opened or closed.
+ *******************************************************************************************************/
+void IotaLogCursor::clearCache(){
+  _file.close();
+  for(int i=0; i<_pageCount; i++){
+		_pages[i].len = 0;
+		_pages[i].lastUse = 0;
+  }
+  _pageUse = 0;
+  _lastReadPos = 0;
+  _blockPos = 0;
+  _blockSerial = -1;
+  _blockIndexCount = 0;
+  _rangeKey = 0;
+  _rangeSerial = -1;
+	for(uint32_t i=0; i<_cacheSize; i++){
+		_cacheKey[i] = _log->_firstKey;
+		_cacheSerial[i] = _log->_firstSerial;
 	}
-	IotaFile.seek(0);
-	IotaFile.read(&record,sizeof(record));
-  uint32_t begKey = record.UNIXtime;
-  uint32_t begSerial = record.serial;
-	uint32_t endKey = record.UNIXtime;
-	uint32_t endSerial = record.serial;
-  uint32_t filePos = 0;
-  do {
-		filePos += _recordSize;
-		IotaFile.seek(filePos);
-		IotaFile.read(&record,sizeof(record));
-		if(record.UNIXtime - endKey != _interval || record.serial - endSerial != 1 || filePos >= _fileSize){
-			Serial.printf_P(PSTR("%d,%d,%d,%d\r\n"), begKey, begSerial, endKey, endSerial);
-			logDiag = SD.open(diagPath, FILE_WRITE);
-			if(logDiag){
-				logDiag.printf_P(PSTR("%d,%d,%d,%d\r\n"), begKey, begSerial, endKey, endSerial);
-				if(filePos >= IotaFile.size()){
-					logDiag.printf_P(PSTR("End of file\r\n"));
-				}
-				logDiag.close();
-			}
-			begKey = record.UNIXtime;
-			begSerial = record.serial;
+}
+
+/*******************************************************************************************************
+ * readBlock - readSerial() for a compressed log.
+ * Decodes forward from the record last decoded if it is earlier in the same block (or ends the block
+ * before), otherwise from the start of the block.
+ *******************************************************************************************************/
+bool IotaLogCursor::readBlock(IotaLogRecord* callerRecord, int32_t serial){
+  int32_t blockSerial = serial - (serial - _log->_firstSerial) % IOTALOG_BLOCK_RECORDS;
+  if(_blockPos == 0 || _blockSerial < blockSerial - 1 || _blockSerial > serial){
+		_blockPos = blockOffset((blockSerial - _log->_firstSerial) / IOTALOG_BLOCK_RECORDS);
+		_blockSerial = blockSerial - 1;
+  }
+  while(_blockSerial < serial){
+		if( ! decodeNext()){
+			log("IotaLog: block decode failed %s, serial %d\r\n", _log->_path, _blockSerial + 1);
+			_blockPos = 0;
+			return false;
 		}
-		endKey = record.UNIXtime;
-		endSerial = record.serial;
-	} while(filePos < IotaFile.size());
-	endLedCycle();
+  }
+  _log->fromFixed(callerRecord, _blockFixed, _blockMap);
+  callerRecord->UNIXtime = _blockKey;
+  callerRecord->serial = _blockSerial;
+  return true;
+}
+
+/*******************************************************************************************************
+ * decodeNext - decode the record following the one last decoded, and with the first of a block, the
+ * block's map if the log has one per block.
+ * The state is unchanged if it is incomplete or fails its check.
+ *******************************************************************************************************/
+bool IotaLogCursor::decodeNext(){
+  if( ! _blockFixed){
+		_blockFixed = new int64_t[IOTALOG_FIXED_MAX];
+  }
+  int32_t serial = _blockSerial + 1;
+  bool start = ((serial - _log->_firstSerial) % IOTALOG_BLOCK_RECORDS) == 0;
+  uint32_t baseKey = start ? 0 : _blockKey;
+  uint32_t pos = _blockPos;
+  uint32_t crc = IotaLog::crc32(&serial, sizeof(serial));
+  uint32_t map = start ? _log->_channels | _log->_accums : _blockMap;
+  int64_t delta[IOTALOG_FIXED_MAX];
+  uint64_t keyDelta;
+  uint64_t value;
+  if(start && _log->_blockMaps){
+		if( ! readVarint(pos, value, crc) || (value & IOTALOG_ALL_CHANNELS) == 0 ||
+				(value & ~(uint64_t)(IOTALOG_ALL_CHANNELS | IOTALOG_ACCUMS_MASK))){
+			return false;
+		}
+		map = value;
+  }
+  int count = IotaLog::fixedCount(map);
+  if( ! readVarint(pos, keyDelta, crc) || keyDelta == 0 || keyDelta > (0xFFFFFFFFUL - baseKey)){
+		return false;
+  }
+  for(int i=0; i<count; i++){
+		if( ! readVarint(pos, value, crc)){
+			return false;
+		}
+		delta[i] = unzigzag(value);
+  }
+  if(readByte(pos) != (int)(crc & 0xFF)){
+		return false;
+  }
+  if(start){
+		memset(_blockFixed, 0, count * sizeof(int64_t));
+  }
+  for(int i=0; i<count; i++){
+		_blockFixed[i] += delta[i];
+  }
+  _blockKey = baseKey + keyDelta;
+  _blockSerial = serial;
+  _blockPos = pos;
+  _blockMap = map;
+  return true;
+}
+
+bool IotaLogCursor::readVarint(uint32_t& pos, uint64_t& value, uint32_t& crc){
+  value = 0;
+  for(int shift=0; shift<64; shift+=7){
+		int byte = readByte(pos);
+		if(byte < 0){
+			return false;
+		}
+		uint8_t data = byte;
+		crc = IotaLog::crc32(&data, 1, crc);
+		value |= (uint64_t)(data & 0x7F) << shift;
+		if( ! (data & 0x80)){
+			return true;
+		}
+  }
+  return false;
+}
+
+/*******************************************************************************************************
+ * readByte - next byte of a compressed log, -1 at the end.
+ * Reads through the first cache page, which holds IOTALOG_PAGE_BYTES from any file position.
+ *******************************************************************************************************/
+int IotaLogCursor::readByte(uint32_t& pos){
+  IotaLogPage* page = &_pages[0];
+  if(pos < page->pos || pos >= page->pos + page->len){
+		uint32_t end = _log->_dataStart + _log->_fileSize;
+		if(pos >= end){
+			return -1;
+		}
+		if( ! pageAlloc(page, true)){
+			return -1;
+		}
+		page->pos = pos;
+		page->len = min(page->size, end - pos);
+		_log->IotaFile.seek(pos);
+		_log->IotaFile.read(page->data, page->len);
+		_log->_readKeyIO++;
+  }
+  return page->data[pos++ - page->pos];
+}
+
+/*******************************************************************************************************
+ * blockOffset - file position of a block, from IOTALOG_BLOCK_INDEX entries cached around it.
+ *******************************************************************************************************/
+uint32_t IotaLogCursor::blockOffset(uint32_t block){
+  if(block < _blockIndexBase || block >= _blockIndexBase + _blockIndexCount){
+		if( ! _blockIndex){
+			_blockIndex = new uint32_t[IOTALOG_BLOCK_INDEX];
+		}
+		_blockIndexBase = block - block % IOTALOG_BLOCK_INDEX;
+		_blockIndexCount = min((uint32_t)IOTALOG_BLOCK_INDEX, _log->_blocks - _blockIndexBase);
+		_log->BlockFile.seek(_blockIndexBase * sizeof(uint32_t));
+		_log->BlockFile.read(_blockIndex, _blockIndexCount * sizeof(uint32_t));
+		_log->_readKeyIO++;
+  }
+  return _blockIndex[block - _blockIndexBase];
 }
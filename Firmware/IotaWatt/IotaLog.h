@@ -7,6 +7,7 @@
 #define IotaLog_h
 #include "SPI.h"
 #include "SD.h"
+#include <functional>
 
 /*******************************************************************************************************
 ********************************************************************************************************
@@ -23,23 +24,378 @@ struct IotaLogRecord {
       double logHours;        // Total hours of monitoring logged to date in this log 
       double accum1[15];
       double accum2[15];
+      double* accum3;           // THD hours, if allocated by setAccums(), else nullptr
+      double* accum4;           // VAR hours, likewise
+      uint32_t logged;          // IOTALOG_ACCUM_THD/_VAR: accum3/accum4 hold values read from a log
       IotaLogRecord()
       :UNIXtime(0)
       ,serial(0)
-      ,logHours(0){};
+      ,logHours(0)
+      ,accum3(nullptr)
+      ,accum4(nullptr)
+      ,logged(0){};
+      IotaLogRecord(const IotaLogRecord& other);
+      ~IotaLogRecord();
+      IotaLogRecord& operator=(const IotaLogRecord& other);
+      void setAccums(uint32_t accums);
     };    
 
+/*******************************************************************************************************
+Record format
+A log file starts with an IOTALOG_FORMAT_SIZE byte format block holding the channel map: the inputs whose
+accumulators are stored.  Each stored record is the IotaLogRecord head (UNIXtime, serial, logHours)
+followed by accum1 then accum2 of just the mapped channels, so a unit with four inputs stores 80 byte
+records rather than 256.  The map comes from setChannels() when begin() creates the file and is fixed
+for the life of the file, except in a compressed log (see Block compression) or a segmented log (see
+Segments).  Callers read and write whole IotaLogRecords; unmapped accumulators read as zero.
+Each record ends with a crc32 of the rest, checked as it is read.
+Files from before the format block (version 1) have no format block and all channels, and version 2
+files have no crc.
+A log begun after setAccums(IOTALOG_ACCUM_THD) also stores accum3 of the mapped channels, after accum2,
+and after setAccums(IOTALOG_ACCUM_VAR) accum4 after that.  These accumulators are kept in the channel map
+word of the format block, above the channels.  A record only has accum3 and accum4 once the caller has
+allocated them with IotaLogRecord::setAccums(), so records for logs and scripts without them stay small.
+Without them a write stores zero and a read skips them.  Copying a record copies their values.  A read
+sets logged to those of them it filled from the log, so a reader can tell a logged zero from a log
+without them.
+********************************************************************************************************/
+#define IOTALOG_FORMAT_ID 0x464C5449UL        // "ITLF"
+#define IOTALOG_FORMAT_PACKED 2               // Format version without record crc
+#define IOTALOG_FORMAT_VERSION 4
+#define IOTALOG_FORMAT_SIZE 512               // Bytes reserved at start of file (one SD block)
+#define IOTALOG_CHANNELS 15                   // Accumulator pairs in IotaLogRecord
+#define IOTALOG_ALL_CHANNELS 0x7FFFUL
+#define IOTALOG_ACCUMS 4                      // Accumulators per channel, at most
+#define IOTALOG_ACCUM_THD 0x10000UL           // Format channel map: accum3 stored
+#define IOTALOG_ACCUM_VAR 0x20000UL           // Format channel map: accum4 stored
+#define IOTALOG_ACCUMS_MASK 0x30000UL
+#define IOTALOG_RECORD_HEAD 16                // UNIXtime, serial and logHours
+#define IOTALOG_RECORD_V1 (IOTALOG_RECORD_HEAD + 2 * IOTALOG_CHANNELS * sizeof(double))
+#define IOTALOG_RECORD_CRC 4                  // Bytes of crc following each record
+#define IOTALOG_RECORD_MAX (IOTALOG_RECORD_HEAD + IOTALOG_ACCUMS * IOTALOG_CHANNELS * sizeof(double) + IOTALOG_RECORD_CRC)
+
+/*******************************************************************************************************
+Block compression
+A log created after setCompress(true) (format version 3) stores records in blocks of
+IOTALOG_BLOCK_RECORDS.  Each record is coded against the one before it in the block - against zero for
+the first - as a varint key delta and zig-zag varint deltas of logHours and the mapped accumulators in
+fixed point, followed by a check byte (crc of serial and record).  Block offsets are appended to
+<path>.bix, so a serial resolves to one index entry and a partial block decode.  Compressed logs are
+append-only: they don't wrap and setDays() has no effect.  Group commit defers their flushes instead of
+buffering records.
+begin() resumes from the index and the last block, rebuilding the index from the log if need be.
+A compressed log created now (format version 5) starts each block with a varint of its channel map word,
+coded with the first record, so a change of setChannels() or setAccums() is taken up by the open log at
+its next block, without rewriting what is already there.  The format block has the map of the first
+block.  Version 3 files keep the map of their format block throughout.
+********************************************************************************************************/
+#define IOTALOG_FORMAT_BLOCKS 3               // Format version of a compressed log
+#define IOTALOG_FORMAT_MAPPED 5               // ...with a channel map per block
+#define IOTALOG_BLOCK_RECORDS 32              // Records per block
+#define IOTALOG_BLOCK_INDEX 64                // Index entries cached per cursor
+#define IOTALOG_HOURS_SCALE 1e7               // Fixed point units per logHour
+#define IOTALOG_ACCUM_SCALE 1e3               // Fixed point units per accumulator unit
+#define IOTALOG_FIXED_MAX (1 + IOTALOG_ACCUMS * IOTALOG_CHANNELS)
+#define IOTALOG_BLOCK_RECORD_MAX (3 + 5 + 10 * IOTALOG_FIXED_MAX + 1)  // Map, key, values, check
+
+struct IotaLogFormat {
+      uint32_t  id;                           // IOTALOG_FORMAT_ID
+      uint16_t  version;                      // IOTALOG_FORMAT_VERSION
+      uint16_t  recordSize;                   // Stored record size
+      uint32_t  channels;                     // Bit n set: accum1[n] and accum2[n] stored (and accums)
+      uint32_t  checksum;                     // crc32 of the preceding fields
+    };
+
+/*******************************************************************************************************
+Repair
+A damaged log is repaired in place rather than deleted.  A record is good if its crc checks, its key is
+on the interval and its serial is that of its place in the log.  A bad record found by a reader is
+noted, and repair() mends it a slice at a time from the service writing the log, while reads and writes
+carry on.  From the bad record it reads back and forward to the nearest good records and rewrites just
+those between, with copies of the good record before them carrying the following keys (at the start of
+the log, of the one after with the keys before it), which read as no data just as an outage does.
+begin() mends a bad first or last record the same way before the log is used.  Only if begin() can't
+establish the state of the log (serials that don't add up) is the whole file repaired: the newest good
+record is taken as the end of the log, the records before it are checked in order, bad ones and any
+whose keys are out of order replaced and serials renumbered, and bad records after the newest good one
+in a file that hasn't wrapped dropped.  Compressed logs rely on their check bytes: begin() drops any
+incomplete records at the end and readers are refused records that fail.
+********************************************************************************************************/
+
+/*******************************************************************************************************
+Page cache
+Sequential and near-sequential reads (readNext, uploader and history catch-up, queries stepping
+through the log) are served from a few IOTALOG_PAGE_BYTES pages of whole records, replaced LRU.
+Pages are aligned on file position, so they remain valid across changes to _wrap and _firstSerial.
+write() updates any cached copy of the record it overwrites.
+********************************************************************************************************/
+#define IOTALOG_PAGE_BYTES 2048               // Cache page size, rounded down to whole records
+#define IOTALOG_CACHE_PAGES 2                 // Pages per log (default cursor)
+
+struct IotaLogPage {
+      uint32_t  pos;                          // File position of page
+      uint32_t  len;                          // Valid bytes in page (0 = empty)
+      uint32_t  lastUse;                      // LRU sequence
+      uint32_t  size;                         // Bytes allocated
+      uint8_t*  data;                         // Allocated on first use
+      IotaLogPage()
+      :pos(0)
+      ,len(0)
+      ,lastUse(0)
+      ,size(0)
+      ,data(nullptr){};
+      ~IotaLogPage(){delete[] data;}
+    };
+
+/*******************************************************************************************************
+Header
+The state that begin() would otherwise rebuild by scanning the file (logical size, wrap point, first
+and last key and serial) is checkpointed to <path>.hdr every IOTALOG_HEADER_WRITES writes and at end().
+begin() validates it against the log and rolls forward any records written since the checkpoint.
+If there is no usable header, or more than IOTALOG_HEADER_ROLL records to roll, the file is scanned.
+********************************************************************************************************/
+#define IOTALOG_HEADER_ID 0x474C5449UL        // "ITLG"
+#define IOTALOG_HEADER_VERSION 1
+#define IOTALOG_HEADER_WRITES 60              // Writes between checkpoints
+#define IOTALOG_HEADER_ROLL 1000              // Maximum records rolled forward at begin()
+
+struct IotaLogHeader {
+      uint32_t  id;                           // IOTALOG_HEADER_ID
+      uint16_t  version;                      // IOTALOG_HEADER_VERSION
+      uint16_t  recordSize;                   // Must match _recordSize
+      uint32_t  interval;                     // Must match _interval
+      uint32_t  fileSize;                     // Logical file size
+      uint32_t  entries;
+      uint32_t  wrap;
+      uint32_t  firstKey;
+      int32_t   firstSerial;
+      uint32_t  lastKey;
+      int32_t   lastSerial;
+      uint32_t  checksum;                     // crc32 of the preceding fields
+    };
+
+/*******************************************************************************************************
+Hole index
+Each discontinuity (a record whose key is not the previous key + interval) is indexed by the key and
+serial of the record following the hole.  Between holes, key maps to serial arithmetically, so readKey()
+resolves any key with a binary search of the index and a single read.  write() appends new holes to
+<path>.ndx and begin() loads it, locating any holes it doesn't cover by bisection of the log.
+At most IOTALOG_INDEX_MAX holes are held; the oldest are dropped and keys before them are searched.
+********************************************************************************************************/
+#define IOTALOG_INDEX_ID 0x584E4449UL         // "IDNX"
+#define IOTALOG_INDEX_MAX 256                 // Maximum holes indexed (8 bytes each)
+#define IOTALOG_INDEX_GROW 16                 // Allocation increment
+
+struct IotaLogIndex {
+      uint32_t  key;                          // Key of first record after hole
+      int32_t   serial;                       // Serial of...
+    };
+
+struct IotaLogIndexHeader {
+      uint32_t  id;                           // IOTALOG_INDEX_ID
+      uint32_t  interval;                     // Must match _interval
+      int32_t   floor;                        // Holes before this serial have been dropped
+    };
+
+/*******************************************************************************************************
+Group commit
+With setCommit(records, seconds), write() buffers records in RAM and writes them as one aligned group
+with a single flush, rather than flushing every record.  Readers see buffered records.  The header is
+only checkpointed with the buffer empty, so after a crash begin() recovers the log as of the last
+commit and the buffered records are lost - the writer sees an earlier lastKey() and carries on from there.
+A compressed log is written record by record as usual, but the log and its block index are only flushed
+once per group, so a crash loses the unflushed records in the same way.
+The buffer of an uncompressed log is records times the record size, allocated at the first buffered
+write within the heap budget.  If it can't be had, write() writes through until it can.
+********************************************************************************************************/
+#define IOTALOG_COMMIT_MAX 16                 // Maximum records per group commit
+
+/*******************************************************************************************************
+Preallocation
+With setPreallocate(bytes), an uncompressed log that hasn't reached its maximum size is grown bytes at a
+time, zero filled, ahead of write().  The file is then extended (and the cluster chain added to) once per
+extent rather than by every write, and cursors' handles, which only know the file size as of when they
+were opened, are reopened once per extent.  Zero records past the last written read as the end of the
+log at begin().  The SD library doesn't expose the card's sectors, so the log is still read and written
+through File - see IotaLogCursor for how seeks are kept short.
+********************************************************************************************************/
+#define IOTALOG_EXTENT_BYTES 32768            // Default preallocation (a typical FAT32 cluster)
+
+/*******************************************************************************************************
+Segments
+With setSegmentDays(days), a log that begin() creates is kept as a directory <path>/ of segment files
+rather than one wrapping file.  Each segment, <path>/nnnnnnnn.log, is a log file of its own (format block
+then records) holding up to a fixed number of records - days of them, rounded up to whole cache pages -
+and only the newest is written.  When it is full a new one is started, and the oldest are deleted once the
+rest hold setDays() of records, so retention is a file delete and setDays() can shrink or grow the log
+at any time.  <path>/segments.ndx lists the full segments with their first key and serial, so begin()
+only reads (and if need be repairs) the newest segment; the header (<path>/log.hdr) describes that
+segment and the hole index (<path>/log.ndx) the whole log.  If the segment index is lost it is rebuilt
+from the directory.  Full segments are never written again, so damage found in one is logged but not
+repaired.  Compressed logs aren't segmented, and an existing log keeps the form it was created in.
+Each segment has the channel map of its own format block.  A change of setChannels() or setAccums() is
+taken up by starting a new segment early, so the segment index also lists each segment's records and
+map, and a record's place in the log is found through the segment holding it.
+********************************************************************************************************/
+#define IOTALOG_SEGMENT_ID 0x32475349UL       // "ISG2"
+#define IOTALOG_SEGMENT_INDEX "/segments.ndx"
+#define IOTALOG_SEGMENT_GROW 8                // Allocation increment
+
+struct IotaLogSegmentHeader {
+      uint32_t  id;                           // IOTALOG_SEGMENT_ID
+      uint32_t  interval;                     // Must match _interval
+      uint32_t  records;                      // Records per full segment
+      uint32_t  number;                       // Number of the segment being written
+    };
+
+struct IotaLogSegment {
+      uint32_t  number;                       // Segment file number
+      uint32_t  firstKey;                     // Key of first record in segment
+      int32_t   firstSerial;                  // Serial of...
+      uint32_t  records;                      // Records in segment
+      uint32_t  map;                          // Channel map word of its format block
+      uint32_t  start;                        // Log position of its first record
+    };
+
+/*******************************************************************************************************
+Tail ring
+With setTail(seconds), write() also keeps the most recent records in a RAM ring, stored as in the file.
+Uploaders post the record dataLog wrote moments before, so readSerial() and readKey() of any record in
+the ring are answered from it with no SD access.  The ring is limited to IOTALOG_TAIL_BYTES, is
+allocated at the first write and is emptied whenever the log's caches are cleared.
+********************************************************************************************************/
+#define IOTALOG_TAIL_BYTES 4096               // Maximum size of tail ring
+
+/*******************************************************************************************************
+Heap budget
+Cache pages, tail rings and group commit buffers are allocated as they are first used, and all logs
+share IOTALOG_HEAP_BUDGET bytes for them (IotaLog::heapUsed()).  Over budget, a cursor makes do with
+the pages it already has, or with none reads an uncompressed log a record at a time and a compressed
+log through an IOTALOG_PAGE_MIN byte page, the one allocation allowed past the budget, and a tail ring
+is kept smaller or not at all.  A log with few readers, such as a history tier, can be given a one page
+default cursor by its constructor.
+********************************************************************************************************/
+#define IOTALOG_HEAP_BUDGET 16384             // Page, tail and commit bytes, all logs
+#define IOTALOG_PAGE_MIN 256                  // Page for a compressed log over budget
+
+/*******************************************************************************************************
+Range reads
+readRange(record, begin, end, step, callback) reads the keys begin, begin + step ... up to end into
+record, calling callback(record, rtc) with each as readKey() would return it, until the range is done
+or the callback returns false.  Each key is taken to be (key - last key read) / interval serials on from
+the last record the cursor read, so only the first key of a range is searched for, runs of consecutive
+keys are read straight through the page cache, and readKey() is only called again when that lands on
+the far side of a hole.  A step of zero reads just begin.  It returns the number of records delivered.
+********************************************************************************************************/
+typedef std::function<bool(IotaLogRecord* record, int rtc)> IotaLogRangeCallback;
+
+/*******************************************************************************************************
+Class IotaLogCursor
+An independent reader of an IotaLog.  Each consumer of a log (history, uploaders, queries) holds its
+own cursor with its own key cache and page cache, so interleaved readers don't evict each other's state.
+The log's own readKey(), readSerial() and readNext() use a default cursor with IOTALOG_CACHE_PAGES.
+Each cursor reads an uncompressed log through a File handle of its own, so its seeks follow the FAT
+cluster chain from where it last read.  In a segmented log the handle is on the segment last read.
+write(), begin() and end() keep the cursors' caches current.
+A cursor must not outlive its log.
+********************************************************************************************************/
+class IotaLog;
+
+class IotaLogCursor
+{
+  public:
+
+    IotaLogCursor(IotaLog& log, int pages = 1);
+    ~IotaLogCursor();
+
+    int readKey (IotaLogRecord* /* pointer to caller's buffer */);
+    int readSerial(IotaLogRecord* callerRecord, int32_t serial); 
+    int readNext(IotaLogRecord* /* pointer to caller's buffer */);
+    uint32_t readRange(IotaLogRecord* callerRecord, uint32_t begin, uint32_t end, uint32_t step,
+                       IotaLogRangeCallback callback);
+
+  private:
+
+    friend class IotaLog;
+
+    IotaLog*  _log;                         // Log read by this cursor
+    IotaLogCursor* _next;                   // Next cursor on the log
+    File      _file;                        // Cursor's own handle on the log (see logFile())
+    uint32_t  _fileNumber;                  // Segment number of... (0 if not segmented)
+
+    uint32_t  _cacheSize;
+    uint32_t  _cacheWrap;  
+    uint32_t* _cacheKey;
+    int32_t*  _cacheSerial;
+    uint32_t  _rangeKey;                    // Key of last record read
+    int32_t   _rangeSerial;                 // Serial of... (-1 none)
+
+    IotaLogPage* _pages;                    // Page cache
+    int       _pageCount;                   // Pages in cache
+    uint32_t  _pageUse;                     // LRU sequence
+    uint32_t  _lastReadPos;                 // File position of last record read
+
+    int64_t*  _blockFixed;                  // Decoded record in fixed point (compressed log)
+    uint32_t  _blockMap;                    // Channel map word of...
+    uint32_t  _blockKey;                    // Key of...
+    int32_t   _blockSerial;                 // Serial of... (-1 none)
+    uint32_t  _blockPos;                    // File position following...
+    uint32_t* _blockIndex;                  // Cached block offsets
+    uint32_t  _blockIndexBase;              // First block in...
+    uint32_t  _blockIndexCount;             // Entries in...
+
+    int       readStep(IotaLogRecord* callerRecord, uint32_t key);
+    void      readCache(IotaLogRecord* callerRecord, uint32_t pos);
+    File&     logFile(uint32_t pos, uint32_t len);
+    bool      pageAlloc(IotaLogPage* page, bool small);
+    void      readRecord(IotaLogRecord* callerRecord, const uint8_t* data, uint32_t pos, uint16_t size,
+                         uint32_t map);
+    bool      readBlock(IotaLogRecord* callerRecord, int32_t serial);
+    bool      decodeNext();
+    bool      readVarint(uint32_t& pos, uint64_t& value, uint32_t& crc);
+    int       readByte(uint32_t& pos);
+    uint32_t  blockOffset(uint32_t block);
+    void      writeCache(const uint8_t* data, uint32_t pos);
+    void      clearCache();
+    bool      searchIndex(IotaLogRecord* callerRecord, uint32_t key);
+    void      searchKey(IotaLogRecord* callerRecord, const uint32_t key,
+                        const uint32_t lowKey, const int32_t lowSerial, 
+                        const uint32_t highKey, const int32_t highSerial);
+};
+
 class IotaLog
 {
   public:
 
-	IotaLog(int interval=5, uint32_t days = 365) {
+	IotaLog(int interval=5, uint32_t days = 365, int pages = IOTALOG_CACHE_PAGES) {
     _path = nullptr;
+    _headerPath = nullptr;
+    _headerWrites = 0;
+    _indexPath = nullptr;
+    _index = nullptr;
+    _indexCount = 0;
+    _indexAlloc = 0;
+    _indexFloor = 0;
+    _indexValid = false;
 		_interval = interval;
-		_recordSize = sizeof(IotaLogRecord);
+		_recordSize = IOTALOG_RECORD_V1;
+    _channels = IOTALOG_ALL_CHANNELS;
+    _newChannels = IOTALOG_ALL_CHANNELS;
+    _accums = 0;
+    _newAccums = 0;
+    _checked = false;
+    _repair = false;
+    _repairLow = 0;
+    _repairHigh = 0;
+    _compressed = false;
+    _blockMaps = false;
+    _newCompress = false;
+    _blockPath = nullptr;
+    _blocks = 0;
+    _writeFixed = nullptr;
+    _writeKey = 0;
+    _dataStart = 0;
     _fileSize = 0;
-		_lastReadKey = 0;
-		_lastReadSerial = 0;
 		_readKeyIO = 0;
 		_wrap = 0;
 		_firstKey = 0;
@@ -47,18 +403,49 @@ class IotaLog
 		_lastKey = 0;
 		_lastSerial = -1;
     _entries = 0;
-    _cacheSize = 10;
-    _cacheWrap = 0;
-    _cacheKey = new uint32_t[_cacheSize];
-    _cacheSerial = new int32_t[_cacheSize];
+    _pageSize = (IOTALOG_PAGE_BYTES / _recordSize) * _recordSize;
+    _cursors = nullptr;
+    _cursor = new IotaLogCursor(*this, pages);
+    _commitBuffer = nullptr;
+    _commitBytes = 0;
+    _commitRecords = 1;
+    _commitSeconds = 0;
+    _commitCount = 0;
+    _commitPos = 0;
+    _commitKey = 0;
+    _extent = 0;
+    _tail = nullptr;
+    _tailSeconds = 0;
+    _tailRecords = 0;
+    _tailCount = 0;
+    _tailNext = 0;
+    _segmentDir = nullptr;
+    _segments = nullptr;
+    _segmentCount = 0;
+    _segmentAlloc = 0;
+    _segmentNumber = 0;
+    _segmentRecords = 0;
+    _segmentBytes = 0;
+    _segmentStart = 0;
+    _segmentKey = 0;
+    _newSegmentDays = 0;
     setDays(days);     
 	}
 	
 	~IotaLog(){
     IotaFile.close();
+    BlockFile.close();
     delete[] _path;
-    delete[] _cacheKey;
-    delete[] _cacheSerial;
+    delete[] _headerPath;
+    delete[] _indexPath;
+    delete[] _index;
+    delete _cursor;
+    freeCommit();
+    freeTail();
+    delete[] _blockPath;
+    delete[] _writeFixed;
+    delete[] _segmentDir;
+    delete[] _segments;
 	}
 	      
     int begin (const char* /* filepath */);
@@ -66,7 +453,12 @@ class IotaLog
     int readKey (IotaLogRecord* /* pointer to caller's buffer */);
     int readSerial(IotaLogRecord* callerRecord, int32_t serial); 
     int readNext(IotaLogRecord* /* pointer to caller's buffer */);
+    uint32_t readRange(IotaLogRecord* callerRecord, uint32_t begin, uint32_t end, uint32_t step,
+                       IotaLogRangeCallback callback);
     int end();
+    int commit();
+    int repair(uint32_t ms = 0);
+    bool repairing();
     
     boolean  isOpen();
     uint32_t firstKey();
@@ -77,16 +469,59 @@ class IotaLog
     uint32_t readKeyIO();
     uint32_t interval();
     uint32_t setDays(uint32_t); 
+    uint32_t setCommit(uint32_t records, uint32_t seconds);
+    uint32_t setTail(uint32_t seconds);
+    uint32_t setPreallocate(uint32_t bytes);
+    uint32_t setSegmentDays(uint32_t days);
+    uint32_t setChannels(uint32_t channels);
+    uint32_t channels();
+    uint32_t setAccums(uint32_t accums);
+    uint32_t accums();
+    bool     setCompress(bool compress);
+    bool     compressed();
+    bool     remaps();
+    uint16_t recordSize();
 	 	      
     void     dumpFile();
+    static uint32_t heapUsed();
 
   private:
         
 	  File 	 IotaFile;
+    File     BlockFile;                     // Block index of compressed log
 
     char*    _path;                         // file pathname
-    uint16_t _interval;	                    // Posting interval to log. Currently tested only using 5.
-    uint16_t _recordSize;      	  		      // Size of a log record
+    char*    _headerPath;                   // header file pathname
+    uint32_t _headerWrites;                 // Writes since header checkpoint
+    char*    _indexPath;                    // hole index pathname
+
+    IotaLogIndex* _index;                   // Hole index, ascending
+    uint16_t  _indexCount;                  // Holes in index
+    uint16_t  _indexAlloc;                  // Allocated entries
+    int32_t   _indexFloor;                  // Index is complete from this serial
+    bool      _indexValid;                  // Index has been loaded
+
+    uint32_t _interval;	                    // Posting interval to log. Currently tested only using 5.
+    uint16_t _recordSize;      	  		      // Size of a stored record
+    uint32_t _channels;                     // Channel map of the open file
+    uint32_t _newChannels;                  // Channel map for a new file
+    uint32_t _accums;                       // IOTALOG_ACCUM_THD and _VAR stored in the open file
+    uint32_t _newAccums;                    // ...for a new file
+    uint32_t _dataStart;                    // File position of first record (after format block)
+    uint32_t _days;                         // Retention set by setDays()
+    uint32_t _extent;                       // Preallocation increment (0 = none)
+
+    bool      _checked;                     // Records carry a crc
+    bool      _repair;                      // Damage found, for repair()
+    int32_t   _repairLow;                   // First serial of the damaged range
+    int32_t   _repairHigh;                  // Next serial to check after...
+    bool      _compressed;                  // Open file is block compressed
+    bool      _blockMaps;                   // ...with a channel map per block
+    bool      _newCompress;                 // Compress a new file
+    char*     _blockPath;                   // block index pathname
+    uint32_t  _blocks;                      // Blocks in log
+    int64_t*  _writeFixed;                  // Last record written, fixed point
+    uint32_t  _writeKey;                    // Key of...
     uint32_t _fileSize;                     // Size of file in bytes
     uint32_t _entries;                      // Number of entries (fileSize / recsize(256))
     uint32_t _maxFileSize;				        	// Maximum filesize in bytes
@@ -96,19 +531,101 @@ class IotaLog
     int32_t  _lastSerial;                   // Serial of...
     uint32_t _wrap;                         // Offset of logical record zero (0 if file not wrapped)
 
-    uint32_t  _cacheSize = 10;
-    uint32_t  _cacheWrap = 0;  
-    uint32_t* _cacheKey;
-    int32_t*  _cacheSerial;
+    friend class IotaLogCursor;
+
+    IotaLogCursor* _cursor;                 // Default cursor
+    IotaLogCursor* _cursors;                // List of cursors on this log
+    uint32_t  _pageSize;                    // Bytes per cache page
+
+    uint8_t*  _commitBuffer;                // Records buffered for group commit
+    uint16_t  _commitBytes;                 // Size of buffer
+    uint16_t  _commitRecords;               // Records per group commit (1 = write through)
+    uint16_t  _commitCount;                 // Records in buffer
+    uint32_t  _commitSeconds;               // Maximum span of buffered records
+    uint32_t  _commitPos;                   // File position of first buffered record
+    uint32_t  _commitKey;                   // Key of first buffered record
+
+    uint8_t*  _tail;                        // Ring of recent records
+    uint32_t  _tailSeconds;                 // Span set by setTail()
+    uint16_t  _tailRecords;                 // Records in ring
+    uint16_t  _tailCount;                   // Records held (the newest, ending at _lastSerial)
+    uint16_t  _tailNext;                    // Slot of next record written
+
+    char*     _segmentDir;                  // Segment directory (nullptr if a single file)
+    IotaLogSegment* _segments;              // Full segments, oldest first
+    uint16_t  _segmentCount;                // Full segments
+    uint16_t  _segmentAlloc;                // Allocated entries
+    uint32_t  _segmentNumber;               // Number of the segment being written
+    uint32_t  _segmentRecords;              // Records per segment, when full
+    uint32_t  _segmentBytes;                // Bytes per segment at the current record size
+    uint32_t  _segmentStart;                // Log position of the segment being written
+    uint32_t  _segmentKey;                  // Key of its first record
+    uint32_t  _newSegmentDays;              // setSegmentDays() for a new log (0 = single file)
   
-    uint32_t _lastReadKey;           	    // Key of last record read with readKey
-    int32_t  _lastReadSerial;         	    // Serial of last...
     uint32_t _readKeyIO;              	    // Running count of I/Os for keyed reads
     
+    void      clearCache();
+    void      readCommit(uint8_t* data, uint32_t pos, uint32_t len);
+    bool      commitAlloc();
+    void      freeCommit();
+    void      writeTail(const uint8_t* data);
+    void      freeTail();
+    bool      readTail(IotaLogRecord* callerRecord, int32_t serial);
+    bool      searchTail(IotaLogRecord* callerRecord, uint32_t key);
+    bool      readFormat();
+    void      newFormat();
+    void      writeFormat();
+    bool      checkRecord(const uint8_t* data);
+    bool      checkRecord(const uint8_t* data, uint16_t size);
+    bool      goodRecord(uint8_t* data, int32_t serial);
+    int32_t   checkEnds();
+    int32_t   fileSerial();
+    uint32_t  serialPos(int32_t serial);
+    int       repairFile();
+    void      startOver();
+    void      reindex(int32_t low, int32_t high);
+    void      damaged(uint32_t pos);
+    void      rewriteRecord(uint8_t* source, uint32_t pos, uint32_t key, int32_t serial);
+    void      pack(uint8_t* data, const IotaLogRecord* callerRecord);
+    void      unpack(IotaLogRecord* callerRecord, const uint8_t* data);
+    void      unpack(IotaLogRecord* callerRecord, const uint8_t* data, uint32_t map);
+    bool      storedAccum(int n);
+    void      remap();
+    void      scanFile();
+    void      extend();
+    String    segmentPath(uint32_t number);
+    bool      beginSegments();
+    bool      readSegments();
+    void      listSegments();
+    void      rebuildSegments();
+    void      saveSegments();
+    void      addSegment(uint32_t number, uint32_t firstKey, int32_t firstSerial, uint32_t records,
+                         uint32_t map);
+    int       segmentAt(uint32_t pos);
+    uint16_t  layout(uint32_t pos, uint32_t& start, uint32_t& end, uint32_t& map);
+    bool      newSegment();
+    void      trimSegments();
+    void      joinSegments();
+    void      splitSegments();
+    bool      readBlocks();
+    void      rebuildBlocks();
+    void      appendBlock(uint32_t pos, bool flush = true);
+    int       writeBlock(IotaLogRecord* callerRecord, bool hole);
+    static int fixedCount(uint32_t map);
+    static uint16_t storedSize(uint32_t map, bool checked);
+    void      toFixed(int64_t* fixed, const IotaLogRecord* callerRecord, uint32_t map);
+    void      fromFixed(IotaLogRecord* callerRecord, const int64_t* fixed, uint32_t map);
+    uint32_t  serialKey(int32_t serial);
+    bool      readHeader();
+    void      writeHeader();
+    void      loadIndex();
+    void      saveIndex();
+    void      addIndex(uint32_t key, int32_t serial);
+    void      appendIndex();
+    void      pruneIndex();
+    void      findHoles(uint32_t lowKey, int32_t lowSerial, uint32_t highKey, int32_t highSerial);
+    static uint32_t crc32(const void* data, size_t len, uint32_t crc = 0);
     uint32_t  findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos, uint32_t lowKey);
-    void      searchKey(IotaLogRecord* callerRecord, const uint32_t key,
-                        const uint32_t lowKey, const int32_t lowSerial, 
-                        const uint32_t highKey, const int32_t highSerial);
       
 };
 
@@ -10,6 +10,8 @@ const char*      unitstr[] = {
                     "Wh", 
                     "kWh", 
                     "PF",
+                    "THD",
+                    "VAR",
                     ""
                     };
 
@@ -22,6 +24,8 @@ uint8_t     unitsPrecision[] = {
                     /*Wh*/    4, 
                     /*kWh*/   7, 
                     /*PF*/    3,
+                    /*THD*/   1,
+                    /*VAR*/   2,
                     /*None*/  0 
                     };                   
 
@@ -69,10 +73,24 @@ const char*   Script::getUnits() {return unitstr[_units];};
 
 int           Script::precision(){return unitsPrecision[_units];};
 
+uint32_t      Script::accums(){
+  if(_units == unitsVAR) return IOTALOG_ACCUM_VAR;
+  if(_units == unitsTHD) return IOTALOG_ACCUM_THD;
+  return 0;
+}
+
 size_t        ScriptSet::count() {return _count;}
 
 Script*       ScriptSet::first() {return _listHead;}  
 
+uint32_t      ScriptSet::accums(){
+  uint32_t accums = 0;
+  for(Script* script=_listHead; script; script=script->next()){
+    accums |= script->accums();
+  }
+  return accums;
+}
+
 void    Script::print() {
         uint8_t* token = _tokens;
         String string = "Script:";
@@ -142,7 +160,7 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsed
 
 double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsedHours){
         uint8_t* tokens = _tokens;
-        double result, var, watts;
+        double result, watts;
         switch(_units) {
 
           case unitsWatts:
@@ -163,9 +181,7 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsed
             break;
 
           case unitsVA:
-            var = runRecursive(&tokens, oldRec, newRec, elapsedHours, 'R');
-            watts = runRecursive(&tokens, oldRec, newRec, elapsedHours, '1');
-            result = sqrt(watts*watts + var*var); 
+            result = runRecursive(&tokens, oldRec, newRec, elapsedHours, '2'); 
             break;
 
           case unitsHz:
@@ -174,8 +190,15 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsed
 
           case unitsPF:
             watts = runRecursive(&tokens, oldRec, newRec, elapsedHours, '1');
-            var = runRecursive(&tokens, oldRec, newRec, elapsedHours, 'R');
-            result = watts / sqrt(watts*watts + var*var); 
+            result = watts / runRecursive(&tokens, oldRec, newRec, elapsedHours, '2'); 
+            break;
+
+          case unitsTHD:
+            result = runRecursive(&tokens, oldRec, newRec, elapsedHours, 'T'); 
+            break;
+
+          case unitsVAR:
+            result = runRecursive(&tokens, oldRec, newRec, elapsedHours, 'R'); 
             break;
         }
         
@@ -220,9 +243,11 @@ double  Script::runRecursive(uint8_t** tokens, IotaLogRecord* oldRec, IotaLogRec
               // accum2 is VAh, Hzh
               // Type 1 retieves accum1
               // Type 2 retrieves accum2
-              // Type R computes var as sqrt(VA^2 - W^2)
+              // Type R retrieves signed var (accum4), or unless both records were read
+              //        with it computes it as sqrt(VA^2 - W^2)
               // Type A computes Amps as VA / V
               // Type H retrieves Hz for associated voltage channel
+              // Type T retrieves THD (accum3, zero unless both records were read with it)
 
           if(*token & getInputOp){
             if(type == '1'){
@@ -232,9 +257,14 @@ double  Script::runRecursive(uint8_t** tokens, IotaLogRecord* oldRec, IotaLogRec
               operand = (newRec->accum2[*token % 32] - (oldRec ? oldRec->accum2[*token % 32] : 0.0)) / elapsedHours;
             }
             else if(type == 'R'){
-              double VA = (newRec->accum2[*token % 32] - (oldRec ? oldRec->accum2[*token % 32] : 0.0)) / elapsedHours;
-              double W = (newRec->accum1[*token % 32] - (oldRec ? oldRec->accum1[*token % 32] : 0.0)) / elapsedHours;
-              operand = sqrt(VA*VA - W*W);
+              if((newRec->logged & IOTALOG_ACCUM_VAR) && ( ! oldRec || (oldRec->logged & IOTALOG_ACCUM_VAR))){
+                operand = (newRec->accum4[*token % 32] - (oldRec ? oldRec->accum4[*token % 32] : 0.0)) / elapsedHours;
+              }
+              else {
+                double VA = (newRec->accum2[*token % 32] - (oldRec ? oldRec->accum2[*token % 32] : 0.0)) / elapsedHours;
+                double W = (newRec->accum1[*token % 32] - (oldRec ? oldRec->accum1[*token % 32] : 0.0)) / elapsedHours;
+                operand = sqrt(VA*VA - W*W);
+              }
             }
             else if(type == 'A'){
               double VA = (newRec->accum2[*token % 32] - (oldRec ? oldRec->accum2[*token % 32] : 0.0)) / elapsedHours;
@@ -251,6 +281,12 @@ double  Script::runRecursive(uint8_t** tokens, IotaLogRecord* oldRec, IotaLogRec
               int vchannel = inputChannel[*token % 32]->_vchannel;
               operand = (newRec->accum2[vchannel] - (oldRec ? oldRec->accum2[vchannel] : 0.0)) / elapsedHours;
             }
+            else if(type == 'T'){
+              operand = 0.0;
+              if((newRec->logged & IOTALOG_ACCUM_THD) && ( ! oldRec || (oldRec->logged & IOTALOG_ACCUM_THD))){
+                operand = (newRec->accum3[*token % 32] - (oldRec ? oldRec->accum3[*token % 32] : 0.0)) / elapsedHours;
+              }
+            }
             else operand = 0.0;
             if(operand != operand) operand = 0;
           }
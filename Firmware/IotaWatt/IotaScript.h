@@ -14,7 +14,9 @@ enum        units {
             unitsWh = 5,
             unitskWh = 6,
             unitsPF = 7,
-            unitsNone = 8
+            unitsTHD = 8,
+            unitsVAR = 9,
+            unitsNone = 10
             };         // Units to be computed   
 
 class Script {
@@ -35,6 +37,7 @@ class Script {
     double  run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsedHours, units); // Run w/overide units
     void    print();
     int     precision();
+    uint32_t accums();  // IotaLogRecord accumulators beyond accum1 and accum2 read for its units
 
   private:
 
@@ -93,6 +96,7 @@ class ScriptSet {
 
     size_t    count();      // Retrieve count of Scripts in the set.
     Script*   first();      // Get -> first Script in set
+    uint32_t  accums();     // IotaLogRecord accumulators read by the Scripts in the set
 
   private:
 
@@ -61,6 +61,7 @@
 #include "webServer.h"
 #include "updater.h"
 #include "samplePower.h"
+#include "burst.h"
 #include "influxDB.h"
 #include "Emonservice.h"
 #include "auth.h"
@@ -78,10 +79,24 @@ extern ESP8266WebServer server;
 extern DNSServer dnsServer;
 extern IotaLog currLog;
 extern IotaLog histLog;
+extern IotaLog* historyTier[];              // Rollups of histLog, coarsest first
+extern bool historyGaps;                    // Leave gaps in histLog as holes rather than filling them
 extern RTC_PCF8523 rtc;
 extern Ticker ticker;
 extern messageLog msglog;
 
+#define HISTORY_TIERS 3                     // Rollup tiers maintained by historyLog
+
+      // Read cursors on the combined log for logReadKey() and logReadRange()
+
+struct logCursors {
+  IotaLogCursor*  curr;
+  IotaLogCursor*  hist;
+  IotaLogCursor*  tier[HISTORY_TIERS];
+  logCursors();
+  ~logCursors();
+};
+
 #define MS_PER_HOUR   3600000UL
 #define SEVENTY_YEAR_SECONDS  2208988800UL
 
@@ -90,6 +105,7 @@ extern messageLog msglog;
 extern char* deviceName;
 extern const char* IotaLogFile;
 extern const char* historyLogFile;
+extern const char* historyTierFile[];
 extern const char* IotaMsgLog;
 
         // Define the hardware pins
@@ -185,8 +201,15 @@ struct EEprom {
 #define ADC_BITS 12
 #define ADC_RANGE 4096      // 2^12
 
+#include "sampleADC.h"      // ADC access for sampling
+
 extern uint32_t lastCrossMs;           // Timestamp at last zero crossing (ms) (set in samplePower)
+extern uint32_t lastCycleStartUs;      // Start (micros) and length of last good sampleCycles
+extern uint32_t lastCycleUs;
 extern uint32_t nextCrossMs;           // Time just before next zero crossing (ms) (computed in Loop)
+extern uint32_t sampleStaleMs;         // Longest a channel goes unsampled (ms)
+extern uint8_t  sampleCTs;             // Power channels sampled per cycle (samplePowers)
+extern uint16_t harmonicCycles;        // Samples of a channel per harmonic analysis (0 = none)
 
 enum priorities: byte {priorityLow=3, priorityMed=2, priorityHigh=1};
 
@@ -292,10 +315,9 @@ extern const char     base64codes_P[];
 
 extern uint32_t sumVsq;                           // sampleCycle will compute these while collecting samples    
 extern uint32_t sumIsq;
-extern int32_t  sumVI;
+extern int64_t  sumVI;                            // Phase corrected
+extern int64_t  sumVQ;                            // ...and a quarter cycle away (VAR)
 extern int16_t  samples;                          // Number of samples taken in last sampling
-extern int16_t  Vsample [MAX_SAMPLES];            // voltage/current pairs during sampling
-extern int16_t  Isample [MAX_SAMPLES];
 
       // ************************ Declare global functions
 void      setup();
@@ -305,6 +327,7 @@ void      logTrace(void);
 
 void      NewService(uint32_t (*serviceFunction)(struct serviceBlock*), const uint8_t taskID=0);
 void      AddService(struct serviceBlock*);
+int       nextSampleChannels(int* channels);
 uint32_t  dataLog(struct serviceBlock*);
 uint32_t  historyLog(struct serviceBlock*);
 uint32_t  statService(struct serviceBlock*);
@@ -315,7 +338,13 @@ uint32_t  updater(struct serviceBlock*);
 uint32_t  WiFiService(struct serviceBlock*);
 uint32_t  getFeedData(); //(struct serviceBlock*);
 
-uint32_t  logReadKey(IotaLogRecord* callerRecord);
+uint32_t  logReadKey(IotaLogRecord* callerRecord, logCursors* cursors);
+uint32_t  logReadRange(IotaLogRecord* callerRecord, uint32_t begin, uint32_t end, uint32_t step,
+                       IotaLogRangeCallback callback, logCursors* cursors);
+uint32_t  logChannels();
+uint32_t  logAccums();
+void      setLogFormat();
+void      checkLogChannels(IotaLog* iotaLog, const char* service);
 
 void      setLedCycle(const char*);
 void      endLedCycle();
@@ -332,6 +361,7 @@ size_t    sendChunk(char* buf, size_t bufPos);
 uint32_t  HTTPreserve(uint16_t id, bool lock = false);
 void      HTTPrelease(uint32_t HTTPtoken);
 
-void      getSamples();
+enum      sampleFormat {sampleFormatLegacy, sampleFormatCSV, sampleFormatBinary};   // getSamples output
+void      getSamples(uint16_t Ichan, uint16_t Vchan = 0, sampleFormat format = sampleFormatLegacy);
 
 #endif
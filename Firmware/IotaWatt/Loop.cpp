@@ -14,19 +14,21 @@ void loop()
   setLedState();
 
   // ------- If AC zero crossing approaching, go sample a channel.
-  static int lastChannel = 0;
   if((uint32_t)(millis() - lastCrossMs) >= (430 / int(frequency))){
-    trace(T_LOOP,1,lastChannel);
-    int nextChannel = (lastChannel + 1) % maxInputs;
-    while( (! inputChannel[nextChannel]->isActive()) && nextChannel != lastChannel){
-      nextChannel = ++nextChannel % maxInputs;
+    trace(T_LOOP,1);
+    if( ! burstCapture()){                             // A burst slice in place of this sample
+      int channels[MAX_CYCLE_CTS];
+      int count = nextSampleChannels(channels);
+      ESP.wdtFeed();
+      trace(T_LOOP,2,channels[0]);
+      if(count > 1){
+        samplePowers(channels, count);
+      } else {
+        samplePower(channels[0], 0);
+      }
+      trace(T_LOOP,2);
     }
-    ESP.wdtFeed();
-    trace(T_LOOP,2,nextChannel);
-    samplePower(nextChannel, 0);
-    trace(T_LOOP,2);
     nextCrossMs = lastCrossMs + 490 / int(frequency);
-    lastChannel = nextChannel;
   }
 
   // --------- Give web server a shout out.
@@ -100,6 +102,76 @@ void loop()
  * polls for activity.
  ********************************************************************************************************/
 
+/*****************************************************************************************************
+ * nextSampleChannels() picks the channels to sample next.
+ * 
+ * Rather than round-robin, channels get a share of the sampling in proportion to how much their
+ * power is changing - the standard deviation of recent samples (IotaInputChannel::sampled) plus a
+ * floor so that steady channels still get some.  That samples a fluctuating heat pump much more 
+ * often than a steady standby load, which is where the samples do the most good for energy accuracy.
+ * Voltage channels get only the floor, as their voltage is measured with every power channel.
+ * 
+ * The channel picked is the one that has waited longest, weighted by its share.  But any channel 
+ * that has gone sampleStaleMs without a sample goes first, oldest first, so no channel gets much 
+ * staler than that.
+ * 
+ * If it's a power channel and sampleCTs (config "samplects") is more than one, the next in line of 
+ * the power channels on the same voltage channel join it, up to sampleCTs, to be sampled together 
+ * in one cycle by samplePowers.  Returns the number of channels.
+ *****************************************************************************************************/
+
+      // Sampling priority of a channel, or -1 if not active.  Stale channels are above all others.
+
+static double samplePriority(IotaInputChannel* channel, uint32_t timeNow){
+  const float weightFloor = 5.0;                      // Watts
+  if( ! channel->isActive()) return -1.0;
+  uint32_t age = timeNow - channel->_sampleMs;
+  if(age >= sampleStaleMs){
+    return 1.0e15 + age;
+  }
+  float weight = weightFloor;
+  if(channel->_type == channelTypePower){
+    weight += sqrt(channel->_sampleVar);
+  }
+  return age * weight;
+}
+
+int nextSampleChannels(int* channels){
+  uint32_t timeNow = millis();
+  int count = 0;
+  int maxCount = 1;
+  int Vchannel = -1;
+  do {
+    int nextChannel = -1;
+    double nextPriority = -1.0;
+    for(int i=0; i<maxInputs; i++){
+      IotaInputChannel* channel = inputChannel[i];
+      if(count){
+        if(channel->_type != channelTypePower || channel->_vchannel != Vchannel) continue;
+        bool picked = false;
+        for(int j=0; j<count; j++) picked |= channels[j] == i;
+        if(picked) continue;
+      }
+      double priority = samplePriority(channel, timeNow);
+      if(priority > nextPriority){
+        nextPriority = priority;
+        nextChannel = i;
+      }
+    }
+    if(nextChannel < 0) break;
+    if(count == 0 && inputChannel[nextChannel]->_type == channelTypePower){
+      Vchannel = inputChannel[nextChannel]->_vchannel;
+      maxCount = constrain(sampleCTs, 1, MAX_CYCLE_CTS);
+    }
+    inputChannel[nextChannel]->_sampleMs = timeNow;   // Tried, whether it works or not
+    channels[count++] = nextChannel;
+  } while(count < maxCount);
+  if(count == 0){
+    channels[count++] = 0;
+  }
+  return count;
+}
+
 void NewService(uint32_t (*serviceFunction)(struct serviceBlock*), const uint8_t taskID){
     serviceBlock* newBlock = new serviceBlock;
     newBlock->service = serviceFunction;
@@ -240,6 +240,8 @@ uint32_t PVoutput::tickUploadStatus(){
         oldRecord = nullptr;
         delete newRecord;
         newRecord = nullptr;
+        delete histCursor;
+        histCursor = nullptr;
         delete request;
         request = nullptr;
         delete response;
@@ -254,6 +256,9 @@ uint32_t PVoutput::tickUploadStatus(){
         _state = getSystemService;
         return 1;
     }
+    if( ! histCursor){
+        histCursor = new IotaLogCursor(histLog);
+    }
     
             // Insure base energy values for the current day are set.
 
@@ -262,8 +267,9 @@ uint32_t PVoutput::tickUploadStatus(){
         if( ! oldRecord){
             oldRecord = new IotaLogRecord;
         }
+        oldRecord->setAccums(_outputs->accums());
         oldRecord->UNIXtime = local2UTC(_lastReqTime - _lastReqTime % UNIX_DAY);
-        histLog.readKey(oldRecord);
+        histCursor->readKey(oldRecord);
         Script* script = _outputs->first();
         while(script){
             if(strcmp(script->name(),"generation") == 0){
@@ -316,6 +322,8 @@ uint32_t PVoutput::tickUploadStatus(){
     if( ! newRecord) {
         newRecord = new IotaLogRecord;
     }
+    oldRecord->setAccums(_outputs->accums());
+    newRecord->setAccums(_outputs->accums());
     if(oldRecord->UNIXtime != local2UTC(_lastReqTime)){
         trace(T_PVoutput,86);
         if(newRecord->UNIXtime == local2UTC(_lastReqTime)){
@@ -324,11 +332,11 @@ uint32_t PVoutput::tickUploadStatus(){
             newRecord = temp;
         } else {
             oldRecord->UNIXtime = local2UTC(_lastReqTime);
-            histLog.readKey(oldRecord);
+            histCursor->readKey(oldRecord);
         }
     }
     newRecord->UNIXtime = local2UTC(_lastReqTime + _interval);
-    histLog.readKey(newRecord);
+    histCursor->readKey(newRecord);
 
             // See if there was any measurement during this interval
             // Skip ahead if not.
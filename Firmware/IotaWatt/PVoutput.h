@@ -84,6 +84,7 @@ public:
         ,_lastReqTime(0)
         ,oldRecord(nullptr)
         ,newRecord(nullptr)
+        ,histCursor(nullptr)
         ,_POSTrequest(nullptr)
         ,_rateLimitReset(0)
         ,_baseTime(0)
@@ -93,6 +94,7 @@ public:
         delete[] _apiKey;
         delete oldRecord;
         delete newRecord;
+        delete histCursor;
         delete _outputs;
         delete request;
         delete response;
@@ -189,6 +191,7 @@ private:
     uint32_t    _lastReqTime;               // Local time of last output or status in reqData or posted not confirmed
     IotaLogRecord* oldRecord;               // Older of two log records bracketing a reporting interval
     IotaLogRecord* newRecord;               // Newer of two log records bracketing a reporting interval    
+    IotaLogCursor* histCursor;              // Read cursor on histLog
     POSTrequest* _POSTrequest;              // Details of active POST request
 
     int32_t     _rateLimitLimit;            // Flow control from PVoutput response headers
@@ -0,0 +1,269 @@
+#include "IotaWatt.h"
+
+      // Burst capture, see burst.h.
+
+int8_t   burstChannel = -1;
+int8_t   burstPending = -1;
+
+static float    burstThreshold = 0;
+static uint16_t burstSeconds = 2;
+static bool     burstRaw = false;
+static uint32_t burstHoldoffMs = 0;           // No trigger before
+static float    burstBefore = 0;              // Power before and at trigger
+static float    burstTrigger = 0;
+static bool     burstTriggered = false;       // Pending burst is by threshold (not command)
+
+/*****************************************************************************************************
+ * burstWriter - the double buffer.  append() fills the active buffer and swaps when it's full;
+ * write() writes the other if it's full.  If both fill before a write(), append() has to write
+ * then and there, which is counted as an overrun (the sampling was held up).  The buffers are
+ * allocated by begin(), which returns false if it can't.
+ *****************************************************************************************************/
+class burstWriter {
+  public:
+    burstWriter(File& file)
+    :overruns(0)
+    ,_file(file)
+    ,_fill(0)
+    ,_active(0)
+    ,_full(false)
+    {
+      _buf[0] = nullptr;
+      _buf[1] = nullptr;
+    }
+    ~burstWriter(){
+      delete[] _buf[0];
+      delete[] _buf[1];
+    }
+    bool begin(){
+      _buf[0] = new uint8_t[BURST_BUFFER_BYTES];
+      _buf[1] = new uint8_t[BURST_BUFFER_BYTES];
+      return _buf[0] && _buf[1];
+    }
+    void append(const void* data, size_t len){
+      const uint8_t* bytes = (const uint8_t*)data;
+      while(len){
+        size_t n = min(len, (size_t)(BURST_BUFFER_BYTES - _fill));
+        memcpy(_buf[_active] + _fill, bytes, n);
+        _fill += n;
+        bytes += n;
+        len -= n;
+        if(_fill == BURST_BUFFER_BYTES){
+          if(_full){
+            write();
+            overruns++;
+          }
+          _full = true;
+          _active ^= 1;
+          _fill = 0;
+        }
+      }
+    }
+    void write(){
+      if(_full){
+        _file.write(_buf[_active ^ 1], BURST_BUFFER_BYTES);
+        _full = false;
+      }
+    }
+    void flush(){
+      write();
+      _file.write(_buf[_active], _fill);
+      _fill = 0;
+      _file.flush();
+    }
+    uint32_t  overruns;
+
+  private:
+    File&     _file;
+    uint8_t*  _buf[2];
+    size_t    _fill;                          // Bytes in active buffer
+    int       _active;                        // Buffer being filled
+    bool      _full;                          // The other one is waiting to be written
+};
+
+/*****************************************************************************************************
+ * burstRun - a burst in progress, kept between slices.
+ *****************************************************************************************************/
+struct burstRun {
+      IotaInputChannel* Vchannel;
+      IotaInputChannel* Ichannel;
+      File          file;
+      burstWriter   writer;                   // Cycles without raw samples
+      uint8_t*      raw;                      // A burstCycle and its raw samples
+      uint32_t      startMs;
+      uint32_t      startUs;
+      uint32_t      cycles;
+      uint32_t      rejects;
+      char          path[32];
+      burstRun()
+      :Vchannel(nullptr)
+      ,Ichannel(nullptr)
+      ,writer(file)
+      ,raw(nullptr)
+      ,startMs(0)
+      ,startUs(0)
+      ,cycles(0)
+      ,rejects(0){}
+      ~burstRun(){delete[] raw;}
+    };
+
+static burstRun* burst = nullptr;             // Burst in progress
+
+#define BURST_RAW_BYTES (sizeof(burstCycle) + MAX_SAMPLES * 2 * sizeof(int16_t))
+
+/*****************************************************************************************************
+ * burstHeap - the heap a burst needs, with BURST_HEAP_RESERVE left over.
+ *****************************************************************************************************/
+static uint32_t burstHeap(){
+  return sizeof(burstRun) + (burstRaw ? BURST_RAW_BYTES : 2 * BURST_BUFFER_BYTES) + BURST_HEAP_RESERVE;
+}
+
+/*****************************************************************************************************
+ * burstConfig - arm (or with channel -1, disarm) the threshold trigger.
+ * burstCheck - called by setPower with the new power, before it's set.
+ * burstStart - capture a burst of channel at the next sample.  Returns false if there isn't the
+ *              heap for it, or one is already pending or running.
+ *****************************************************************************************************/
+void burstConfig(int channel, float threshold, uint16_t seconds, bool raw){
+  burstChannel = (channel >= 0 && channel < maxInputs && threshold > 0) ? channel : -1;
+  burstThreshold = threshold;
+  burstSeconds = constrain(seconds, 1, BURST_MAX_SECONDS);
+  burstRaw = raw;
+  burstHoldoffMs = millis() + BURST_HOLDOFF_MS;       // Let the readings settle
+}
+
+void burstCheck(IotaInputChannel* channel, float watts){
+  if(channel->_channel != burstChannel || burstPending >= 0 || burst) return;
+  if((int32_t)(millis() - burstHoldoffMs) < 0) return;
+  if(fabs(watts - channel->dataBucket.watts) >= burstThreshold){
+    burstBefore = channel->dataBucket.watts;
+    burstTrigger = watts;
+    burstTriggered = true;
+    burstPending = burstChannel;
+  }
+}
+
+bool burstStart(int channel){
+  if(burstPending >= 0 || burst || ESP.getFreeHeap() < burstHeap()){
+    return false;
+  }
+  burstTriggered = false;
+  burstPending = channel;
+  return true;
+}
+
+/*****************************************************************************************************
+ * burstBegin - open the file and allocate for the pending burst.  Returns false if there isn't
+ *              one or it's refused.
+ * burstEnd - finish the running burst.
+ *****************************************************************************************************/
+static bool burstBegin(){
+  if(burstPending < 0) return false;
+  IotaInputChannel* Ichannel = inputChannel[burstPending];
+  burstPending = -1;
+  burstHoldoffMs = millis() + BURST_HOLDOFF_MS;
+  if( ! Ichannel->isActive() || Ichannel->_type != channelTypePower) return false;
+  uint32_t heap = ESP.getFreeHeap();
+  if(heap < burstHeap()){
+    log("burst: not enough heap, %u free, %u needed", heap, burstHeap());
+    return false;
+  }
+  burst = new burstRun;
+  if( ! burst){
+    log("burst: not enough heap");
+    return false;
+  }
+  if(burstRaw){
+    burst->raw = new uint8_t[BURST_RAW_BYTES];
+  }
+  if(burstRaw ? ! burst->raw : ! burst->writer.begin()){
+    log("burst: not enough heap");
+    delete burst;
+    burst = nullptr;
+    return false;
+  }
+  burst->Ichannel = Ichannel;
+  burst->Vchannel = inputChannel[Ichannel->_vchannel];
+
+  if( ! SD.exists(BURST_DIR)){
+    SD.mkdir(BURST_DIR);
+  }
+  sprintf(burst->path, "%s/%08X.dat", BURST_DIR, UTCtime());
+  burst->file = SD.open(burst->path, FILE_WRITE);
+  if( ! burst->file){
+    log("burst: can't create %s", burst->path);
+    delete burst;
+    burst = nullptr;
+    return false;
+  }
+  trace(T_POWER,7,Ichannel->_channel);
+  burstHeader header;
+  memset(&header, 0, sizeof(header));
+  header.id = BURST_HEADER_ID;
+  header.UNIXtime = UTCtime();
+  if(burstTriggered){
+    header.threshold = burstThreshold;
+    header.wattsBefore = burstBefore;
+    header.wattsTrigger = burstTrigger;
+  }
+  header.seconds = burstSeconds;
+  header.Vchan = burst->Vchannel->_channel;
+  header.Ichan = Ichannel->_channel;
+  header.raw = burstRaw;
+  burst->file.write((uint8_t*)&header, sizeof(header));
+  burst->startMs = millis();
+  burst->startUs = micros();
+  return true;
+}
+
+static void burstEnd(){
+  if( ! burst->raw){
+    burst->writer.flush();
+  }
+  burst->file.close();
+  log("burst: channel %d, %u cycles (%u rejected, %u overruns) to %s", burst->Ichannel->_channel, 
+      burst->cycles, burst->rejects, burst->writer.overruns, burst->path);
+  delete burst;
+  burst = nullptr;
+  burstHoldoffMs = millis() + BURST_HOLDOFF_MS;
+}
+
+/*****************************************************************************************************
+ * burstCapture - start the pending burst, if any, or carry on with the one running, for a slice.
+ * Returns true if it ran.
+ *****************************************************************************************************/
+bool burstCapture(){
+  if( ! burst && ! burstBegin()) return false;
+  IotaInputChannel* Vchannel = burst->Vchannel;
+  IotaInputChannel* Ichannel = burst->Ichannel;
+  int16_t* capture = burst->raw ? (int16_t*)(burst->raw + sizeof(burstCycle)) : nullptr;
+  uint32_t sliceMs = millis();
+  while((uint32_t)(millis() - sliceMs) < BURST_SLICE_MS){
+    if((uint32_t)(millis() - burst->startMs) >= burstSeconds * 1000UL){
+      burstEnd();
+      return true;
+    }
+    burstCycle cycle;
+    cycle.us = micros() - burst->startUs;
+    cycle.rtc = samplePowerCycle(Vchannel, Ichannel, capture);
+    cycle.samples = (capture && cycle.rtc == 0) ? samples : 0;
+    cycle.Vrms = Vchannel->dataBucket.volts;
+    cycle.Hz = Vchannel->dataBucket.Hz;
+    cycle.watts = Ichannel->dataBucket.watts;
+    cycle.VA = Ichannel->dataBucket.VA;
+    cycle.Irms = cycle.Vrms > 0 ? cycle.VA / cycle.Vrms / (Ichannel->_double ? 2 : 1) : 0;
+    if(burst->raw){                                   // Before the next crossing
+      memcpy(burst->raw, &cycle, sizeof(cycle));
+      burst->file.write(burst->raw, sizeof(cycle) + cycle.samples * 2 * sizeof(int16_t));
+    }
+    else {
+      burst->writer.append(&cycle, sizeof(cycle));
+      burst->writer.write();
+    }
+    burst->cycles++;
+    if(cycle.rtc) burst->rejects++;
+    ESP.wdtFeed();
+    yield();
+  }
+  return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+/*********************************************************************************************************
+ *
+ *      Burst capture - sample one V/I pair continuously for a few seconds, to see motor inrush,
+ *      compressor starts and the like that happen between visits of the sampling scheduler.
+ *
+ *      A burst is armed on a power channel by config "burst": {"channel":n, "threshold":watts,
+ *      "seconds":s, "raw":bool}.  When setPower() sees the channel's power change by threshold
+ *      or more from one sample to the next (burstCheck), Loop runs burstCapture() in place of
+ *      the next scheduled sample.  command?burst=n starts one on channel n at once.
+ *
+ *      Each burst is a file iotawatt/burst/<UNIXtime in hex>.dat: a burstHeader, then a 
+ *      burstCycle for every cycle sampled, each followed by its raw V,I samples (int16 pairs, as
+ *      getSamples) if raw is set.  Cycles are about one and a half line cycles apart, the time
+ *      between being the crossing that sampleCycle waits for, and that is when the file is
+ *      written.  Without raw samples, records go through two BURST_BUFFER_BYTES buffers: one fills
+ *      while the other waits for the next gap to be written.  With them, each cycle is captured
+ *      after room for its record and written in one piece, so a cycle costs at most one SD write.
+ *
+ *      A burst doesn't start unless the heap has room for its buffers and BURST_HEAP_RESERVE
+ *      to spare.  It runs in slices of BURST_SLICE_MS, in place of the scheduled samples, so
+ *      the web server and services still get a turn between them.  The burst channel's buckets
+ *      are updated every cycle and the others carry their last values across the burst, so the
+ *      energy logged is unbroken.  Bursts are at least BURST_HOLDOFF_MS apart.
+ *
+ * *******************************************************************************************************/
+
+#define BURST_DIR "iotawatt/burst"
+#define BURST_HEADER_ID 0x54534249UL          // "IBST"
+#define BURST_BUFFER_BYTES 512                // Each of two, for cycles without raw samples
+#define BURST_HEAP_RESERVE 12000              // Free heap to leave for everything else
+#define BURST_SLICE_MS 250                    // Sampling before letting the Loop have a turn
+#define BURST_MAX_SECONDS 10
+#define BURST_HOLDOFF_MS 60000
+
+struct burstHeader {
+      uint32_t  id;                           // BURST_HEADER_ID
+      uint32_t  UNIXtime;                     // Start of burst
+      float     threshold;                    // Change in watts that triggered (0 = by command)
+      float     wattsBefore;                  // Power before and at the trigger
+      float     wattsTrigger;
+      uint16_t  seconds;
+      uint8_t   Vchan;
+      uint8_t   Ichan;
+      uint8_t   raw;                          // Cycles are followed by raw samples
+      uint8_t   reserved[3];
+    };
+
+struct burstCycle {
+      uint32_t  us;                           // Start of sampling, from start of burst
+      float     Vrms;
+      float     Irms;
+      float     watts;
+      float     VA;
+      float     Hz;
+      int16_t   samples;                      // Raw V,I pairs following (0 if none)
+      int16_t   rtc;                          // sampleCycle return code
+    };
+
+extern int8_t   burstChannel;                 // Armed channel (-1 = none)
+extern int8_t   burstPending;                 // Channel to capture next (-1 = none)
+
+void    burstConfig(int channel, float threshold, uint16_t seconds, bool raw);
+void    burstCheck(IotaInputChannel* channel, float watts);
+bool    burstStart(int channel);
+bool    burstCapture();
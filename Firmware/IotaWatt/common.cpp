@@ -100,6 +100,11 @@ WiFiManager wifiManager;
 DNSServer dnsServer;    
 IotaLog currLog(5,365);                     // current data log  (1 year) 
 IotaLog histLog(60,3652);                   // history data log  (10 years)  
+IotaLog dayLog(86400,3652,1);               // history rollup tiers (10 years), one page cursors
+IotaLog hourLog(3600,3652,1);
+IotaLog quarterLog(900,3652,1);
+IotaLog* historyTier[HISTORY_TIERS] = {&dayLog, &hourLog, &quarterLog};
+bool historyGaps = false;                   // Leave gaps in histLog as holes (config "histgaps")
 RTC_PCF8523 rtc;                            // Instance of RTC_PCF8523
 Ticker ticker;
 messageLog msglog;                          // Message log handler    
@@ -109,6 +114,7 @@ messageLog msglog;                          // Message log handler
 char* deviceName;             
 const char* IotaLogFile = "iotawatt/iotalog";
 const char* historyLogFile = "iotawatt/histLog";
+const char* historyTierFile[HISTORY_TIERS] = {"iotawatt/hist1d", "iotawatt/hist1h", "iotawatt/hist15m"};
 const char* IotaMsgLog = "iotawatt/iotamsgs.txt";
                        
 uint8_t ADC_selectPin[2] = {pin_CS_ADC0,    // indexable reference for ADC select pins
@@ -128,7 +134,12 @@ traceUnion traceEntry;
        **************************************************************************************************/
        
 uint32_t lastCrossMs = 0;             // Timestamp at last zero crossing (ms) (set in samplePower)
+uint32_t lastCycleStartUs = 0;        // Start (micros) and length of last good sampleCycles
+uint32_t lastCycleUs = 0;
 uint32_t nextCrossMs = 0;             // Time just before next zero crossing (ms) (computed in Loop)
+uint32_t sampleStaleMs = 2000;        // Longest a channel goes unsampled (config "samplestale")
+uint8_t  sampleCTs = 1;               // Power channels sampled per cycle (config "samplects")
+uint16_t harmonicCycles = 0;          // Samples of a channel per harmonic analysis (config "harmonics")
 
       // Various queues and lists of resources.
 
@@ -220,7 +231,6 @@ const char base64codes_P[] PROGMEM = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnop
 
 uint32_t  sumVsq;                                   // sampleCycle will compute these while collecting samples    
 uint32_t  sumIsq;
-int32_t   sumVI; 
+int64_t   sumVI;                                    // Phase corrected
+int64_t   sumVQ;                                    // ...and a quarter cycle away (VAR)
 int16_t   samples = 0;                              // Number of samples taken in last sampling
-int16_t   Vsample [MAX_SAMPLES];                    // voltage/current pairs during sampling
-int16_t   Isample [MAX_SAMPLES];
@@ -3,7 +3,8 @@
  * The IotaLog class handles the SD file work.
  * If there is no file, it will be created.
  * 
- * The log records contain 2 double precision value*hours accumulators for each channel.
+ * The log records contain 2 double precision value*hours accumulators for each channel,
+ * and a third (THD hours) in logs created with harmonic analysis on.
  * Currently the two are Volt*Hrs / hz.Hrs for VT channels and
  * Watt*Hrs / Irms*Hrs for CT channels.
  * 
@@ -16,11 +17,25 @@
  * but they are ordered.  It is relatively quick to find any record by key (UNIXtime) and a 
  * readKEY method is provided in the IotaLog class.
  * 
+ * With group commit ("logcommit" in the config) the last few records are held in RAM.  If the 
+ * IotaWatt restarts before they are written, they are lost along with the buckets, and the log
+ * resumes from the last committed record.  The gap is filled as after any other outage, with
+ * records that carry forward the last accumulators and logHours, so it reads as no data.
+ * Planned restarts end() the log first.
+ * 
+ * A bad record that a reader finds in the log is mended between writes, a
+ * slice at a time (IotaLog::repair).
+ * 
+ * The logs store just the inputs configured, taking up any added later.  A new
+ * current log is segmented and a new history log block compressed
+ * (see setLogFormat).
+ * 
  * As with all of the SERVICES, it has a  single function call and is implimented as state machine.
  * Services should try not to execute for more than a few milliseconds at a time.
  **********************************************************************************************/
  #include "IotaWatt.h"
  #define GapFill 600           // Fill in gaps of less than this seconds 
+ #define RepairMs 20           // Slice of log repair between writes
        
  uint32_t dataLog(struct serviceBlock* _serviceBlock){
   enum states {initialize, checkClock, logData};
@@ -28,6 +43,8 @@
   static IotaLogRecord* logRecord = new IotaLogRecord;
   static double accum1Then [MAXINPUTS];
   static double accum2Then [MAXINPUTS];
+  static double accum3Then [MAXINPUTS];
+  static double accum4Then [MAXINPUTS];
   static uint32_t timeThen = 0;
   uint32_t timeNow = millis();
   static uint32_t timeNext;
@@ -43,13 +60,17 @@
 
       // Initialize the IotaLog class
       
+      setLogFormat();
       if(int rtc = currLog.begin(IotaLogFile)){
         log("dataLog: Log file open failed. %d", rtc);
         dropDead();
       }
+      checkLogChannels(&currLog, "dataLog");
 
-      // Initialize the IotaLogRecord accums in case no context.
+      // Initialize the IotaLogRecord accums in case no context,
+      // with THD and VAR hours as configured.
 
+      logRecord->setAccums(logAccums());
       for(int i=0; i<MAXINPUTS; i++){
         logRecord->accum1[i] = 0.0;
         logRecord->accum2[i] = 0.0;
@@ -87,6 +108,8 @@
           inputChannel[i]->ageBuckets(timeNow);
           accum1Then[i] = inputChannel[i]->dataBucket.accum1;
           accum2Then[i] = inputChannel[i]->dataBucket.accum2;
+          accum3Then[i] = inputChannel[i]->dataBucket.accum3;
+          accum4Then[i] = inputChannel[i]->dataBucket.accum4;
         }
       }
       timeThen = timeNow;
@@ -108,6 +131,14 @@
  
     case logData: {
 
+      // Mend any damage readers have found in the log, a slice at a time
+      // between writes.
+
+      if(UTCtime() < timeNext && currLog.repairing()){
+        currLog.repair(RepairMs);
+        return currLog.repairing() ? 1 : timeNext;
+      }
+
       // If this seems premature.... get outta here.
 
       if(UTCtime() < timeNext) return timeNext;
@@ -126,18 +157,32 @@
             logRecord->accum2[i] += _input->dataBucket.accum2 - accum2Then[i];
             if(logRecord->accum2[i] != logRecord->accum2[i]) logRecord->accum2[i] = 0;
             accum2Then[i] = _input->dataBucket.accum2;
+            if(logRecord->accum3){
+              logRecord->accum3[i] += _input->dataBucket.accum3 - accum3Then[i];
+              if(logRecord->accum3[i] != logRecord->accum3[i]) logRecord->accum3[i] = 0;
+            }
+            accum3Then[i] = _input->dataBucket.accum3;
+            if(logRecord->accum4){
+              logRecord->accum4[i] += _input->dataBucket.accum4 - accum4Then[i];
+              if(logRecord->accum4[i] != logRecord->accum4[i]) logRecord->accum4[i] = 0;
+            }
+            accum4Then[i] = _input->dataBucket.accum4;
           }
           else {
             accum1Then[i] = 0;
             accum2Then[i] = 0;
+            accum3Then[i] = 0;
+            accum4Then[i] = 0;
           }
         }
         timeThen = timeNow;
         logRecord->logHours += elapsedHrs;
       }
 
-      // set the time and record number and write the entry.
+      // set the time and record number and write the entry,
+      // with any THD hours turned on since.
       
+      logRecord->setAccums(logAccums());
       logRecord->UNIXtime = timeNext;
       logRecord->serial++;
       currLog.write(logRecord);
@@ -152,7 +197,11 @@
 }
 
 /******************************************************************************
- * logReadKey(iotaLogRecord) - read a keyed record from the combined log
+ * logReadKey(iotaLogRecord, cursors) - read a keyed record from the combined log
+ * 
+ * Reads are made through the caller's cursors on each log, so that concurrent 
+ * queries don't disturb each other's (or the uploaders') caches.  A cursor is
+ * only made for a log once the query reads it.
  * 
  * This function brokers keyed log read requests, servicing them from the
  * appropriate log:
@@ -167,9 +216,18 @@
  * large interval (60 seconds).
  * Look ma - no holes!  direct access w/o searching.
  * 
+ * history tiers:
+ * 15 minute, hourly and daily rollups of histLog maintained by historyLog.
+ * Each record is identical to the histLog record with the same key, so 
+ * any key in a tier can be read from it with the same result.  Queries grouped
+ * by day, week, month or year then read consecutive records of a small file.
+ * 
  * This function will decide the most appropriate log to retrieve the requested 
  * record from based on these principles.
  * 
+ * If the key is a multiple of a history tier interval, and is contained in that
+ * tier, use the coarsest such tier.
+ * 
  * If the key is a multiple of the history log interval, and is contained in
  * the history log, use the history log.
  * 
@@ -184,26 +242,158 @@
  * 
  * ***************************************************************************/
 
-uint32_t logReadKey(IotaLogRecord* callerRecord) {
-  uint32_t key = callerRecord->UNIXtime;
+logCursors::logCursors(){
+  curr = nullptr;
+  hist = nullptr;
+  for(int i=0; i<HISTORY_TIERS; i++){
+    tier[i] = nullptr;
+  }
+}
+
+logCursors::~logCursors(){
+  delete curr;
+  delete hist;
+  for(int i=0; i<HISTORY_TIERS; i++){
+    delete tier[i];
+  }
+}
+
+static IotaLog* logFor(uint32_t key) {
+  for(int i=0; i<HISTORY_TIERS; i++){         // coarsest tier containing key
+    IotaLog* tier = historyTier[i];
+    if(tier->isOpen() && (key % tier->interval()) == 0 && 
+       key >= tier->firstKey() && key <= tier->lastKey()){
+      return tier;
+    }
+  }
   if(key % histLog.interval()){               // not multiple of histLog interval
     if(key >= currLog.firstKey()){            // in iotaLog
-      return currLog.readKey(callerRecord);
-    }
-    if(key <= histLog.lastKey()){             // in histLog
-      return histLog.readKey(callerRecord);
+      return &currLog;
     }
   }
   else {                                      // multiple of histLog interval
-    if(key <= histLog.lastKey()){             // in histLog
-      return histLog.readKey(callerRecord);
+    if(key > histLog.lastKey() && key >= currLog.firstKey()){   // in IotaLog
+      return &currLog;
     }
-    if(key >= currLog.firstKey()){            // in IotaLog
-      return currLog.readKey(callerRecord);
+  }
+  return &histLog;                            // in histLog, or between the two logs (rare)
+}
+
+static IotaLogCursor* logCursor(IotaLog* log, logCursors* cursors) {
+  IotaLogCursor** cursor = &cursors->hist;
+  if(log == &currLog){
+    cursor = &cursors->curr;
+  }
+  for(int i=0; i<HISTORY_TIERS; i++){
+    if(log == historyTier[i]){
+      cursor = &cursors->tier[i];
     }
   }
-  callerRecord->UNIXtime = histLog.lastKey(); // between the two logs (rare)
-  histLog.readKey(callerRecord);
-  callerRecord->UNIXtime = key;
-  return 0;
+  if( ! *cursor){
+    *cursor = new IotaLogCursor(*log);
+  }
+  return *cursor;
+}
+
+uint32_t logReadKey(IotaLogRecord* callerRecord, logCursors* cursors) {
+  return logCursor(logFor(callerRecord->UNIXtime), cursors)->readKey(callerRecord);
+}
+
+/******************************************************************************
+ * logReadRange(iotaLogRecord, begin, end, step, callback, cursors) - read 
+ * begin, begin + step ... end from the combined log, as IotaLog::readRange.
+ * 
+ * Each key is read from the log logReadKey() would use.  Consecutive keys 
+ * served by the same log are read as one range of its cursor, so a query
+ * resolves where it starts in each log once and then steps through it.
+ * ***************************************************************************/
+
+uint32_t logReadRange(IotaLogRecord* callerRecord, uint32_t begin, uint32_t end, uint32_t step,
+                      IotaLogRangeCallback callback, logCursors* cursors) {
+  uint32_t count = 0;
+  uint32_t key = begin;
+  while(key <= end){
+    IotaLog* log = logFor(key);
+    uint32_t runEnd = key;
+    while(step && runEnd <= end - step && logFor(runEnd + step) == log){
+      runEnd += step;
+    }
+    uint32_t run = step ? (runEnd - key) / step + 1 : 1;
+    uint32_t read = logCursor(log, cursors)->readRange(callerRecord, key, runEnd, step, callback);
+    count += read;
+    if(read < run || step == 0 || runEnd > end - step){
+      break;
+    }
+    key = runEnd + step;
+  }
+  return count;
+}
+
+/*****************************************************************************
+ * Log format
+ * 
+ * All of the logs store the accumulators of just the inputs configured.
+ * The current log has fixed size records, so it is created in segments
+ * (config "logsegdays", default 7 days).  Each segment has its own map, and a
+ * change of inputs starts a new segment with the new map.
+ * 
+ * The history log and its tiers are only appended, so they are created block
+ * compressed.  They keep everything rather than wrapping.  The map is kept per
+ * block, so an input added is stored from the next block on.
+ * 
+ * So in either, an input added later, or the THD hours once harmonics are
+ * turned on, are stored from then on (setLogFormat() runs again when the config
+ * is reloaded), and read as zero before that.
+ * Existing logs keep the format they were created with; checkLogChannels()
+ * reports inputs, or THD and VAR hours, that one of them can't store until it
+ * is deleted and recreated.
+ * 
+ * New logs also store the signed VAR hours (accum4) for Scripts with units VAR,
+ * and with harmonic analysis on (config "harmonics") the THD hours (accum3) for
+ * units THD.  Readers only allocate them in their IotaLogRecords
+ * (IotaLogRecord::setAccums) when the units of their Scripts need them.  VA and
+ * PF come from the logged VA hours (accum2).
+ * ***************************************************************************/
+
+uint32_t logChannels(){
+  uint32_t channels = 0;
+  for(int i=0; i<maxInputs && i<IOTALOG_CHANNELS; i++){
+    if(inputChannel[i] && inputChannel[i]->isActive()){
+      channels |= 1UL << i;
+    }
+  }
+  return channels;
+}
+
+uint32_t logAccums(){
+  return IOTALOG_ACCUM_VAR | (harmonicCycles ? IOTALOG_ACCUM_THD : 0);
+}
+
+void setLogFormat(){
+  uint32_t channels = logChannels();
+  uint32_t accums = logAccums();
+  currLog.setChannels(channels);
+  currLog.setAccums(accums);
+  histLog.setChannels(channels);
+  histLog.setAccums(accums);
+  histLog.setCompress(true);
+  for(int i=0; i<HISTORY_TIERS; i++){
+    historyTier[i]->setChannels(channels);
+    historyTier[i]->setAccums(accums);
+    historyTier[i]->setCompress(true);
+  }
+}
+
+void checkLogChannels(IotaLog* iotaLog, const char* service){
+  if(iotaLog->remaps()){
+    return;
+  }
+  uint32_t missing = logChannels() & ~iotaLog->channels();
+  if(missing){
+    log("%s: inputs not in log (map %04x), delete log to record them: %04x", service, iotaLog->channels(), missing);
+  }
+  uint32_t accums = logAccums() & ~iotaLog->accums();
+  if(accums){
+    log("%s: THD/VAR hours not in log (map %05x), delete log to record them: %05x", service, iotaLog->accums(), accums);
+  }
 }
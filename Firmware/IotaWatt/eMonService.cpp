@@ -52,6 +52,7 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
   static states state = initialize;
   static IotaLogRecord* logRecord = nullptr;
   static IotaLogRecord* oldRecord = nullptr;
+  static IotaLogCursor* logCursor = nullptr;
   static uint32_t lastRequestTime = 0;          // Time of last measurement in last or current request
   static uint32_t UnixNextPost = 0;             // Next measurement to be posted
   static xbuf reqData;
@@ -173,9 +174,13 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
       if( ! oldRecord){
         oldRecord = new IotaLogRecord;
       }
+      oldRecord->setAccums(emonOutputs->accums());
+      if( ! logCursor){
+        logCursor = new IotaLogCursor(currLog);
+      }
       trace(T_Emon,5);
       oldRecord->UNIXtime = EmonLastPost;      
-      currLog.readKey(oldRecord);
+      logCursor->readKey(oldRecord);
 
             // Assume that record was posted (not important).
             // Plan to start posting one interval later
@@ -207,6 +212,8 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
         oldRecord = nullptr;
         delete logRecord;
         logRecord = nullptr;
+        delete logCursor;
+        logCursor = nullptr;
         delete request;
         request = nullptr;
         reqData.flush();
@@ -242,15 +249,16 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
         if( ! logRecord){
           logRecord = new IotaLogRecord;
         }
+        logRecord->setAccums(emonOutputs->accums());
         logRecord->UNIXtime = UnixNextPost;
-        currLog.readKey(logRecord);    
+        logCursor->readKey(logRecord);    
       
             // Compute the time difference between log entries.
             // If zero, read ahead to skip over a potentially lengthy gap.
             
         double elapsedHours = logRecord->logHours - oldRecord->logHours;
         if(elapsedHours == 0 || elapsedHours != elapsedHours){
-          if(currLog.readNext(logRecord) == 0) {
+          if(logCursor->readNext(logRecord) == 0) {
             UnixNextPost = logRecord->UNIXtime - (logRecord->UNIXtime % EmonCMSInterval);
           }
           UnixNextPost += EmonCMSInterval;
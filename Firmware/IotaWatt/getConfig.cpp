@@ -62,7 +62,33 @@ boolean getConfig(void){
     
   if(Config.containsKey("logdays")){ 
     log("Current log overide days: %d", currLog.setDays(Config["logdays"].as<int>()));
-  }      
+  }
+  
+  currLog.setSegmentDays(7);                            // A new current log is segmented (see setLogFormat)
+  if(Config.containsKey("logsegdays")){
+    log("Current log segment days: %d", currLog.setSegmentDays(Config["logsegdays"].as<int>()));
+  }
+
+  if(Config.containsKey("logcommit")){
+    uint32_t records = Config["logcommit"].as<int>();
+    log("Current log group commit: %d records", currLog.setCommit(records, Config["logcommitsecs"] | (records * currLog.interval())));
+  }
+
+  historyGaps = Config["histgaps"] | false;            // Outages left as holes in the history log
+
+  sampleStaleMs = Config["samplestale"] | 2000;         // Adaptive sampling's limit on channel staleness
+  sampleCTs = constrain(Config["samplects"] | 1, 1, MAX_CYCLE_CTS);   // Power channels sampled per cycle
+  harmonicCycles = Config["harmonics"] | 0;             // Harmonic analysis every this many samples of a channel
+
+  JsonObject& burst = Config["burst"];                  // Burst capture trigger
+  if(burst.success()){
+    burstConfig(burst["channel"] | -1, burst["threshold"] | 0.0, burst["seconds"] | 2, burst["raw"] | false);
+  } else {
+    burstConfig(-1, 0, 2, false);
+  }
+
+  currLog.setTail(Config["logtailsecs"] | 300);         // Recent records held in RAM for uploaders
+  currLog.setPreallocate(Config["logextent"] | IOTALOG_EXTENT_BYTES);
 
         //************************************ Configure device ***************************
 
@@ -189,6 +215,17 @@ boolean getConfig(void){
   else if(pvoutput){
     pvoutput->end();
   } 
+
+      // Inputs added are taken up by the logs at their next block or segment (see setLogFormat).
+      // Those an open log can't take up are reported.
+
+  setLogFormat();
+  if(currLog.isOpen()){
+    checkLogChannels(&currLog, "dataLog");
+  }
+  if(histLog.isOpen()){
+    checkLogChannels(&histLog, "historyLog");
+  }
   
   ConfigFile.close();
   trace(T_CONFIG,12);
@@ -344,6 +381,7 @@ bool configInputs(const char* JsonStr){
   }
   phaseTableEntry* phaseTable = nullptr;
   buildPhaseTable(&phaseTable);
+  buildPhaseFIR();
   for(int i=0; i<MIN(maxInputs,JsonInputs.size()); i++) {
     if(JsonInputs[i].is<JsonObject>()){
       JsonObject& input = JsonInputs[i].as<JsonObject&>();
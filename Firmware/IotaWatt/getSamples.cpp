@@ -1,9 +1,66 @@
-
 #include "IotaWatt.h"
 
-void getSamples(){ //(struct serviceBlock* _serviceBlock){
+/*****************************************************************************************************
+ * getSamples() - capture one cycle of raw samples of a V/I pair and send them.
+ * 
+ * Used by /samples (and the older command?sample) to diagnose CT and VT problems remotely.
+ * The cycle is sampled right here, so the sampling loop is held for just the one extra cycle,
+ * and it is sent from the capture buffer afterward.  Samples are ADC counts less the offset,
+ * voltage the mean of the reads either side of the current's, in time order from the first
+ * crossing of the cycle and evenly spaced over it.  The voltage is not phase corrected; the 
+ * correction that sampleCycle applied to it is reported so that it can be.
+ * 
+ * Legacy:  "samples n" then a line of "V,I" for each pair (command?sample).  Against the channel's own
+ *          voltage channel, as /samples.
+ * CSV:     lines of "name,value" for the header fields then "us,V,I" for each pair.
+ * Binary:  a sampleHeader then int16 V,I for each pair, little-endian.
+ * 
+ * A cycle that fails to sample is reported with a 503, rather than retried.
+ *****************************************************************************************************/
+
+#define SAMPLE_HEADER_ID 0x504D5349UL         // "ISMP"
+
+struct sampleHeader {
+      uint32_t  id;                           // SAMPLE_HEADER_ID
+      uint32_t  UNIXtime;                     // When sampled
+      uint32_t  startUs;                      // micros() at first crossing
+      uint32_t  cycleUs;                      // Length of the cycle
+      int16_t   samples;                      // Pairs that follow
+      uint8_t   Vchan;
+      uint8_t   Ichan;
+      int16_t   Voffset;                      // ADC bias subtracted during sampling
+      int16_t   Ioffset;
+      float     correction;                   // Phase correction applied to voltage, degrees
+      float     shift;                        // ...in samples
+    };
+
+void getSamples(uint16_t Ichan, uint16_t Vchan, sampleFormat format){
   // trace T_GFD
 
+      // Sample a cycle of the channel against the voltage channel and capture the raw samples.
+
+  IotaInputChannel* Vchannel = inputChannel[Vchan];
+  IotaInputChannel* Ichannel = inputChannel[Ichan];
+  sampleHeader header;
+  header.id = SAMPLE_HEADER_ID;
+  header.Vchan = Vchan;
+  header.Ichan = Ichan;
+  header.Voffset = Vchannel->_offset;
+  header.Ioffset = Ichannel->_offset;
+  sampleCT CT;
+  int16_t* capture = new int16_t[MAX_SAMPLES * 2];
+  int rtc = sampleCycles(Vchannel, &Ichannel, 1, &CT, 1, capture);
+  if(rtc){
+    delete[] capture;
+    server.send(503, txtPlain_P, "Sampling failed, try again.");
+    return;
+  }
+  header.UNIXtime = UTCtime();
+  header.startUs = lastCycleStartUs;
+  header.cycleUs = lastCycleUs;
+  header.samples = samples;
+  header.correction = CT.correction;
+  header.shift = CT.steps;
  
   size_t   chunkSize = 1600;
   char* buf = new char[chunkSize+8];
@@ -12,15 +69,41 @@ void getSamples(){ //(struct serviceBlock* _serviceBlock){
       // Setup buffer to do it "chunky-style"
   
   server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-  server.send(200,"text","");
-  bufPos += sprintf_P(buf+bufPos , PSTR("samples %d\r\n"), samples);
+  if(format == sampleFormatBinary){
+    server.send(200, "application/octet-stream", "");
+    memcpy(buf+bufPos, &header, sizeof(header));
+    bufPos += sizeof(header);
+  }
+  else {
+    server.send(200,"text","");
+    if(format == sampleFormatCSV){
+      bufPos += sprintf_P(buf+bufPos, PSTR("time,%u\r\nvchan,%d\r\nichan,%d\r\nstartus,%u\r\ncycleus,%u\r\n"),
+                          header.UNIXtime, Vchan, Ichan, header.startUs, header.cycleUs);
+      bufPos += sprintf_P(buf+bufPos, PSTR("voffset,%d\r\nioffset,%d\r\ncorrection,%.3f\r\nshift,%.3f\r\n"),
+                          header.Voffset, header.Ioffset, header.correction, header.shift);
+      bufPos += sprintf_P(buf+bufPos, PSTR("samples,%d\r\n"), samples);
+    }
+    else {
+      bufPos += sprintf_P(buf+bufPos, PSTR("samples %d\r\n"), samples);
+    }
+  }
 
       // Loop to generate entries
   
-  for(int i=0; i<samples+1; i++){
-    bufPos += sprintf_P(buf+bufPos, PSTR("%d,%d\r\n"),Vsample[i], Isample[i]);
+  for(int i=0; i<samples; i++){
+    if(format == sampleFormatBinary){
+      memcpy(buf+bufPos, capture + i * 2, 2 * sizeof(int16_t));
+      bufPos += 2 * sizeof(int16_t);
+    }
+    else if(format == sampleFormatCSV){
+      bufPos += sprintf_P(buf+bufPos, PSTR("%u,%d,%d\r\n"), (uint32_t)((uint64_t)i * header.cycleUs / samples),
+                          capture[i * 2], capture[i * 2 + 1]);
+    }
+    else {
+      bufPos += sprintf_P(buf+bufPos, PSTR("%d,%d\r\n"),capture[i * 2], capture[i * 2 + 1]);
+    }
 
-    if(bufPos > (chunkSize - 15)){
+    if(bufPos > (chunkSize - 24)){
       sendChunk(buf, bufPos);
       bufPos = 6;
     }    
@@ -37,4 +120,5 @@ void getSamples(){ //(struct serviceBlock* _serviceBlock){
   sendChunk(buf, 6);
   trace(T_GFD,7);
   delete[] buf;
-}
\ No newline at end of file
+  delete[] capture;
+}
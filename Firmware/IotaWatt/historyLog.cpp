@@ -18,16 +18,41 @@
  * The records in this log are simply an identical subset of the one-minute entries,
  * real or virtual, that are (or were) in the currLog.
  * 
+ * This service also maintains the history tiers - 15 minute, hourly and daily logs 
+ * that are in turn an identical subset of the history log.  Queries with a large group
+ * read them instead, touching a few hundred records to cover years.  A new or lagging
+ * tier is filled from the history log a time slice at a time.
+ * 
+ * Catching up - after an outage, or when the history log has been deleted and is rebuilt
+ * from the current log - is done in bulk: each dispatch fills or copies as many records as
+ * fit before the next AC zero crossing, reading the current log as a range and group
+ * committing the writes, then updates the tiers once.
+ * 
+ * With historyGaps (config "histgaps"), a gap - a stretch with no current log data, either
+ * missing from the current log or before its first record - is left as a hole in the history
+ * log rather than filled with copies of the record before it.  A keyed read in the hole gets
+ * that same record, so readers see no data either way, but the gap costs one hole index entry
+ * instead of a record per minute.
+ * 
  **********************************************************************************************/
 #include "IotaWatt.h"
 #define GapFill 600           // Fill in gaps of less than this seconds 
+#define TierFillMs 20         // Time slice to fill history tiers
+#define HistFillMs 20         // Most time in one dispatch to catch up the history log
+
+bool fillTiers();
+bool fillTime(uint32_t startMs);
+void fillCommit(bool bulk);
       
 uint32_t historyLog(struct serviceBlock* _serviceBlock){
-  enum states {initialize, logFill, logData};
+  enum states {initialize, tierFill, logFill, logData};
   static states state = initialize;
   static uint32_t lastExitTime = 0;
   static uint32_t fillTarget = 0;                                         
+  static uint32_t copyKey = 0;                                            // Last current log key copied
+  static int32_t copySerial = -1;                                         // Serial of...
   static IotaLogRecord* logRecord = nullptr;
+  static IotaLogCursor* currCursor = nullptr;
   trace(T_history,0);  
  
   switch(state){
@@ -42,6 +67,7 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
       }
 
       log("historyLog: service started."); 
+      if( ! currCursor) currCursor = new IotaLogCursor(currLog);
 
         // Initialize the historyLog class
      
@@ -50,6 +76,7 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
         log("historyLog: Log file open failed: %d, service halted.", rtc);
         return 0;
       }
+      checkLogChannels(&histLog, "historyLog");
       
         // If it's not a new log, get the last entry.
      
@@ -61,26 +88,46 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
 
       else {
         if( ! logRecord) logRecord = new IotaLogRecord;
+        logRecord->setAccums(histLog.accums());
         logRecord->UNIXtime = currLog.firstKey();
         if(logRecord->UNIXtime % histLog.interval()){
             logRecord->UNIXtime += histLog.interval() - (logRecord->UNIXtime % histLog.interval());
         }
         log("historyLog: first entry %s", localDateString(logRecord->UNIXtime).c_str());
-        currLog.readKey(logRecord);
+        currCursor->readKey(logRecord);
         histLog.write(logRecord);
         delete logRecord;
         logRecord = nullptr;
       }
 
+        // Open the history tiers.  A tier that fails is just not used.
+
+      for(int i=0; i<HISTORY_TIERS; i++){
+        if(int rtc = historyTier[i]->begin(historyTierFile[i])){
+          log("historyLog: Tier %s open failed: %d", historyTierFile[i], rtc);
+        }
+      }
+
       trace(T_history,3);
-      if(histLog.lastKey() < currLog.firstKey()){
+      state = tierFill;
+      break;
+    } 
+
+          // tierFill brings the history tiers up to date with the history log
+          // before going on to maintain them all.
+
+    case tierFill: {
+      if(fillTiers()){
+        return 1;
+      }
+      if(histLog.lastKey() < currLog.firstKey() && ! historyGaps){
         fillTarget = currLog.firstKey();
         state = logFill;
       } else {
         state = logData;
       }
       break;
-    } 
+    }
 
           // logFill replicates the last history file record until fillTarget.
           // Used primarily to fill large gaps as when the current log has been 
@@ -89,13 +136,21 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
     case logFill: {
       if( ! logRecord) {
         logRecord = new IotaLogRecord;
+        logRecord->setAccums(histLog.accums());
         histLog.readSerial(logRecord, histLog.lastSerial());
+        fillCommit(true);
       }
-      logRecord->UNIXtime += histLog.interval();
-      if(logRecord->UNIXtime < fillTarget){ 
+      uint32_t startMs = millis();
+      do {
+        logRecord->UNIXtime += histLog.interval();
+        if(logRecord->UNIXtime >= fillTarget){
+          break;
+        }
         histLog.write(logRecord);
-      }
-      else {
+      } while(fillTime(startMs));
+      fillTiers();
+      if(logRecord->UNIXtime >= fillTarget){
+        fillCommit(false);
         delete logRecord;
         logRecord = nullptr;
         state = logData;
@@ -103,34 +158,52 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
       return 1;
     }
 
+          // logData copies the one minute records from the current log, as many
+          // as there is time for.  With historyGaps, records that the current log
+          // returns for keys in its holes (a repeat of the serial before) are skipped.
+
     case logData: {
-      trace(T_history,4);   
-      if((histLog.lastKey() + histLog.interval()) > currLog.lastKey()){
+      trace(T_history,4);
+      uint32_t key = max(histLog.lastKey(), copyKey) + histLog.interval();
+      if(historyGaps && key < currLog.firstKey()){
+        key = currLog.firstKey() + histLog.interval() - 1;
+        key -= key % histLog.interval();
+      }
+      if(key > currLog.lastKey()){
         return UTCtime() + 5;
       }
       trace(T_history,5);
       if( ! logRecord){
         logRecord = new IotaLogRecord;
-        logRecord->UNIXtime = histLog.lastKey(); 
-      }
-      logRecord->UNIXtime += histLog.interval();
-      if(currLog.readKey(logRecord)){
-      log("historyLog: primary log file read failure. Service suspended.");
-        delete logRecord;
-        logRecord = nullptr;
-        return 0;
+        logRecord->setAccums(logAccums());
+        fillCommit(key + histLog.interval() <= currLog.lastKey());
       }
-      trace(T_history,7); 
-      if(logRecord->UNIXtime % histLog.interval()){
-        Serial.print("log file record not multiple of history interval: ");
-        Serial.println(logRecord->UNIXtime);
+      uint32_t startMs = millis();
+      bool failed = false;
+      currCursor->readRange(logRecord, key, currLog.lastKey(), histLog.interval(), [&](IotaLogRecord*, int rtc) {
+        if(rtc){
+          failed = true;
+          return false;
+        }
+        trace(T_history,7);
+        copyKey = logRecord->UNIXtime;
+        if( ! historyGaps || logRecord->serial != copySerial){
+          copySerial = logRecord->serial;
+          trace(T_history,8);
+          histLog.write(logRecord);
+        }
+        return fillTime(startMs);
+      });
+      if(failed){
+        log("historyLog: primary log file read failure. Service suspended.");
+        fillCommit(false);
         delete logRecord;
         logRecord = nullptr;
         return 0;
       }
-      trace(T_history,8); 
-      histLog.write(logRecord);
-      if((histLog.lastKey() + histLog.interval()) > currLog.lastKey()){
+      fillTiers();
+      if((copyKey + histLog.interval()) > currLog.lastKey()){
+        fillCommit(false);
         delete logRecord;
         logRecord = nullptr;
       }
@@ -138,5 +211,65 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
     }
   }
   trace(T_history,9);
-  return histLog.lastKey() + histLog.interval(); 
-}
\ No newline at end of file
+  return max(histLog.lastKey(), copyKey) + histLog.interval(); 
+}
+
+/**********************************************************************************************
+ * fillTime - true while a bulk fill may go on: there is time before the next AC zero
+ * crossing and it has run less than HistFillMs.
+ **********************************************************************************************/
+bool fillTime(uint32_t startMs){
+  return (int32_t)(nextCrossMs - millis()) > 0 && (millis() - startMs) < HistFillMs;
+}
+
+/**********************************************************************************************
+ * fillCommit - group commit history log writes while catching up, and write through
+ * (committing anything buffered) once caught up.
+ **********************************************************************************************/
+void fillCommit(bool bulk){
+  if(bulk){
+    histLog.setCommit(IOTALOG_COMMIT_MAX, IOTALOG_COMMIT_MAX * histLog.interval());
+  } else {
+    histLog.setCommit(1, 0);
+  }
+}
+
+/**********************************************************************************************
+ * fillTiers - write history log records to each open history tier up to the end of the
+ * history log.  Returns true if the time slice ran out first.
+ **********************************************************************************************/
+bool fillTiers(){
+  static IotaLogCursor* histCursor = nullptr;
+  IotaLogRecord* tierRecord = nullptr;
+  uint32_t startTime = millis();
+  bool more = false;
+  if(histLog.lastKey() == 0){
+    return false;
+  }
+  for(int i=0; i<HISTORY_TIERS && ! more; i++){
+    IotaLog* tier = historyTier[i];
+    if( ! tier->isOpen()) continue;
+    while(true){
+      uint32_t key = tier->lastKey() + tier->interval();
+      if(tier->lastKey() == 0){
+        key = histLog.firstKey() + tier->interval() - 1;
+        key -= key % tier->interval();
+      }
+      if(key > histLog.lastKey()) break;
+      if((millis() - startTime) > TierFillMs){
+        more = true;
+        break;
+      }
+      if( ! tierRecord){
+        tierRecord = new IotaLogRecord;
+        tierRecord->setAccums(histLog.accums());
+      }
+      if( ! histCursor) histCursor = new IotaLogCursor(histLog);
+      tierRecord->UNIXtime = key;
+      histCursor->readKey(tierRecord);
+      tier->write(tierRecord);
+    }
+  }
+  delete tierRecord;
+  return more;
+}
@@ -39,6 +39,7 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
   static states state = initialize;
   static IotaLogRecord* logRecord = nullptr;
   static IotaLogRecord* oldRecord = nullptr;
+  static IotaLogCursor* logCursor = nullptr;    // Read cursor on currLog
   static uint32_t lastRequestTime = 0;          // Time of last measurement in last or current request
   static uint32_t lastBufferTime = 0;           // Time of last measurement reqData buffer
   static uint32_t UnixNextPost = UTCtime();    // Next measurement to be posted
@@ -256,8 +257,12 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
       if( ! oldRecord){
         oldRecord = new IotaLogRecord;
       }
+      oldRecord->setAccums(influxOutputs->accums());
+      if( ! logCursor){
+        logCursor = new IotaLogCursor(currLog);
+      }
       oldRecord->UNIXtime = influxLastPost;      
-      currLog.readKey(oldRecord);
+      logCursor->readKey(oldRecord);
       trace(T_influx,6);
 
           // Assume that record was posted (not important).
@@ -294,6 +299,8 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
           oldRecord = nullptr;
           delete logRecord;
           logRecord = nullptr;
+          delete logCursor;
+          logCursor = nullptr;
           delete request;
           request = nullptr;
           reqData.flush();
@@ -337,9 +344,10 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
         if( ! logRecord){
           logRecord = new IotaLogRecord;            
         }
+        logRecord->setAccums(influxOutputs->accums());
         trace(T_influx,7);
         logRecord->UNIXtime = UnixNextPost;
-        currLog.readKey(logRecord);
+        logCursor->readKey(logRecord);
         trace(T_influx,7);
         
             // Compute the time difference between log entries.
@@ -347,7 +355,7 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
             
         double elapsedHours = logRecord->logHours - oldRecord->logHours;
         if(elapsedHours == 0){
-          if(currLog.readNext(logRecord) == 0) {
+          if(logCursor->readNext(logRecord) == 0) {
             UnixNextPost = logRecord->UNIXtime - (logRecord->UNIXtime % influxDBInterval);
           }
           UnixNextPost += influxDBInterval;
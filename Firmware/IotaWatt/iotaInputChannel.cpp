@@ -1,4 +1,4 @@
-#include <iotawatt.h>
+#include "IotaWatt.h"
 
 void IotaInputChannel::reset(){
     delete[] _name;
@@ -24,6 +24,8 @@ void IotaInputChannel::ageBuckets(uint32_t timeNow) {
     double elapsedHrs = double((uint32_t)(timeNow - dataBucket.timeThen)) / 3600000E0;
     dataBucket.accum1 += dataBucket.value1 * elapsedHrs;
     dataBucket.accum2 += dataBucket.value2 * elapsedHrs;
+    dataBucket.accum3 += dataBucket.value3 * elapsedHrs;
+    dataBucket.accum4 += dataBucket.value4 * elapsedHrs;
     dataBucket.timeThen = timeNow;    
 }
 
@@ -37,6 +39,7 @@ void IotaInputChannel::setVoltage(float volts){
     if(_type != channelTypeVoltage) return;
     dataBucket.volts = volts;
     ageBuckets(millis());
+    sampled(volts);
 }
 
 void IotaInputChannel::setHz(float Hz){
@@ -44,11 +47,26 @@ void IotaInputChannel::setHz(float Hz){
     dataBucket.Hz = Hz;
 }
 
-void IotaInputChannel::setPower(float watts, float VA){
+void IotaInputChannel::setPower(float watts, float VA, float VAR){
     if(_type != channelTypePower) return;
+    burstCheck(this, watts);
     dataBucket.watts = watts;
     dataBucket.VA = VA;
+    dataBucket.value4 = VAR;
     ageBuckets(millis());
+    sampled(watts);
+}
+
+        // Note a new value for the sampling scheduler (nextSampleChannels).
+        // Exponentially weighted mean and variance of the last ten or so.
+
+void IotaInputChannel::sampled(float value){
+    const float weight = 0.1;
+    float diff = value - _sampleMean;
+    _sampleMean += weight * diff;
+    _sampleVar = (1.0 - weight) * (_sampleVar + weight * diff * diff);
+    _sampleMs = millis();
+    _sampleCount++;
 }
 
 float IotaInputChannel::getPhase(const float var){
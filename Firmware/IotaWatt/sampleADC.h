@@ -0,0 +1,61 @@
+#pragma once
+
+/*********************************************************************************************************
+ *
+ *      ADC access for the sampling loops in samplePower.
+ *
+ *      The loops start a conversion on one MCP3208, do their housekeeping while the SPI hardware clocks
+ *      it out, then collect the result.  ADCstart() and ADCfinish() are that bit-banging of the ESP8266
+ *      SPI and GPIO registers (see esp8266_peri.h).  They are inline, so the loops run as tight as with
+ *      the registers written out in place.  ADCread() is a single conversion through the SPI library,
+ *      used to prime the loops and to read the reference voltage.
+ *
+ *      An ADC is addressed as in IotaInputChannel: high bits the ADC (chip select), low 3 bits the port.
+ *      The host bench replaces this file with a waveform simulator (bench/host/sampleADC.h).
+ *
+ * *******************************************************************************************************/
+
+inline void ADCbegin(){                                           // SD may have changed the SPI settings
+  SPI.beginTransaction(SPISettings(2000000,MSBFIRST,SPI_MODE0));
+}
+
+inline uint32_t ADCselectMask(uint8_t addr){                      // Hardware chip select mask (pins 0-15)
+  return 1 << ADC_selectPin[addr >> 3];
+}
+
+      // Select the ADC and start the SPI sending a 5 bit start + sgl/diff + port address and
+      // clocking in the result.
+
+inline void ADCstart(uint32_t selectMask, uint8_t port){
+  const uint32_t mask = ~((SPIMMOSI << SPILMOSI) | (SPIMMISO << SPILMISO));
+  const uint32_t dataMask = ((ADC_BITS + 6) << SPILMOSI) | ((ADC_BITS + 6) << SPILMISO);
+  GPOC = selectMask;                                              // digitalWrite(select, LOW)
+  SPI1U1 = (SPI1U1 & mask) | dataMask;                            // Set number of bits
+  SPI1W0 = (0x18 | port) << 3;                                    // Data left aligned in low byte
+  SPI1CMD |= SPIBUSY;                                             // Start the SPI clock
+}
+
+      // Wait for the SPI to complete, deselect the ADC and extract the reading from the SPI buffer.
+
+inline int16_t ADCfinish(uint32_t selectMask){
+  volatile uint8_t * fifoPtr8 = (volatile uint8_t *) &SPI1W0;
+  while(SPI1CMD & SPIBUSY) {}                                     // Loop till SPI completes
+  GPOS = selectMask;                                              // digitalWrite(select, HIGH)
+  return (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 3) + (*(fifoPtr8+2) >> 5);
+}
+
+inline void ADCdeselect(uint32_t selectMask){                     // Abandon a conversion
+  GPOS = selectMask;
+}
+
+inline int ADCread(uint8_t addr){
+  uint8_t ADC_out [4] = {0, 0, 0, 0};
+  uint8_t ADC_in  [4] = {0, 0, 0, 0};
+  uint8_t ADCselectPin = ADC_selectPin[addr >> 3];
+  ADCbegin();
+  ADC_out[0] = 0x18 | (addr & 0x07);
+  digitalWrite(ADCselectPin, LOW);                                // Lower the chip select
+  SPI.transferBytes(ADC_out, ADC_in, 3);                          // Do business
+  digitalWrite(ADCselectPin, HIGH);                               // Raise the chip select to deselect and reset
+  return (word(ADC_in[1] & 0x3F, ADC_in[2]) >> (14 - ADC_BITS));  // Put the result together and return
+}
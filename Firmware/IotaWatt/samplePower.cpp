@@ -1,4 +1,7 @@
 #include "IotaWatt.h"
+
+static void powerResult(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, double Vrms, double Vratio,
+                        uint32_t sumIsq, int64_t sumVI, int64_t sumVQ);
   
   /***************************************************************************************************
   *  samplePower()  Sample a channel.
@@ -33,27 +36,33 @@ void samplePower(int channel, int overSample){
   trace(T_POWER,1);
   IotaInputChannel* Ichannel = inputChannel[channel];
   IotaInputChannel* Vchannel = inputChannel[Ichannel->_vchannel]; 
-          
-  byte Ichan = Ichannel->_channel;
+  int16_t* capture = harmonicDue(Ichannel) ? new int16_t[MAX_SAMPLES * 2] : nullptr;
+  if(samplePowerCycle(Vchannel, Ichannel, capture) == 0 && capture){
+    harmonicAnalysis(Vchannel, Ichannel, capture);
+  }
+  delete[] capture;
+  trace(T_POWER,9);                                                                               
+  return;
+}
+
+  /***************************************************************************************************
+  *  samplePowerCycle()  Sample a cycle of a power channel and set its power and the voltage.
+  *  capture is as sampleCycle.  Returns sampleCycle's return code.
+  *  
+  ****************************************************************************************************/
+int samplePowerCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int16_t* capture){
   byte Vchan = Vchannel->_channel;
-  
-  double _Irms = 0;
-  double _watts = 0;
   double _Vrms = 0;
-  double _VA = 0;
-
-  int16_t* VsamplePtr = Vsample;
-  int16_t* IsamplePtr = Isample;
    
         // Invoke high speed sample collection.
         // If it fails, return.
  
-  if(int rtc = sampleCycle(Vchannel, Ichannel)) {
+  if(int rtc = sampleCycle(Vchannel, Ichannel, 1, capture)) {
     trace(T_POWER,2);
     if(rtc == 2){
       Ichannel->setPower(0.0, 0.0);
     }
-    return;
+    return rtc;
   }          
       
         // Voltage calibration is the ratio of line voltage to voltage presented at the input.
@@ -65,65 +74,104 @@ void samplePower(int channel, int overSample){
         // Compute Vrms from raw samples
 
   _Vrms = Vratio * sqrt((double)sumVsq / samples);
+  Vchannel->setVoltage(_Vrms);                          // Voltage is sampled with every power channel
   
+  powerResult(Vchannel, Ichannel, _Vrms, Vratio, sumIsq, sumVI, sumVQ);
+  return 0;
+}
+
+  /***************************************************************************************************
+  *  samplePowers()  Sample up to MAX_CYCLE_CTS power channels that share a voltage channel,
+  *  all in the same cycle (sampleCycles).
+  *  
+  ****************************************************************************************************/
+void samplePowers(int* channels, int count){
+  if(count > MAX_CYCLE_CTS) count = MAX_CYCLE_CTS;
+  IotaInputChannel* Ichannels[MAX_CYCLE_CTS];
+  for(int i=0; i<count; i++){
+    Ichannels[i] = inputChannel[channels[i]];
+  }
+  IotaInputChannel* Vchannel = inputChannel[Ichannels[0]->_vchannel];
+  sampleCT CTs[MAX_CYCLE_CTS];
+
+        // Capture the channel that has been due for harmonic analysis longest.  Any others
+        // stay due, so channels sampled together take turns.
+
+  int16_t* capture = nullptr;
+  int captureCT = -1;
+  for(int i=0; i<count; i++){
+    if(harmonicDue(Ichannels[i]) && 
+       (captureCT < 0 || Ichannels[i]->_harmonicCount > Ichannels[captureCT]->_harmonicCount)){
+      captureCT = i;
+    }
+  }
+  if(captureCT >= 0){
+    capture = new int16_t[MAX_SAMPLES * 2];
+  }
+  else {
+    captureCT = 0;
+  }
+
+  trace(T_POWER,6,count);
+  if(int rtc = sampleCycles(Vchannel, Ichannels, count, CTs, 1, capture, captureCT)) {
+    trace(T_POWER,2);
+    if(rtc == 2){
+      for(int i=0; i<count; i++){
+        Ichannels[i]->setPower(0.0, 0.0);
+      }
+    }
+    delete[] capture;
+    return;
+  }
+
+  double Vratio = Vchannel->_calibration * Vadj_3 * getAref(Vchannel->_channel) / double(ADC_RANGE);
+  double Vrms = Vratio * sqrt((double)sumVsq / samples);
+  Vchannel->setVoltage(Vrms);
+  for(int i=0; i<count; i++){
+    powerResult(Vchannel, Ichannels[i], Vrms, Vratio, CTs[i].sumIsq, CTs[i].VI.sum, CTs[i].VQ.sum);
+  }
+  if(capture){
+    harmonicAnalysis(Vchannel, Ichannels[captureCT], capture);
+    delete[] capture;
+  }
+  trace(T_POWER,9);
+}
+
+  /***************************************************************************************************
+  *  powerResult()  Compute and set the power of a channel from the sums of its cycle.
+  *  
+  ****************************************************************************************************/
+static void powerResult(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, double Vrms, double Vratio,
+                        uint32_t sumIsq, int64_t sumVI, int64_t sumVQ){
+
         // Iratio is straight Amps/ADC volt.
   
-  double Iratio = Ichannel->_calibration * getAref(Ichan) / double(ADC_RANGE);
+  double Iratio = Ichannel->_calibration * getAref(Ichannel->_channel) / double(ADC_RANGE);
 
         // Compute Irms from raw samples
 
-  _Irms = Iratio * sqrt((double)sumIsq / samples);
-  
-      // Determine phase correction components.
-      // stepCorrection is the number of V samples to add or subtract.
-      // stepFraction is the interpolation to apply to the next V sample (0.0 - 1.0)
-      // The phase correction is the net phase lead (+) of current computed as the 
-      // (CT lead - VT lead) - any gross phase correction for 3 phase measurement.
-      // Note that a reversed CT can be corrected by introducing a 180deg gross correction.
-
-  float _phaseCorrection =  (Ichannel->getPhase(_Irms) - Vchannel->getPhase(_Vrms) - Ichannel->_vphase) * samples / 360.0;  // fractional Isamples correction
-  int stepCorrection = int(_phaseCorrection);                                        // whole steps to correct 
-  float stepFraction = _phaseCorrection - stepCorrection;                            // fractional step correction
-  if(stepFraction < 0){                                                              // if current lead
-    stepCorrection--;                                                                // One sample back
-    stepFraction += 1.0;                                                             // and forward 1-fraction
-  }
-  Ichannel->_lastPhase = Ichannel->getPhase(_Irms) - Vchannel->getPhase(_Vrms);
+  double _Irms = Iratio * sqrt((double)sumIsq / samples);
+
+        // sampleCycle has accumulated sumVI with voltage phase corrected by the
+        // last phase estimate.  Update the estimate for the next cycle.
+        // The phase correction is the net phase lead (+) of current computed as the 
+        // (CT lead - VT lead).  Any gross phase correction for 3 phase measurement
+        // (or a reversed CT) is applied by sampleCycle.
+
+  Ichannel->_lastPhase = Ichannel->getPhase(_Irms) - Vchannel->getPhase(Vrms);
 
   trace(T_POWER,3);
 
-        // Recompute sums and squares with phase corrected samples.
+        // Compute Power, VA and VAR.  VAR is signed, positive when the current lags.
 
-  int16_t rawV;
-  int16_t rawI;  
-  double _sumVI = 0;
-  double _sumVsq = 0;
-  double _sumIsq = 0;
-            
-  Isample[samples] = Isample[0];
-  Vsample[samples] = Vsample[0];      
-  int Vindex = (samples + stepCorrection) % samples;
-  for(int i=0; i<samples; i++){  
-    rawI = *IsamplePtr;
-    rawV = Vsample[Vindex]; 
-    rawV += int(stepFraction * (Vsample[Vindex + 1] - Vsample[Vindex]));
-    _sumVsq += rawV * rawV;
-    _sumIsq += rawI * rawI;
-    _sumVI += rawV * rawI;      
-    IsamplePtr++;
-    Vindex = ++Vindex % samples;
-  }
-
-        // Compute Vrms, Irms, Power, etc.
-
-  _Vrms = Vratio * sqrt((double)_sumVsq / samples);
-  _Irms = Iratio * sqrt((double)_sumIsq / samples);
-  _watts = Vratio * Iratio * ((double)_sumVI / samples);
-  _VA = _Vrms * _Irms;
+  double _watts = Vratio * Iratio * ((double)sumVI / samples);
+  double _VA = Vrms * _Irms;
+  double _VAR = Vratio * Iratio * ((double)sumVQ / samples);
 
   if(Ichannel->_double){
     _watts *= 2.0;
     _VA *= 2.0;
+    _VAR *= 2.0;
   }
   
         // If watts is negative and the channel is not explicitely signed, reverse it (backward CT).
@@ -133,6 +181,7 @@ void samplePower(int channel, int overSample){
   if( ! Ichannel->_signed){
     if(_watts < 0){
       _watts = -_watts;
+      _VAR = -_VAR;
       if(_watts > 5){
         Ichannel->_reversed = true;
       }
@@ -141,21 +190,178 @@ void samplePower(int channel, int overSample){
       // Update with the new power and voltage values.
 
   trace(T_POWER,5);
-  Ichannel->setPower(_watts, _VA);
-  trace(T_POWER,9);                                                                               
-  return;
+  Ichannel->setPower(_watts, _VA, _VAR);
+}
+
+      // Phase correction delay lines and head of cycle for sampleCycles, grown as needed.
+
+static int16_t* delayLine = nullptr;
+static int      delayLineSize = 0;
+static int16_t  lastCycleSamples[MAX_CYCLE_CTS + 1];   // Samples per cycle last time, by CTs per cycle
+
+      // Fractional delay filter coefficients, see buildPhaseFIR.
+
+int16_t*        phaseFIR = nullptr;
+
+      // Sample n of the cycle (-samples <= n < 2 * samples) from the head or the delay line.
+
+static inline int16_t cycleSample(int16_t* head, int16_t* delay, uint16_t delayMask, int16_t headSize, int16_t n){
+  if(n < 0) n += samples;
+  if(n >= samples) n -= samples;
+  return n < headSize ? head[n] : delay[n & delayMask];
+}
+
+      // Set up a pairing of current samples with voltage steps samples away.
+      // I[n] is paired with V[n + shift + fraction], filtered from V[n + shift - 1] through
+      // V[n + shift + 2].  Then the delays of the current (delayI) and voltage (delayV) samples
+      // that make a pair from the samples in hand, and the head of the cycle needed at the end.
+
+static void setupPairing(samplePairing& P, float steps){
+  P.sum = 0;
+  P.shift = floor(steps);
+  int16_t fraction = (steps - P.shift) * PHASE_FIR_STEPS;
+  if(fraction >= PHASE_FIR_STEPS) fraction = PHASE_FIR_STEPS - 1;
+  for(int tap=0; tap<PHASE_FIR_TAPS; tap++){
+    P.coef[tap] = phaseFIR[fraction * PHASE_FIR_TAPS + tap];
+  }
+  P.delayI = P.shift >= -2 ? P.shift + 2 : 0;
+  P.delayV = P.delayI - P.shift;
+  P.delayMax = max(P.delayI, (int16_t)(P.delayV + 1));
+  P.firstPair = max(0, 1 - P.shift) + P.delayI;
+  P.headSize = abs(P.shift) + 3;
+}
+
+      // Set up a current channel for sampleCycles.
+      // Phase correction in samples: the correction at the last cycle's sample rate plus
+      // position, where the current is read in the pass, in samples after the voltage sample
+      // it pairs with.  VI pairs the current with the corrected voltage.  VQ pairs it with
+      // the corrected voltage a quarter cycle earlier, or later and negated, whichever is 
+      // nearer, to keep the delay line and head short.  Either is the voltage shifted 90 degrees.
+
+static void setupCT(sampleCT& CT, IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int count, float position){
+  CT.channel = Ichannel;
+  CT.sumI = 0;
+  CT.sumIsq = 0;
+  CT.rawI = 0;
+  CT.offset = Ichannel->_offset;
+  CT.selectMask = ADCselectMask(Ichannel->_addr);
+  CT.port = Ichannel->_addr % 8;
+
+  float steps = position;
+  float perCycle = lastCycleSamples[count] ? lastCycleSamples[count] : samplesPerCycle * 2 / (count + 1);
+  CT.correction = 0;
+  if(Ichannel != Vchannel){
+    CT.correction = Ichannel->_lastPhase - Ichannel->_vphase;
+    CT.correction -= 360.0 * floor((CT.correction + 180.0) / 360.0);    // -180 to +180 degrees
+    steps += CT.correction * perCycle / 360.0;
+  }
+  CT.steps = steps;
+  if( ! phaseFIR) buildPhaseFIR();
+  setupPairing(CT.VI, steps);
+  CT.signVQ = steps >= 0 ? 1 : -1;
+  setupPairing(CT.VQ, steps - CT.signVQ * perCycle / 4.0);
+  CT.delayMax = max(CT.VI.delayMax, CT.VQ.delayMax);
+  CT.headSize = max(CT.VI.headSize, CT.VQ.headSize);
+}
+
+      // Accumulate the latest pair of a pairing, sample being the current sample just saved.
+
+static inline void pairSample(samplePairing& P, int16_t* Vdelay, int16_t* Idelay, uint16_t delayMask, int16_t sample){
+  int16_t Vndx = sample - 1 - P.delayV;
+  int32_t V = P.coef[0] * Vdelay[Vndx & delayMask] + P.coef[1] * Vdelay[(Vndx + 1) & delayMask] +
+              P.coef[2] * Vdelay[(Vndx + 2) & delayMask] + P.coef[3] * Vdelay[(Vndx + 3) & delayMask];
+  P.sum += ((V + 16384) >> 15) * Idelay[(sample - P.delayI) & delayMask];
+}
+
+      // Finish the pairs of a pairing that wrap around the ends of the cycle.
+
+static void finishPairing(samplePairing& P, sampleCT& CT, int16_t* Vhead, int16_t* Vdelay, uint16_t delayMask, int16_t VheadSize){
+  int16_t wrapEnd = samples + P.firstPair - P.delayI;
+  for(int i=samples-P.delayI; i<wrapEnd; i++){
+    int16_t Indx = i >= samples ? i - samples : i;
+    int16_t Vndx = Indx + P.shift - 1;
+    int32_t V = 0;
+    for(int tap=0; tap<PHASE_FIR_TAPS; tap++){
+      V += P.coef[tap] * cycleSample(Vhead, Vdelay, delayMask, VheadSize, Vndx + tap);
+    }
+    P.sum += ((V + 16384) >> 15) * cycleSample(CT.Ihead, CT.Idelay, delayMask, CT.headSize, Indx);
+  }
+}
+
+      // Note a rejected cycle against its current channels and return rtc.
+
+static int rejectCycle(IotaInputChannel** Ichannels, int count, sampleRejects reason, int rtc){
+  for(int i=0; i<count; i++){
+    Ichannels[i]->_quality.rejects[reason]++;
+  }
+  return rtc;
+}
+
+      // Adjust an offset by the mean of a cycle, assuming symmetric waves but within limits otherwise.
+
+static int16_t adjustOffset(int16_t offset, int32_t sum){
+  const uint16_t minOffset = ADC_RANGE / 2 - ADC_RANGE / 200;    // Allow +/- .5% variation
+  const uint16_t maxOffset = ADC_RANGE / 2 + ADC_RANGE / 200;
+  if(sum >= 0) sum += samples / 2; 
+  else sum -= samples / 2;
+  offset += sum / samples;
+  if(offset < minOffset) offset = minOffset;
+  if(offset > maxOffset) offset = maxOffset;
+  return offset;
+}
+
+  /**********************************************************************************************
+  * 
+  *  sampleCycle(Vchan, Ichan, cycles, capture)
+  *  
+  *  Sample one current channel, leaving the results in samples, sumVsq, sumIsq, sumVI and sumVQ.
+  *  sampleCycles does the work.
+  *
+  ****************************************************************************************************/
+  
+int sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles, int16_t* capture){
+  sampleCT CT;
+  int rtc = sampleCycles(Vchannel, &Ichannel, 1, &CT, cycles, capture);
+  sumIsq = CT.sumIsq;
+  sumVI = CT.VI.sum;
+  sumVQ = CT.VQ.sum;
+  return rtc;
 }
 
   /**********************************************************************************************
   * 
-  *  sampleCycle(Vchan, Ichan)
+  *  sampleCycles(Vchan, Ichans, count, CTs, cycles, capture, captureCT)
   *  
   *  This code accounts for up to 66% (60Hz) of the execution of IotaWatt.
-  *  It collects voltage and current sample pairs and saves them away for 
+  *  It collects voltage and current samples and accumulates the sums
+  *  that samplePower needs as it goes, so there is no post processing of the samples.
   *    
-  *  The approach is to start sampling voltage/current pairs in a tight loop.
-  *  When voltage crosses zero, we start recording the pairs.
+  *  The approach is to start sampling voltage/current in a tight loop.
+  *  When voltage crosses zero, we start accumulating the samples.
   *  When we  cross zero 2 more times we stop and return to compute the results.
+  *
+  *  Each pass of the loop reads count (up to MAX_CYCLE_CTS) current channels that share the
+  *  voltage channel, then the voltage.  With one, that's the classic V/I pair.  With more, 
+  *  every one of them gets a result from the same cycle at 2 / (count + 1) of the sample 
+  *  rate, which is plenty, and a whole cycle is saved for each extra channel.  The results
+  *  are in CTs, with samples and sumVsq for the voltage.
+  *
+  *  Power needs voltage phase corrected to line up with the current.  The correction
+  *  (Ichannel->_lastPhase, estimated by samplePower from the previous cycle's Vrms and Irms,
+  *  less the gross 3 phase correction, plus the current's position in the pass) is converted 
+  *  to a whole number of samples and a fraction at the last cycle's sample rate.  Each current
+  *  sample is paired with the voltage that many samples away, interpolated by a 4 tap fractional
+  *  delay filter (buildPhaseFIR), using a small circular delay line of recent samples.  Pairs 
+  *  that would reach past either end of the cycle wrap around to the other end, just as if the
+  *  whole cycle had been saved, using a copy of the first few samples and what is left in the 
+  *  delay line at the end.
+  *
+  *  Reactive power is summed the same way, pairing each current sample with the corrected
+  *  voltage a quarter cycle away (see setupCT).  That takes a delay line and head of about a 
+  *  quarter cycle, rather than a few samples, and another four multiplies per current sample.
+  *
+  *  For diagnostics, capture can point to room for MAX_SAMPLES V,I pairs to save the raw samples
+  *  of the voltage and current CTs[captureCT].
   *  
   *  Note:  If ever there was a time for low-level hardware manipulation, this is it.
   *  the tighter and faster the samples can be taken, the more accurate the results can be.
@@ -167,7 +373,7 @@ void samplePower(int channel, int overSample){
   *  registers, it's possinble to get about 640 sample pairs per cycle (60Hz) running
   *  the SPI at 2MHz, which is the spec for the MCP3208.
   *  
-  *  I've tried to segregate the bit-banging and document it well.
+  *  I've tried to segregate the bit-banging (sampleADC.h) and document it well.
   *  For anyone interested in the low level registers, you can find 
   *  them defined in esp8266_peri.h.
   *
@@ -175,31 +381,23 @@ void samplePower(int channel, int overSample){
   *   0 - success
   *   1 - low quality sample (low sample rate, probably interrupted)
   *   2 - failure (probably no voltage reference or voltage unplugged during sampling)
+  *  Each current channel's _quality counts the attempt and the result, by reason if rejected.
   *   
   ****************************************************************************************************/
   
-  int sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles){
+  int sampleCycles(IotaInputChannel* Vchannel, IotaInputChannel** Ichannels, int count, sampleCT* CTs,
+                   int cycles, int16_t* capture, int captureCT){
 
   int Vchan = Vchannel->_channel;
-  int Ichan = Ichannel->_channel;
-
-  uint32_t dataMask = ((ADC_BITS + 6) << SPILMOSI) | ((ADC_BITS + 6) << SPILMISO);
-  const uint32_t mask = ~((SPIMMOSI << SPILMOSI) | (SPIMMISO << SPILMISO));
-  volatile uint8_t * fifoPtr8 = (volatile uint8_t *) &SPI1W0;
-  
-  uint8_t  Iport = inputChannel[Ichan]->_addr % 8;       // Port on ADC
-  uint8_t  Vport = inputChannel[Vchan]->_addr % 8;
-    
+  uint8_t  Vport = Vchannel->_addr % 8;       // Port on ADC
   int16_t offsetV = Vchannel->_offset;        // Bias offset
-  int16_t offsetI = Ichannel->_offset;
   
   int16_t rawV;                               // Raw ADC readings
   int16_t lastV = 0;
   int16_t avgV;
-  int16_t rawI = 0;
-        
-  int16_t * VsamplePtr = Vsample;             // -> to sample storage arrays
-  int16_t * IsamplePtr = Isample;
+
+  int32_t sumV = 0;                           // Sums for offset and rms
+  uint32_t _sumVsq = 0;
     
   int16_t crossLimit = cycles * 2 + 1;        // number of crossings in total
   int16_t crossCount = 0;                     // number of crossings encountered
@@ -213,15 +411,43 @@ void samplePower(int channel, int overSample){
   int16_t midCrossSamples;                    // Sample count at mid cycle and end of cycle
   int16_t lastCrossSamples;                   // Used to determine if sampling was interrupted
 
-  byte ADC_IselectPin = ADC_selectPin[inputChannel[Ichan]->_addr >> 3];  // Chip select pin
-  byte ADC_VselectPin = ADC_selectPin[inputChannel[Vchan]->_addr >> 3];
-  uint32_t ADC_IselectMask = 1 << ADC_IselectPin;             // Mask for hardware chip select (pins 0-15)
-  uint32_t ADC_VselectMask = 1 << ADC_VselectPin;
+  uint32_t ADC_VselectMask = ADCselectMask(Vchannel->_addr);   // Mask for hardware chip select
 
-  bool Vreverse = inputChannel[Vchan]->_reverse;
-  bool Ireverse = inputChannel[Ichan]->_reverse;
+  bool Vreverse = Vchannel->_reverse;
+
+        // Set up the current channels and carve their delay lines out of the shared buffer.
+
+  int16_t delayMax = 0;
+  int16_t VheadSize = 0;
+  for(int i=0; i<count; i++){
+    setupCT(CTs[i], Vchannel, Ichannels[i], count, (i - (count - 1) / 2.0) / (count + 1));
+    delayMax = max(delayMax, CTs[i].delayMax);
+    VheadSize = max(VheadSize, CTs[i].headSize);
+  }
+  uint16_t delayMask = 1;
+  while(delayMask < delayMax) delayMask = (delayMask << 1) | 1;
+  int size = delayMask + 1 + VheadSize;
+  for(int i=0; i<count; i++){
+    size += delayMask + 1 + CTs[i].headSize;
+  }
+  if(delayLineSize < size){
+    delete[] delayLine;
+    delayLineSize = size;
+    delayLine = new int16_t[delayLineSize];
+  }
+  int16_t* Vdelay = delayLine;
+  int16_t* Vhead = Vdelay + delayMask + 1;
+  int16_t* next = Vhead + VheadSize;
+  for(int i=0; i<count; i++){
+    CTs[i].Idelay = next;
+    CTs[i].Ihead = next + delayMask + 1;
+    next = CTs[i].Ihead + CTs[i].headSize;
+  }
   
-  SPI.beginTransaction(SPISettings(2000000,MSBFIRST,SPI_MODE0));
+  for(int i=0; i<count; i++){
+    Ichannels[i]->_quality.attempts++;
+  }
+  ADCbegin();
  
   rawV = readADC(Vchan) - offsetV;                    // Prime the pump
   samples = 0;                                        // Start with nothing
@@ -232,55 +458,70 @@ void samplePower(int channel, int overSample){
   WDT_FEED();
   do{  
                       /************************************
-                       * Sample the Current (I) channel   *
+                       * Sample the Current (I) channels  *
                        ************************************/
-                                               
-        GPOC = ADC_IselectMask;                            // digitalWrite(ADC_IselectPin, LOW); Select the ADC
 
-              // hardware send 5 bit start + sgl/diff + port_addr
-                                            
-        SPI1U1 = (SPI1U1 & mask) | dataMask;               // Set number of bits 
-        SPI1W0 = (0x18 | Iport) << 3;                      // Data left aligned in low byte 
-        SPI1CMD |= SPIBUSY;                                // Start the SPI clock  
+    for(int i=0; i<count; i++){
+      sampleCT& CT = CTs[i];
+                                               
+        ADCstart(CT.selectMask, CT.port);                 // Select the ADC and start the conversion
 
               // Do some loop housekeeping asynchronously while SPI runs.
 
-          *IsamplePtr = rawI;
-          *VsamplePtr = avgV = (rawV + lastV)  >> 1;
-          lastV = rawV;
-          if(crossCount) {                                // If past first crossing 
-            VsamplePtr++;                                 // Accumulate samples
-            IsamplePtr++;                                 
-            samples++;                                    // Count samples
-            if(samples >= MAX_SAMPLES){                   // If over the legal limit
-              trace(T_SAMP,0);                            // shut down and return
-              GPOS = ADC_IselectMask;                     // (Chip select high) 
-              Serial.println(F("Max samples exceeded."));
-              return 2;
+          if(i == 0){
+            avgV = (rawV + lastV)  >> 1;
+            lastV = rawV;
+            if(crossCount) {                              // If past first crossing 
+              Vdelay[samples & delayMask] = avgV;         // Into the delay line
+              if(samples < VheadSize){                    // Save the head for wrap around
+                Vhead[samples] = avgV;
+              }
+              if(capture){
+                capture[samples * 2] = avgV;
+                capture[samples * 2 + 1] = CTs[captureCT].rawI;
+              }
+              sumV += avgV;                               // Accumulate samples
+              _sumVsq += avgV * avgV;
+              samples++;                                  // Count samples
+              if(samples >= MAX_SAMPLES){                 // If over the legal limit
+                trace(T_SAMP,0);                          // shut down and return
+                ADCdeselect(CT.selectMask);               // (Chip select high) 
+                Serial.println(F("Max samples exceeded."));
+                return rejectCycle(Ichannels, count, sampleMaxSamples, 2);
+              }
+            }
+            crossGuard--;    
+          }
+
+              // Accumulate this current's sample and its latest phase corrected pairs.
+
+          if(crossCount){
+            int16_t sample = samples - 1;
+            CT.Idelay[sample & delayMask] = CT.rawI;
+            if(sample < CT.headSize){
+              CT.Ihead[sample] = CT.rawI;
+            }
+            CT.sumI += CT.rawI;
+            CT.sumIsq += CT.rawI * CT.rawI;
+            if(samples > CT.VI.firstPair){
+              pairSample(CT.VI, Vdelay, CT.Idelay, delayMask, sample);
+            }
+            if(samples > CT.VQ.firstPair){
+              pairSample(CT.VQ, Vdelay, CT.Idelay, delayMask, sample);
             }
           }
-          crossGuard--;    
           
-              // Now wait for SPI to complete
+              // Now wait for the conversion and adjust with offset.
         
-        while(SPI1CMD & SPIBUSY) {}                                         // Loop till SPI completes
-        GPOS = ADC_IselectMask;                                             // digitalWrite(ADC_IselectPin, HIGH); Deselect the ADC 
-
-              // extract the rawV from the SPI hardware buffer and adjust with offset. 
-                                                                    
-        rawI = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 3) + (*(fifoPtr8+2) >> 5) - offsetI;
+        CT.rawI = ADCfinish(CT.selectMask) - CT.offset;
+        if(CT.rawI >= -1 && CT.rawI <= 1) CT.rawI = 0;
+    }
 
                       /************************************
                        *  Sample the Voltage (V) channel  *
                        ************************************/
          
-        GPOC = ADC_VselectMask;                             // digitalWrite(ADC_VselectPin, LOW); Select the ADC
-  
-              // hardware send 5 bit start + sgl/diff + port_addr0
-        
-        SPI1U1 = (SPI1U1 & mask) | dataMask;
-        SPI1W0 = (0x18 | Vport) << 3;
-        SPI1CMD |= SPIBUSY;
+        ADCstart(ADC_VselectMask, Vport);                   // Select the ADC and start the conversion
         
               // Do some housekeeping asynchronously while SPI runs.
               
@@ -292,21 +533,15 @@ void samplePower(int channel, int overSample){
               // So handling needs to be robust.
         
           if((uint32_t)(millis()-startMs)>timeoutMs){                   // Something is wrong
-            trace(T_SAMP,2,Ichan);                                      // Leave a meaningful trace
+            trace(T_SAMP,2,Ichannels[0]->_channel);                     // Leave a meaningful trace
             trace(T_SAMP,2,Vchan);
-            GPOS = ADC_VselectMask;                                     // ADC select pin high 
-            return 2;                                                   // Return a failure
+            ADCdeselect(ADC_VselectMask);                               // ADC select pin high 
+            return rejectCycle(Ichannels, count, sampleTimeout, 2);     // Return a failure
           }
-          if(rawI >= -1 && rawI <= 1) rawI = 0;
                               
-              // Now wait for SPI to complete
-        
-        while(SPI1CMD & SPIBUSY) {}                                 
-        GPOS = ADC_VselectMask;                           // digitalWrite(ADC_VselectPin, HIGH);  Deselect the ADC                       
-
-              // extract the rawI from the SPI hardware buffer and adjust with offset.
+              // Now wait for the conversion and adjust with offset.
  
-        rawV = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 3) + (*(fifoPtr8+2) >> 5) - offsetV;
+        rawV = ADCfinish(ADC_VselectMask) - offsetV;
                
         // Finish up loop cycle by checking for zero crossing.
         // Crossing is defined by voltage changing signs  (Xor) and crossGuard negative.
@@ -322,9 +557,7 @@ void samplePower(int channel, int overSample){
           else if(crossCount == crossLimit) {
             trace(T_SAMP,6);
             lastCrossUs = micros();                       // To compute frequency
-            lastCrossMs = millis();
-            *VsamplePtr = (lastV + rawV) >> 1;                                       
-            *IsamplePtr = rawI;                           // For main loop dispatcher to estimate when next crossing is imminent
+            lastCrossMs = millis();                       // For main loop dispatcher to estimate when next crossing is imminent
             lastCrossSamples = samples;
             crossGuard = 0;                               // No more crosses for awhile
           }
@@ -337,66 +570,48 @@ void samplePower(int channel, int overSample){
 
   trace(T_SAMP,8);
 
-          // Process raw samples.
-          // Add them to check the offset.
+          // Finish the pairs that wrap around the ends of the cycle.
           // Reverse if required.
 
-  VsamplePtr = Vsample;
-  IsamplePtr = Isample;
-  int32_t sumI = 0;
-  int32_t sumV = 0;
-  sumVsq = 0;
-  sumIsq = 0;
-  sumVI = 0;
-  for(int i=0; i<samples; i++){
-    if(*IsamplePtr == -1 || *IsamplePtr == 1){
-      *IsamplePtr == 0;
+  for(int i=0; i<count; i++){
+    if(samples <= CTs[i].headSize || samples <= CTs[i].VI.firstPair || samples <= CTs[i].VQ.firstPair){
+      return rejectCycle(Ichannels, count, sampleLowCount, 1);
+    }
+    finishPairing(CTs[i].VI, CTs[i], Vhead, Vdelay, delayMask, VheadSize);
+    finishPairing(CTs[i].VQ, CTs[i], Vhead, Vdelay, delayMask, VheadSize);
+    CTs[i].VQ.sum *= CTs[i].signVQ;
+    if(Vreverse != Ichannels[i]->_reverse){
+      CTs[i].VI.sum = -CTs[i].VI.sum;
+      CTs[i].VQ.sum = -CTs[i].VQ.sum;
     }
-    sumV += *VsamplePtr;
-    sumI += *IsamplePtr;
-    if(Vreverse) *VsamplePtr = - *VsamplePtr;
-    if(Ireverse) *IsamplePtr = - *IsamplePtr;
-    sumVsq += *VsamplePtr * *VsamplePtr;
-    sumIsq += *IsamplePtr * *IsamplePtr;
-    sumVI  += *IsamplePtr * *VsamplePtr;VsamplePtr++;
-    IsamplePtr++;
   }
+  sumVsq = _sumVsq;
 
-        // Adjust the offset values assuming symmetric waves but within limits otherwise.
- 
-  const uint16_t minOffset = ADC_RANGE / 2 - ADC_RANGE / 200;    // Allow +/- .5% variation
-  const uint16_t maxOffset = ADC_RANGE / 2 + ADC_RANGE / 200;
+        // Adjust the offset values.
 
   trace(T_SAMP,9);
 
-  if(sumV >= 0) sumV += samples / 2; 
-  else sumV -= samples / 2;
-  offsetV = Vchannel->_offset + sumV / samples;
-  if(offsetV < minOffset) offsetV = minOffset;
-  if(offsetV > maxOffset) offsetV = maxOffset;
-  Vchannel->_offset = offsetV;
-  
-  if(sumI >= 0) sumI += samples / 2;
-  else sumI -= samples / 2;
-  offsetI = Ichannel->_offset + sumI / samples;
-  if(offsetI < minOffset) offsetI = minOffset;
-  if(offsetI > maxOffset) offsetI = maxOffset;
-  Ichannel->_offset = offsetI; 
+  Vchannel->_offset = adjustOffset(Vchannel->_offset, sumV);
+  for(int i=0; i<count; i++){
+    Ichannels[i]->_offset = adjustOffset(Ichannels[i]->_offset, CTs[i].sumI);
+  }
   
-  if(samples < ((lastCrossUs - firstCrossUs) * 380 / 10000)){
+  if(samples < ((lastCrossUs - firstCrossUs) * 760 / (10000 * (count + 1)))){
     Serial.print(F("Low sample count "));
     Serial.println(samples);
-    return 1;
+    return rejectCycle(Ichannels, count, sampleLowCount, 1);
   }
   if(abs(samples - (midCrossSamples * 2)) > 10){
     // DateTime now = DateTime(localTime());
     // Serial.printf_P(PSTR("%d/%02d/%02d %02d:%02d:%02d sample imbalance: %d - %d = %d, vchan %d, ichan %d\r\n"), now.month(), now.day(), now.year()%100,
     // now.hour(), now.minute(), now.second(), midCrossSamples, samples-midCrossSamples, abs(samples - (midCrossSamples * 2)), Vchan, Ichan);
-    return 1;
+    return rejectCycle(Ichannels, count, sampleImbalance, 1);
   }
             // Update damped frequency.
 
-  float Hz = 1000000.0  / float((uint32_t)(lastCrossUs - firstCrossUs));
+  lastCycleStartUs = firstCrossUs;
+  lastCycleUs = lastCrossUs - firstCrossUs;
+  float Hz = 1000000.0  / float(lastCycleUs);
   Vchannel->setHz(Hz);
   frequency = (0.9 * frequency) + (0.1 * Hz);
 
@@ -405,8 +620,14 @@ void samplePower(int channel, int overSample){
           // It can be a little off per cycle, but by damping the 
           // saved value we can get a pretty accurate average.
 
-  samplesPerCycle = samplesPerCycle * .9 + (samples / cycles) * .1;
+  lastCycleSamples[count] = samples / cycles;
+  if(count == 1){
+    samplesPerCycle = samplesPerCycle * .9 + lastCycleSamples[count] * .1;
+  }
   cycleSamples++;
+  for(int i=0; i<count; i++){
+    Ichannels[i]->_quality.success(samples / cycles);
+  }
   
   return 0;
 }
@@ -418,18 +639,104 @@ void samplePower(int channel, int overSample){
 //**********************************************************************************************
 
 int readADC(uint8_t channel){ 
-  uint32_t align = 0;               // SPI requires out and in to be word aligned                                                                 
-  uint8_t ADC_out [4] = {0, 0, 0, 0};
-  uint8_t ADC_in  [4] = {0, 0, 0, 0};  
-  uint8_t ADCselectPin;
-  
-  SPI.beginTransaction(SPISettings(2000000,MSBFIRST,SPI_MODE0));  // SD may have changed this
-  ADCselectPin = ADC_selectPin[inputChannel[channel]->_addr >> 3];    
-  ADC_out[0] = 0x18 | (inputChannel[channel]->_addr & 0x07);
-  digitalWrite(ADCselectPin, LOW);                  // Lower the chip select
-  SPI.transferBytes(ADC_out, ADC_in, 3);            // Do business
-  digitalWrite(ADCselectPin, HIGH);                 // Raise the chip select to deselect and reset
-  return (word(ADC_in[1] & 0x3F, ADC_in[2]) >> (14 - ADC_BITS)); // Put the result together and return
+  return ADCread(inputChannel[channel]->_addr);
+}
+
+/****************************************************************************************************
+ * buildPhaseFIR() builds the coefficients of the fractional delay filter that sampleCycle uses to
+ * phase correct voltage: a 4 tap Lagrange (cubic) interpolator of V[n-1] through V[n+2] for each of
+ * PHASE_FIR_STEPS fractions of a sample past V[n], taken at the middle of its step.  They are Q15,
+ * trimmed to sum to exactly one.  Linear interpolation loses amplitude and phase at the higher
+ * harmonics; this is flat to well past the 15th at 50 or 60Hz.
+ ****************************************************************************************************/
+void buildPhaseFIR(){
+  if(phaseFIR) return;
+  phaseFIR = new int16_t[PHASE_FIR_STEPS * PHASE_FIR_TAPS];
+  for(int step=0; step<PHASE_FIR_STEPS; step++){
+    double f = (step + 0.5) / PHASE_FIR_STEPS;
+    double h[PHASE_FIR_TAPS] = {-f * (f - 1.0) * (f - 2.0) / 6.0,
+                                (f + 1.0) * (f - 1.0) * (f - 2.0) / 2.0,
+                                -(f + 1.0) * f * (f - 2.0) / 2.0,
+                                (f + 1.0) * f * (f - 1.0) / 6.0};
+    int16_t* coef = phaseFIR + step * PHASE_FIR_TAPS;
+    int32_t sum = 0;
+    for(int tap=0; tap<PHASE_FIR_TAPS; tap++){
+      coef[tap] = lround(h[tap] * 32768.0);
+      sum += coef[tap];
+    }
+    coef[f < 0.5 ? 1 : 2] += 32768 - sum;
+  }
+}
+
+/****************************************************************************************************
+ * Harmonic analysis.  Every harmonicCycles (config "harmonics") samples of a power channel, the cycle
+ * is captured and analysed for the voltage and the current: the magnitude of each harmonic up to 
+ * HARMONIC_ORDERS, by Goertzel's algorithm, gives the THD (percent of fundamental) and the odd 
+ * harmonics kept in _harmonic.  THD is dataBucket.value3, accumulated as THD hours in accum3 and 
+ * logged there if the log has room for it (setLogFormat).  The cycle is crossing to crossing,
+ * so harmonic k is exactly bin k of the n samples.
+ * 
+ * harmonicDue() counts a sample of the channel and returns true if it is due for analysis.  It stays
+ * due until harmonicAnalysis() is done.  The caller allocates room for MAX_SAMPLES V,I pairs to 
+ * capture the cycle, just for that cycle, and frees it after.
+ ****************************************************************************************************/
+bool harmonicDue(IotaInputChannel* channel){
+  if(harmonicCycles == 0){
+    return false;
+  }
+  if(channel->_harmonicCount < UINT16_MAX){
+    channel->_harmonicCount++;
+  }
+  return channel->_harmonicCount >= harmonicCycles;
+}
+
+void harmonicAnalysis(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, const int16_t* capture){
+  analyseHarmonics(Vchannel, capture, 2);
+  analyseHarmonics(Ichannel, capture + 1, 2);
+  Ichannel->_harmonicCount = 0;
+}
+
+void analyseHarmonics(IotaInputChannel* channel, const int16_t* x, int stride){
+  double magnitude[HARMONIC_ORDERS + 1];
+  goertzel(x, stride, samples, HARMONIC_ORDERS, magnitude);
+  double sumSq = 0;
+  for(int k=2; k<=HARMONIC_ORDERS; k++){
+    sumSq += magnitude[k] * magnitude[k];
+  }
+  channel->ageBuckets(millis());
+  if(magnitude[1] * 2 < samples * 4){                 // Fundamental under 4 counts, no meaningful THD
+    channel->dataBucket.value3 = 0;
+    for(int i=0; i<HARMONICS_SELECTED; i++){
+      channel->_harmonic[i] = 0;
+    }
+    return;
+  }
+  channel->dataBucket.value3 = 100.0 * sqrt(sumSq) / magnitude[1];
+  for(int i=0; i<HARMONICS_SELECTED && i * 2 + 3 <= HARMONIC_ORDERS; i++){
+    channel->_harmonic[i] = 100.0 * magnitude[i * 2 + 3] / magnitude[1];
+  }
+}
+
+      // Goertzel's algorithm for harmonics 1 through orders of n samples (every stride'th of x).
+      // The resonator is fixed point with Q29 coefficients - Q14 would put the fundamental
+      // a sixth of a bin off at 640 samples.  magnitude[k] is |X(k)|.
+
+void goertzel(const int16_t* x, int stride, int n, int orders, double* magnitude){
+  magnitude[0] = 0;
+  for(int k=1; k<=orders; k++){
+    int32_t coef = lround(2.0 * cos(2.0 * M_PI * k / n) * (1L << 29));
+    int32_t s1 = 0;
+    int32_t s2 = 0;
+    const int16_t* sample = x;
+    for(int i=0; i<n; i++){
+      int32_t s0 = *sample + (int32_t)(((int64_t)coef * s1) >> 29) - s2;
+      s2 = s1;
+      s1 = s0;
+      sample += stride;
+    }
+    double power = (double)s1 * s1 + (double)s2 * s2 - (double)coef * s1 * s2 / (1L << 29);
+    magnitude[k] = power > 0 ? sqrt(power) : 0;
+  }
 }
 
 /****************************************************************************************************
@@ -440,7 +747,6 @@ int readADC(uint8_t channel){
  ****************************************************************************************************/
 float sampleVoltage(uint8_t Vchan, float Vcal){
   IotaInputChannel* Vchannel = inputChannel[Vchan];
-  uint32_t sumVsq = 0;
   int retries = 0;
   while(int rtc = sampleCycle(Vchannel, Vchannel)){
     if(rtc == 2){
@@ -450,12 +756,8 @@ float sampleVoltage(uint8_t Vchan, float Vcal){
       return -1.0;
     }
   }
-  for(int i=0; i<samples; i++){  
-    sumVsq += Vsample[i] * Vsample[i];
-    sumVsq += Isample[i] * Isample[i];
-  }
   double Vratio = Vcal * Vadj_3 * getAref(Vchan) / double(ADC_RANGE);
-  return  Vratio * sqrt((double)(sumVsq / (samples * 2)));
+  return  Vratio * sqrt(((double)sumVsq + sumIsq) / (samples * 2));
 }
 //**********************************************************************************************
 //
@@ -464,45 +766,11 @@ float sampleVoltage(uint8_t Vchan, float Vcal){
 //**********************************************************************************************
 
 float getAref(int channel) { 
-  uint32_t align = 0;               // SPI requires out and in to be word aligned                                                                 
-  uint8_t ADC_out [4] = {0, 0, 0, 0};
-  uint8_t ADC_in  [4] = {0, 0, 0, 0};  
-  uint8_t ADCselectPin;
-  
-  SPI.beginTransaction(SPISettings(2000000,MSBFIRST,SPI_MODE0));  // SD may have changed this
-  ADCselectPin = ADC_selectPin[inputChannel[channel]->_aRef >> 3];    
-  ADC_out[0] = 0x18 | (inputChannel[channel]->_aRef & 0x07);            
-
-  digitalWrite(ADCselectPin, LOW);                  // Lower the chip select
-  SPI.transferBytes(ADC_out, ADC_in, 3);            // Start reading the results
-  digitalWrite(ADCselectPin, HIGH);                 // Raise the chip select to deselect and reset
-                                                    // Put the result together and return
-  uint16_t ADCvalue = (word(ADC_in[1] & 0x3F, ADC_in[2]) >> (14 - ADC_BITS));
+  uint16_t ADCvalue = ADCread(inputChannel[channel]->_aRef);
   if(ADCvalue == 4095 | ADCvalue == 0) return 0;    // no ADC
   return VrefVolts * ADC_RANGE / ADCvalue;  
 }
 
-//**********************************************************************************************
-//
-//        printSamples()  -  print the current samples.
-//        These are diagnostic tools, not currently used.
-//
-//**********************************************************************************************
-
-void printSamples() {
-  Serial.println(samples);
-  for(int i=0; i<(samples + 2); i++)
-  {
-    Serial.print(i);
-    Serial.print(", ");
-    Serial.print(Vsample[i]);
-    Serial.print(", ");
-    Serial.print(Isample[i]);
-    Serial.println();
-  }
-  return;
-}
-
 // String samplePhase(uint8_t Vchan, uint8_t Ichan, uint16_t shift){
 
 //   trace(T_samplePhase,0);
@@ -709,18 +977,11 @@ float samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double
   int offsetCycles = 5;                            // Cycles sampled to determine offset value
   int cycles = 20;                                // Cycles sampled for phase calculation
 
-  uint32_t dataMask = ((ADC_BITS + 6) << SPILMOSI) | ((ADC_BITS + 6) << SPILMISO);
-  const uint32_t mask = ~((SPIMMOSI << SPILMOSI) | (SPIMMISO << SPILMISO));
-  volatile uint8_t * fifoPtr8 = (volatile uint8_t *) &SPI1W0;
-
   IotaInputChannel* Ichannel = inputChannel[Ichan];
   IotaInputChannel* Cchannel = inputChannel[Cchan];
 
-  byte ADC_IselectPin = ADC_selectPin[Ichannel->_addr >> 3];  // Chip select pin
-  byte ADC_CselectPin = ADC_selectPin[Cchannel->_addr >> 3]; 
-  
-  uint32_t ADC_IselectMask = 1 << ADC_IselectPin;             // Mask for hardware chip select (pins 0-15)
-  uint32_t ADC_CselectMask = 1 << ADC_CselectPin;
+  uint32_t ADC_IselectMask = ADCselectMask(Ichannel->_addr);  // Mask for hardware chip select
+  uint32_t ADC_CselectMask = ADCselectMask(Cchannel->_addr);
               
   uint8_t  Iport = inputChannel[Ichan]->_addr % 8;             // Port on ADC
   uint8_t  Cport = inputChannel[Cchan]->_addr % 8;         
@@ -753,10 +1014,7 @@ float samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double
   int32_t sumC = 0;
   int32_t samples = 0;
 
-  int32_t Iwait = 0;
-  int32_t Cwait = 0;
-
-  SPI.beginTransaction(SPISettings(2000000,MSBFIRST,SPI_MODE0));
+  ADCbegin();
  
   rawI = (readADC(Ichan) << 2) - offsetI;                    // Prime the pump
   samples = 0;
@@ -770,10 +1028,7 @@ float samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double
                       //* Sample the CT (C) channel   *
                       //*******************************
                                                
-        GPOC = ADC_CselectMask;                            // digitalWrite(ADC_CselectPin, LOW); Select the ADC
-        SPI1U1 = (SPI1U1 & mask) | dataMask;               // Set number of bits 
-        SPI1W0 = (0x18 | Cport) << 3;                      // Data left aligned in low byte 
-        SPI1CMD |= SPIBUSY;                                // Start the SPI clock 
+        ADCstart(ADC_CselectMask, Cport);                  // Select the ADC and start the conversion
 
           if(crossCount) {
             sumI += (rawI + lastI) >> 1;
@@ -783,30 +1038,23 @@ float samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double
           lastI = rawI;
           crossGuard--;    
           
-        while(SPI1CMD & SPIBUSY) {}                                         // Loop till SPI completes
-        GPOS = ADC_CselectMask;                                             // digitalWrite(ADC_CselectPin, HIGH); Deselect the ADC 
-        rawC = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 5) + ((*(fifoPtr8+2) & 0xE0) >> 3) - offsetC;
+        rawC = (ADCfinish(ADC_CselectMask) << 2) - offsetC;                // 14 bit reading
         if(Creverse) rawC = -rawC;
 
                       //************************************
                       //*  Sample the Current (I) channel  *
                       //************************************
          
-        GPOC = ADC_IselectMask;                             // digitalWrite(ADC_IselectPin, LOW); Select the ADC
-        SPI1U1 = (SPI1U1 & mask) | dataMask;
-        SPI1W0 = (0x18 | Iport) << 3;
-        SPI1CMD |= SPIBUSY;
+        ADCstart(ADC_IselectMask, Iport);                   // Select the ADC and start the conversion
                
           if((uint32_t)(millis()-startMs)>timeoutMs){                   // Something is wrong
-            GPOS = ADC_IselectMask;                                     // ADC select pin high 
+            ADCdeselect(ADC_IselectMask);                               // ADC select pin high 
             delete[] isamples;                               
             Serial.printf("crosscount %d, samples %d\r\n", crossCount, samples);                                              
             return -998.0;  
           }
         
-        while(SPI1CMD & SPIBUSY) {}                                 
-        GPOS = ADC_IselectMask;
-        rawI = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 5) + ((*(fifoPtr8+2) & 0xE0) >> 3) - offsetI;                           // digitalWrite(ADC_IselectPin, HIGH);  Deselect the ADC                       
+        rawI = (ADCfinish(ADC_IselectMask) << 2) - offsetI;
         if(Ireverse) rawI = -rawI;
 
         // Finish up loop cycle by checking for zero crossing.
@@ -846,10 +1094,7 @@ float samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double
                       //* Sample the CT (C) channel   *
                       //*******************************
                                                
-        GPOC = ADC_CselectMask;                            // digitalWrite(ADC_CselectPin, LOW); Select the ADC
-        SPI1U1 = (SPI1U1 & mask) | dataMask;               // Set number of bits 
-        SPI1W0 = (0x18 | Cport) << 3;                      // Data left aligned in low byte 
-        SPI1CMD |= SPIBUSY;                                // Start the SPI clock 
+        ADCstart(ADC_CselectMask, Cport);                  // Select the ADC and start the conversion
 
               // Do some loop housekeeping asynchronously while SPI runs.
 
@@ -875,19 +1120,14 @@ float samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double
           
               // Now wait for SPI to complete
         
-        while(SPI1CMD & SPIBUSY) {Cwait++;}                                         // Loop till SPI completes
-        GPOS = ADC_CselectMask;                                             // digitalWrite(ADC_CselectPin, HIGH); Deselect the ADC 
-        rawC = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 5) + ((*(fifoPtr8+2) & 0xE0) >> 3) - offsetC;
+        rawC = (ADCfinish(ADC_CselectMask) << 2) - offsetC;                // 14 bit reading
         if(Creverse) rawC = -rawC;
 
                       //************************************
                       //*  Sample the Current (I) channel  *
                       //************************************
          
-        GPOC = ADC_IselectMask;                             // digitalWrite(ADC_IselectPin, LOW); Select the ADC
-        SPI1U1 = (SPI1U1 & mask) | dataMask;
-        SPI1W0 = (0x18 | Iport) << 3;
-        SPI1CMD |= SPIBUSY;
+        ADCstart(ADC_IselectMask, Iport);                   // Select the ADC and start the conversion
         
               // Do some housekeeping asynchronously while SPI runs.
               // Check for timeout.  The clock gets reset at each crossing, so the
@@ -898,16 +1138,14 @@ float samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double
               // So handling needs to be robust.
         
           if((uint32_t)(millis()-startMs)>timeoutMs){                   // Something is wrong
-            GPOS = ADC_IselectMask;                                     // ADC select pin high 
+            ADCdeselect(ADC_IselectMask);                               // ADC select pin high 
             delete[] isamples;                               
             return -999.0;                                                // Return a failure
           }
                               
               // Now wait for SPI to complete
         
-        while(SPI1CMD & SPIBUSY) {Iwait++;}                                 
-        GPOS = ADC_IselectMask;
-        rawI = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 5) + ((*(fifoPtr8+2) & 0xE0) >> 3) - offsetI;                           // digitalWrite(ADC_IselectPin, HIGH);  Deselect the ADC                       
+        rawI = (ADCfinish(ADC_IselectMask) << 2) - offsetI;
         if(Ireverse) rawI = -rawI;
 
         // Finish up loop cycle by checking for zero crossing.
@@ -1,13 +1,64 @@
 #ifndef samplePower_h
 #define samplePower_h
 
+#define PHASE_FIR_STEPS 128                 // Fractional delays in phase correction filter
+#define PHASE_FIR_TAPS 4
+
+#define MAX_CYCLE_CTS 3                     // Current channels sampled per cycle by sampleCycles
+#define HARMONIC_ORDERS 15                  // Harmonics analysed, fundamental through 15th
+
+extern int16_t* phaseFIR;                   // PHASE_FIR_STEPS sets of Q15 coefficients
+
+      // Current samples paired with the voltage steps samples away, interpolated by the fractional
+      // delay filter: the sum of the pairs and the delays that make them (setupPairing).
+
+struct samplePairing {
+      int64_t   sum;
+      int16_t   shift;                      // Whole samples of delay
+      int16_t   delayI;                     // Delays of the samples paired
+      int16_t   delayV;
+      int16_t   delayMax;
+      int16_t   firstPair;                  // Sample that completes the first pair
+      int16_t   headSize;                   // Samples needed from the head of the cycle
+      int32_t   coef[PHASE_FIR_TAPS];       // Fractional delay filter
+    };
+
+      // A current channel in sampleCycles: its sums, phase correction and delay line.
+
+struct sampleCT {
+      IotaInputChannel* channel;
+      int32_t   sumI;
+      uint32_t  sumIsq;
+      samplePairing VI;                     // With the phase corrected voltage (watts)
+      samplePairing VQ;                     // With that a quarter cycle away (VAR)
+      int16_t   rawI;
+      int16_t   offset;
+      uint32_t  selectMask;
+      uint8_t   port;
+      int8_t    signVQ;                     // -1 if VQ is paired with the voltage a quarter cycle ahead
+      float     correction;                 // Phase correction applied, degrees
+      float     steps;                      // ...in samples, including position in the pass
+      int16_t   delayMax;                   // Of VI and VQ
+      int16_t   headSize;                   // Samples saved from the head of the cycle
+      int16_t*  Idelay;
+      int16_t*  Ihead;
+    };
+
 void    samplePower(int channel, int overSample);
-int     sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles = 1);
+void    samplePowers(int* channels, int count);
+int     samplePowerCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int16_t* capture = nullptr);
+int     sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles = 1, int16_t* capture = nullptr);
+int     sampleCycles(IotaInputChannel* Vchannel, IotaInputChannel** Ichannels, int count, sampleCT* CTs,
+                     int cycles = 1, int16_t* capture = nullptr, int captureCT = 0);
 float   getAref(int channel);
 int     readADC(uint8_t channel);
 float   sampleVoltage(uint8_t Vchan, float Vcal);
+void    buildPhaseFIR();
+bool    harmonicDue(IotaInputChannel* channel);
+void    harmonicAnalysis(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, const int16_t* capture);
+void    analyseHarmonics(IotaInputChannel* channel, const int16_t* x, int stride);
+void    goertzel(const int16_t* x, int stride, int n, int orders, double* magnitude);
 float   samplePhase(uint8_t Vchan, uint8_t Ichan, int Ishift = 100);
 float   samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double *VSec);
-void    printSamples();
 
 #endif
\ No newline at end of file
@@ -48,6 +48,11 @@ uint32_t statService(struct serviceBlock* _serviceBlock) {
   trace(T_stats, 4);
   cycleSampleRate = .25 * cycleSampleRate + (1.0 - .25) * float(cycleSamples * 1000) / float((uint32_t)(timeNow - timeThen));
   cycleSamples = 0;
+  for(int i=0; i<maxInputs; i++){
+    inputChannel[i]->_sampleRate = .25 * inputChannel[i]->_sampleRate + 
+                                   (1.0 - .25) * float(inputChannel[i]->_sampleCount * 1000) / float((uint32_t)(timeNow - timeThen));
+    inputChannel[i]->_sampleCount = 0;
+  }
   if(heapMsPeriod > 300000){
     heapMs = 0.0;
     heapMsPeriod = 0;
@@ -72,6 +72,7 @@ uint32_t timeSync(struct serviceBlock* _serviceBlock) {
   trace(T_timeSync, 1);
   if(millis() > 3628800000UL) {
     log("timeSync: Six week routine restart.");
+    currLog.end();
     ESP.restart();
   }
 
@@ -198,6 +198,7 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
       if(unpackUpdate(updateVersion)){
         if(installUpdate(updateVersion)){
           log ("Firmware updated, restarting.");
+          currLog.end();
           delay(500);
           ESP.restart();
         }
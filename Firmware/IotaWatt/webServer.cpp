@@ -70,6 +70,7 @@ void handleRequest(){
   if(serverOn(authAdmin, F("/status"),HTTP_GET, handleStatus)) return;
   if(serverOn(authAdmin, F("/vcal"),HTTP_GET, handleVcal)) return;
   if(serverOn(authAdmin, F("/command"), HTTP_GET, handleCommand)) return;
+  if(serverOn(authAdmin, F("/samples"), HTTP_GET, handleSamples)) return;
   if(serverOn(authUser, F("/list"), HTTP_GET, printDirectory)) return;
   if(serverOn(authAdmin, F("/config"), HTTP_GET, handleGetConfig)) return;
   if(serverOn(authAdmin, F("/edit"), HTTP_DELETE, handleDelete)) return;
@@ -493,6 +494,26 @@ void handleStatus(){
     stats.set(F("frequency"),frequency);
     trace(T_WEB,14);
     stats.set(F("lowbat"), RTClowBat);
+    trace(T_WEB,14);
+    JsonArray& sampling = stats.createNestedArray("sampling");
+    for(int i=0; i<maxInputs; i++){
+      if(inputChannel[i]->isActive()){
+        sampleQuality& quality = inputChannel[i]->_quality;
+        JsonObject& channelObject = sampling.createNestedObject();
+        channelObject.set(F("channel"),inputChannel[i]->_channel);
+        channelObject.set(F("attempts"),quality.attempts);
+        channelObject.set(F("good"),quality.successes);
+        channelObject.set(F("lowcount"),quality.rejects[sampleLowCount]);
+        channelObject.set(F("imbalance"),quality.rejects[sampleImbalance]);
+        channelObject.set(F("timeout"),quality.rejects[sampleTimeout]);
+        channelObject.set(F("maxsamples"),quality.rejects[sampleMaxSamples]);
+        channelObject.set(F("samplesmin"),quality.minSamples);
+        channelObject.set(F("samplesavg"),quality.successes ? (double)quality.sumSamples / quality.successes : 0.0);
+        channelObject.set(F("samplesmax"),quality.maxSamples);
+        channelObject.set(F("lastgood"),quality.successes ? 
+                          UTCtime() - (uint32_t)(millis() - quality.lastSuccessMs) / 1000 : 0);
+      }
+    }
     root.set(F("stats"),stats);
   }
   
@@ -503,6 +524,14 @@ void handleStatus(){
       if(inputChannel[i]->isActive()){
         JsonObject& channelObject = jsonBuffer.createObject();
         channelObject.set(F("channel"),inputChannel[i]->_channel);
+        channelObject.set(F("samplerate"),inputChannel[i]->_sampleRate);
+        if(harmonicCycles){
+          channelObject.set(F("THD"),inputChannel[i]->dataBucket.value3);
+          JsonArray& harmonics = channelObject.createNestedArray("harmonics");
+          for(int h=0; h<HARMONICS_SELECTED; h++){
+            harmonics.add(inputChannel[i]->_harmonic[h]);
+          }
+        }
         if(inputChannel[i]->_type == channelTypeVoltage){
           channelObject.set(F("Vrms"),statRecord.accum1[i]);
           channelObject.set(F("Hz"),statRecord.accum2[i]);
@@ -516,6 +545,7 @@ void handleStatus(){
             pf = statRecord.accum1[i] / pf;
           }
           channelObject.set("Pf",pf);
+          channelObject.set(F("VAR"),String(inputChannel[i]->dataBucket.value4,0));
           if(inputChannel[i]->_reversed){
             channelObject.set(F("reversed"),true);
           }
@@ -622,12 +652,51 @@ void handleVcal(){
   server.send(200, txtJson_P, response);  
 }
 
+void deleteHistoryTiers(){
+  for(int i=0; i<HISTORY_TIERS; i++){
+    historyTier[i]->end();
+    deleteRecursive(String(historyTierFile[i]) + ".log");
+    deleteRecursive(String(historyTierFile[i]) + ".ndx");
+    deleteRecursive(String(historyTierFile[i]) + ".hdr");
+    deleteRecursive(String(historyTierFile[i]) + ".bix");
+  }
+}
+
+/************************************************************************************************
+ * /samples?ichan=n[&vchan=n][&format=csv|bin]
+ * One cycle of raw samples of a power (or voltage) channel against its voltage channel.
+ * See getSamples.
+ ************************************************************************************************/
+void handleSamples(){
+  trace(T_WEB,24);
+  int Ichan = server.hasArg(F("ichan")) ? server.arg(F("ichan")).toInt() : -1;
+  if(Ichan < 0 || Ichan >= maxInputs || ! inputChannel[Ichan]->isActive()){
+    server.send(400, txtPlain_P, "Invalid ichan.");
+    return;
+  }
+  int Vchan = inputChannel[Ichan]->_type == channelTypeVoltage ? Ichan : inputChannel[Ichan]->_vchannel;
+  if(server.hasArg(F("vchan"))){
+    Vchan = server.arg(F("vchan")).toInt();
+  }
+  if(Vchan < 0 || Vchan >= maxInputs || ! inputChannel[Vchan]->isActive() ||
+     inputChannel[Vchan]->_type != channelTypeVoltage){
+    server.send(400, txtPlain_P, "Invalid vchan.");
+    return;
+  }
+  sampleFormat format = sampleFormatCSV;
+  if(server.arg(F("format")) == "bin"){
+    format = sampleFormatBinary;
+  }
+  getSamples(Ichan, Vchan, format);
+}
+
 void handleCommand(){
   trace(T_WEB,2); 
   if(server.hasArg(F("restart"))) {
     trace(T_WEB,3); 
     server.send(200, "text/plain", "ok");
     log("Restart command received.");
+    currLog.end();
     delay(500);
     ESP.restart();
   }
@@ -649,11 +718,28 @@ void handleCommand(){
   }
   if(server.hasArg(F("sample"))){
     trace(T_WEB,5); 
-    uint16_t chan = server.arg(F("sample")).toInt();
-    sampleCycle(inputChannel[0], inputChannel[chan]);
-    getSamples();
+    int chan = server.arg(F("sample")).toInt();
+    if(chan < 0 || chan >= maxInputs || ! inputChannel[chan]->isActive()){
+      server.send(400, txtPlain_P, "Invalid channel.");
+      return;
+    }
+    getSamples(chan, inputChannel[chan]->_type == channelTypeVoltage ? chan : inputChannel[chan]->_vchannel);
     return; 
   }
+  if(server.hasArg(F("burst"))){
+    trace(T_WEB,25); 
+    int chan = server.arg(F("burst")).toInt();
+    if(chan < 0 || chan >= maxInputs || inputChannel[chan]->_type != channelTypePower){
+      server.send(400, txtPlain_P, "Invalid channel.");
+      return;
+    }
+    if( ! burstStart(chan)){
+      server.send(503, txtPlain_P, "Burst busy or not enough memory, try again.");
+      return;
+    }
+    server.send(200, txtPlain_P, "ok");
+    return;
+  }
   if(server.hasArg(F("disconnect"))) {
     trace(T_WEB,6); 
     server.send(200, txtPlain_P, "ok");
@@ -670,21 +756,31 @@ void handleCommand(){
       currLog.end();
       deleteRecursive(String(IotaLogFile) + ".log");
       deleteRecursive(String(IotaLogFile) + ".ndx");
+      deleteRecursive(String(IotaLogFile) + ".hdr");
+      deleteRecursive(String(IotaLogFile));
     } 
     else if(arg == "history"){
       trace(T_WEB,22); 
       histLog.end();
       deleteRecursive(String(historyLogFile) + ".log");
       deleteRecursive(String(historyLogFile) + ".ndx");
+      deleteRecursive(String(historyLogFile) + ".hdr");
+      deleteRecursive(String(historyLogFile) + ".bix");
+      deleteHistoryTiers();
     }
     else if(arg == "both"){
       trace(T_WEB,23);
       currLog.end();
       deleteRecursive(String(IotaLogFile) + ".log");
       deleteRecursive(String(IotaLogFile) + ".ndx");
+      deleteRecursive(String(IotaLogFile) + ".hdr");
+      deleteRecursive(String(IotaLogFile));
       histLog.end();
       deleteRecursive(String(historyLogFile) + ".log");
       deleteRecursive(String(historyLogFile) + ".ndx");
+      deleteRecursive(String(historyLogFile) + ".hdr");
+      deleteRecursive(String(historyLogFile) + ".bix");
+      deleteHistoryTiers();
     }
     else {
       server.send(400, txtPlain_P, F("Specify current, history, or both."));
@@ -798,6 +894,7 @@ void handleGetConfig(){
     if(server.arg(F("update")) == "restart"){
       server.send(200, F("text/plain"), "OK");
       log("Restart command received.");
+      currLog.end();
       delay(500);
       ESP.restart();
     }
@@ -19,6 +19,7 @@ bool loadFromSpiffs(String path, String dataType);
 void handleFileUpload();
 void handleSpiffsUpload();
 void deleteRecursive(String path);
+void deleteHistoryTiers();
 void handleDelete();
 void handleCreate();
 void printDirectory();
@@ -27,6 +28,7 @@ void handleNotFound();
 void handleStatus();
 void handleVcal();
 void handleCommand();
+void handleSamples();
 void handleGetFeedList();
 void handleGetFeedData();
 void handleGraphCreate();
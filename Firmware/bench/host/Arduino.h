@@ -0,0 +1,131 @@
+#pragma once
+
+/*********************************************************************************************************
+ *
+ *      Host (Linux) stand-ins for the small part of the Arduino/ESP8266 core that the
+ *      IotaWatt log engine and sampling code use.  Only enough is here to compile and run the firmware
+ *      sources under the bench harness - this is not an emulator.
+ *
+ * *******************************************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+typedef bool      boolean;
+typedef uint8_t   byte;
+typedef uint32_t  uint32;
+typedef uint16_t  word;
+
+using std::min;
+using std::max;
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+#define PSTR(s) (s)
+#define F(s) (s)
+#define PROGMEM
+#define PGM_P const char*
+#define printf_P printf
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define sprintf_P sprintf
+
+uint32_t  millis();
+uint32_t  micros();
+void      yield();
+void      delay(uint32_t ms);
+void      hostClock(uint64_t (*clockUs)());   // Host only: run millis() and micros() from clockUs (nullptr = real time)
+
+#define WDT_FEED()
+
+//********************************************************************************************************
+//      String - just what the log engine needs, backed by std::string.
+//********************************************************************************************************
+class String {
+  public:
+    String() {}
+    String(const char* str) :_str(str ? str : "") {}
+    String(const std::string& str) :_str(str) {}
+    String(char c) :_str(1, c) {}
+    String(int value) :_str(std::to_string(value)) {}
+    String(unsigned int value) :_str(std::to_string(value)) {}
+    String(long value) :_str(std::to_string(value)) {}
+    String(unsigned long value) :_str(std::to_string(value)) {}
+
+    const char*   c_str() const {return _str.c_str();}
+    unsigned int  length() const {return _str.length();}
+    int           lastIndexOf(char c) const {size_t pos = _str.rfind(c); return pos == std::string::npos ? -1 : (int)pos;}
+    int           indexOf(char c, unsigned int from = 0) const {size_t pos = _str.find(c, from); return pos == std::string::npos ? -1 : (int)pos;}
+    String        substring(unsigned int from) const {return String(_str.substr(std::min(from, length())));}
+    String        substring(unsigned int from, unsigned int to) const {
+                    from = std::min(from, length());
+                    return String(_str.substr(from, std::min(to, length()) - from));
+                  }
+    bool          startsWith(const String& str) const {return _str.compare(0, str._str.length(), str._str) == 0;}
+    bool          endsWith(const String& str) const {
+                    return _str.length() >= str._str.length() &&
+                           _str.compare(_str.length() - str._str.length(), str._str.length(), str._str) == 0;
+                  }
+    bool          equals(const String& str) const {return _str == str._str;}
+    bool          operator==(const String& str) const {return _str == str._str;}
+    bool          operator!=(const String& str) const {return _str != str._str;}
+    String&       operator+=(const String& str) {_str += str._str; return *this;}
+    String&       operator+=(const char* str) {_str += str; return *this;}
+    String&       operator+=(char c) {_str += c; return *this;}
+    friend String operator+(const String& a, const String& b) {return String(a._str + b._str);}
+    friend String operator+(const String& a, const char* b) {return String(a._str + b);}
+    friend String operator+(const char* a, const String& b) {return String(a + b._str);}
+
+  private:
+    std::string _str;
+};
+
+//********************************************************************************************************
+//      Print - printf flavors over a virtual write().
+//********************************************************************************************************
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(const uint8_t* buf, size_t len) = 0;
+    size_t write(const char* buf, size_t len) {return write((const uint8_t*)buf, len);}
+    size_t printf(const char* format, ...) __attribute__ ((format (printf, 2, 3))) {
+      char buf[256];
+      va_list args;
+      va_start(args, format);
+      int len = vsnprintf(buf, sizeof(buf), format, args);
+      va_end(args);
+      if(len < 0) return 0;
+      return write((const uint8_t*)buf, std::min((size_t)len, sizeof(buf) - 1));
+    }
+    size_t print(const char* str) {return write((const uint8_t*)str, strlen(str));}
+    size_t print(const String& str) {return print(str.c_str());}
+    size_t print(long value) {return printf("%ld", value);}
+    size_t println(const char* str = "") {return print(str) + print("\r\n");}
+    size_t println(const String& str) {return println(str.c_str());}
+    size_t println(long value) {return print(value) + print("\r\n");}
+};
+
+class HardwareSerial : public Print {
+  public:
+    HardwareSerial() :_quiet(false) {}
+    size_t write(const uint8_t* buf, size_t len) {return _quiet ? len : fwrite(buf, 1, len, stderr);}
+    void   quiet(bool quiet) {_quiet = quiet;}
+  private:
+    bool   _quiet;
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+  public:
+    void      restart();
+    void      wdtFeed() {}
+    uint32_t  getFreeHeap() {return 40000;}
+    uint32_t  restarts;
+};
+extern EspClass ESP;
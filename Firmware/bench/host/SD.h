@@ -0,0 +1,121 @@
+#pragma once
+
+/*********************************************************************************************************
+ *
+ *      Host stand-in for the Arduino SD library.  Files live in an ordinary host directory
+ *      (SD.setRoot()) and every call is counted in SDstats so the bench can report what a
+ *      log operation would have cost on the card.
+ *
+ *      The sector counts model the SD library's single 512 byte block cache: a read or write
+ *      only costs a card transfer when it touches a block other than the one last cached.
+ *      A flush of a File that has been written updates the directory entry, which displaces
+ *      the cached data block.
+ *
+ *      Like the SD library (sdfatlib), each open File has its own position in the file's FAT
+ *      cluster chain.  Seeking forward follows the chain from there, seeking back follows it
+ *      from the first cluster, and reading or writing into the next cluster follows one link.
+ *      Each FAT block read doing so is counted in fatReads (and blockReads).  Growing a file
+ *      into a new cluster allocates it: a FAT block read and the two FAT copies written.
+ *      Each File also has its own idea of the file's size, set at open() and by its own writes,
+ *      so a reader doesn't see a file grown by another until it reopens it.  Data written by
+ *      any File is visible to all, as through the library's shared block cache.
+ *
+ *      A directory opened for reading lists its entries with openNextFile().
+ *
+ * *******************************************************************************************************/
+
+#include "Arduino.h"
+#include <dirent.h>
+#include <memory>
+
+#define FILE_READ   1
+#define FILE_WRITE  2
+
+#define SD_BLOCK_SIZE 512
+#define SD_CLUSTER_SIZE 32768               // Default cluster size (FAT32, 8-32GB card)
+#define SD_FAT_ENTRIES 128                  // FAT32 entries per FAT block
+
+struct SDstats {
+    uint32_t  opens;
+    uint32_t  seeks;                        // Calls to File::seek
+    uint32_t  reads;                        // Calls to File::read
+    uint64_t  bytesRead;
+    uint32_t  writes;                       // Calls to File::write
+    uint64_t  bytesWritten;
+    uint32_t  flushes;
+    uint32_t  blockReads;                   // Card blocks transferred in (see above)
+    uint32_t  blockWrites;                  // Card blocks transferred out
+    uint32_t  fatReads;                     // FAT blocks read following cluster chains
+    SDstats() {memset(this, 0, sizeof(SDstats));}
+    SDstats   operator-(const SDstats& then) const;
+    SDstats   operator+(const SDstats& more) const;
+};
+
+extern SDstats SDstat;
+
+struct hostRestart {};                      // Thrown by ESP.restart()
+
+class File : public Print {
+  public:
+    File() {}
+    explicit operator bool() const {return _file && _file->fp;}
+
+    int       read();
+    int       read(void* buf, size_t len);
+    size_t    write(const uint8_t* buf, size_t len);
+    size_t    write(uint8_t c) {return write(&c, 1);}
+    using Print::write;
+    bool      seek(uint32_t pos);
+    uint32_t  position();
+    uint32_t  size();
+    int       available();
+    void      flush();
+    void      close();
+    bool      isDirectory();
+    const char* name();                     // Last component of path, as the library's short name
+    File      openNextFile(uint8_t mode = FILE_READ);
+    void      rewindDirectory();
+    bool      truncate(uint32_t size);
+
+  private:
+    friend class SDClass;
+    struct hostFile {
+      FILE*       fp;
+      uint32_t    id;
+      uint32_t    pos;
+      uint32_t    size;                     // File size as known to this File
+      uint32_t    cluster;                  // Index in chain of current cluster (valid if pos > 0)
+      bool        dirty;                    // Written since last flush
+      std::string name;
+      DIR*        dir;                      // Directory being listed (nullptr for a file)
+      ~hostFile() {if(fp) fclose(fp); if(dir) closedir(dir);}
+    };
+    std::shared_ptr<hostFile> _file;
+    void      touch(uint32_t pos, size_t len, bool write);
+    void      walk(uint32_t pos);
+    void      fatBlock(uint32_t block);
+};
+
+class SDClass {
+  public:
+    void      setRoot(const char* root);
+    const char* root() {return _root.c_str();}
+    bool      exists(const char* path);
+    bool      exists(const String& path) {return exists(path.c_str());}
+    bool      mkdir(const char* path);
+    bool      mkdir(const String& path) {return mkdir(path.c_str());}
+    File      open(const char* path, uint8_t mode = FILE_READ);
+    File      open(const String& path, uint8_t mode = FILE_READ) {return open(path.c_str(), mode);}
+    bool      remove(const char* path);
+    bool      remove(const String& path) {return remove(path.c_str());}
+    bool      rmdir(const char* path);
+    void      setClusterSize(uint32_t size) {_clusterSize = size;}
+    uint32_t  clusterSize() {return _clusterSize;}
+
+  private:
+    std::string _root;
+    uint32_t  _clusterSize = SD_CLUSTER_SIZE;
+    std::string hostPath(const char* path);
+};
+
+extern SDClass SD;
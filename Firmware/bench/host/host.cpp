@@ -0,0 +1,382 @@
+/*
+  host.cpp - Linux implementations of the bench stand-ins for Arduino, ESP and SD.
+*/
+#include <chrono>
+#include <time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+HardwareSerial  Serial;
+EspClass        ESP;
+SDClass         SD;
+SDstats         SDstat;
+
+static const auto hostStart = std::chrono::steady_clock::now();
+static uint64_t (*hostClockUs)() = nullptr;
+
+uint32_t millis(){
+  if(hostClockUs) return hostClockUs() / 1000;
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+uint32_t micros(){
+  if(hostClockUs) return hostClockUs();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+void hostClock(uint64_t (*clockUs)()){
+  hostClockUs = clockUs;
+}
+
+void yield(){}
+void delay(uint32_t ms){usleep(ms * 1000);}
+
+void EspClass::restart(){
+  restarts++;
+  throw hostRestart();
+}
+
+uint32_t UTCtime(){return time(nullptr);}
+uint32_t localTime(){return time(nullptr);}
+void setLedCycle(const char*){}
+void endLedCycle(){}
+
+void hostLog(const char* format, ...){
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  Serial.printf("log: %s\n", buf);
+}
+
+void trace(const uint8_t /*module*/, const uint8_t /*id*/, const uint8_t /*det*/){}
+
+//********************************************************************************************************
+//      Sampling globals, as in common.cpp
+//********************************************************************************************************
+uint32_t lastCrossMs = 0;
+uint32_t lastCycleStartUs = 0;
+uint32_t lastCycleUs = 0;
+uint32_t nextCrossMs = 0;
+IotaInputChannel* *inputChannel = nullptr;
+uint8_t  maxInputs = 0;
+uint8_t  deviceMajorVersion = 5;
+uint8_t  deviceMinorVersion = 0;
+float    VrefVolts = 2.5;
+float    frequency = 55;
+float    samplesPerCycle = 550;
+int16_t  cycleSamples = 0;
+uint32_t sumVsq;
+uint32_t sumIsq;
+int64_t  sumVI;
+int64_t  sumVQ;
+int16_t  samples = 0;
+uint16_t harmonicCycles = 0;
+
+DateTime::DateTime(uint32_t t){
+  time_t tt = t;
+  struct tm* tm = gmtime(&tt);
+  _year = tm->tm_year + 1900;
+  _month = tm->tm_mon + 1;
+  _day = tm->tm_mday;
+  _hour = tm->tm_hour;
+  _minute = tm->tm_min;
+  _second = tm->tm_sec;
+}
+
+//********************************************************************************************************
+//      SDstats
+//********************************************************************************************************
+
+SDstats SDstats::operator-(const SDstats& then) const {
+  SDstats delta;
+  delta.opens = opens - then.opens;
+  delta.seeks = seeks - then.seeks;
+  delta.reads = reads - then.reads;
+  delta.bytesRead = bytesRead - then.bytesRead;
+  delta.writes = writes - then.writes;
+  delta.bytesWritten = bytesWritten - then.bytesWritten;
+  delta.flushes = flushes - then.flushes;
+  delta.blockReads = blockReads - then.blockReads;
+  delta.blockWrites = blockWrites - then.blockWrites;
+  delta.fatReads = fatReads - then.fatReads;
+  return delta;
+}
+
+SDstats SDstats::operator+(const SDstats& more) const {
+  SDstats sum;
+  sum.opens = opens + more.opens;
+  sum.seeks = seeks + more.seeks;
+  sum.reads = reads + more.reads;
+  sum.bytesRead = bytesRead + more.bytesRead;
+  sum.writes = writes + more.writes;
+  sum.bytesWritten = bytesWritten + more.bytesWritten;
+  sum.flushes = flushes + more.flushes;
+  sum.blockReads = blockReads + more.blockReads;
+  sum.blockWrites = blockWrites + more.blockWrites;
+  sum.fatReads = fatReads + more.fatReads;
+  return sum;
+}
+
+//********************************************************************************************************
+//      File
+//********************************************************************************************************
+
+static struct {
+  uint32_t  file;
+  uint32_t  block;
+  bool      valid;
+  bool      dirty;
+} blockCache = {0, 0, false, false};
+
+void File::touch(uint32_t pos, size_t len, bool write){
+  if(len == 0) return;
+  for(uint32_t block = pos / SD_BLOCK_SIZE; block <= (pos + len - 1) / SD_BLOCK_SIZE; block++){
+    if( ! (blockCache.valid && blockCache.file == _file->id && blockCache.block == block)){
+      if(blockCache.dirty){
+        SDstat.blockWrites++;
+      }
+      bool whole = write && pos <= block * SD_BLOCK_SIZE && (pos + len) >= (block + 1) * SD_BLOCK_SIZE;
+      if( ! whole){
+        SDstat.blockReads++;
+      }
+      blockCache.file = _file->id;
+      blockCache.block = block;
+      blockCache.valid = true;
+      blockCache.dirty = false;
+    }
+    if(write){
+      blockCache.dirty = true;
+    }
+  }
+}
+
+int File::read(){
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::read(void* buf, size_t len){
+  if( ! *this) return -1;
+  SDstat.reads++;
+  len = std::min(len, (size_t)(_file->size - std::min(_file->pos, _file->size)));
+  fseeko(_file->fp, _file->pos, SEEK_SET);
+  size_t got = fread(buf, 1, len, _file->fp);
+  touch(_file->pos, got, false);
+  walk(_file->pos + got);
+  _file->pos += got;
+  SDstat.bytesRead += got;
+  return got;
+}
+
+size_t File::write(const uint8_t* buf, size_t len){
+  if( ! *this) return 0;
+  SDstat.writes++;
+  fseeko(_file->fp, _file->pos, SEEK_SET);
+  size_t put = fwrite(buf, 1, len, _file->fp);
+  fflush(_file->fp);
+  touch(_file->pos, put, true);
+  walk(_file->pos + put);
+  _file->pos += put;
+  _file->size = std::max(_file->size, _file->pos);
+  _file->dirty = true;
+  SDstat.bytesWritten += put;
+  return put;
+}
+
+bool File::seek(uint32_t pos){
+  if( ! *this) return false;
+  SDstat.seeks++;
+  if(pos > size()) return false;
+  walk(pos);
+  _file->pos = pos;
+  return true;
+}
+
+/*********************************************************************************************************
+ *  walk - follow the cluster chain from the current position to pos, as seekSet() does and as reads
+ *  and writes do crossing into following clusters.  Clusters past the end of the file are allocated.
+ *********************************************************************************************************/
+void File::walk(uint32_t pos){
+  uint32_t clusterSize = SD.clusterSize();
+  if(pos == 0){
+    _file->cluster = 0;
+    return;
+  }
+  uint32_t cluster = (pos - 1) / clusterSize;
+  uint32_t from = 0;
+  if(_file->pos && cluster >= _file->cluster){
+    from = _file->cluster;
+  }
+  uint32_t allocated = (_file->size + clusterSize - 1) / clusterSize;
+  uint32_t end = std::min(cluster, allocated);
+  if(end > from){
+    for(uint32_t block = from / SD_FAT_ENTRIES; block <= (end - 1) / SD_FAT_ENTRIES; block++){
+      fatBlock(block);
+    }
+  }
+  for(uint32_t grow = allocated; grow <= cluster; grow++){
+    fatBlock(grow / SD_FAT_ENTRIES);
+    SDstat.blockWrites += 2;
+  }
+  _file->cluster = cluster;
+}
+
+void File::fatBlock(uint32_t block){
+  uint32_t file = _file->id | 0x80000000UL;
+  if( ! (blockCache.valid && blockCache.file == file && blockCache.block == block)){
+    if(blockCache.dirty){
+      SDstat.blockWrites++;
+    }
+    SDstat.blockReads++;
+    SDstat.fatReads++;
+    blockCache.file = file;
+    blockCache.block = block;
+    blockCache.valid = true;
+    blockCache.dirty = false;
+  }
+}
+
+uint32_t File::position(){
+  return *this ? _file->pos : 0;
+}
+
+uint32_t File::size(){
+  return *this ? _file->size : 0;
+}
+
+int File::available(){
+  return *this ? size() - _file->pos : 0;
+}
+
+void File::flush(){
+  if( ! *this) return;
+  SDstat.flushes++;
+  fflush(_file->fp);
+  if(blockCache.dirty){
+    SDstat.blockWrites++;
+    blockCache.dirty = false;
+  }
+  if(_file->dirty){
+    SDstat.blockReads++;                        // Directory entry read-modify-write
+    SDstat.blockWrites++;
+    blockCache.valid = false;
+    _file->dirty = false;
+  }
+}
+
+void File::close(){
+  if(*this){
+    flush();
+  }
+  _file.reset();
+}
+
+bool File::isDirectory(){
+  return *this && _file->dir;
+}
+
+const char* File::name(){
+  if( ! *this) return "";
+  size_t slash = _file->name.rfind('/');
+  return _file->name.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+File File::openNextFile(uint8_t mode){
+  struct dirent* entry;
+  if( ! isDirectory()) return File();
+  while((entry = readdir(_file->dir))){
+    if(strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")){
+      return SD.open((_file->name + "/" + entry->d_name).c_str(), mode);
+    }
+  }
+  return File();
+}
+
+void File::rewindDirectory(){
+  if(isDirectory()) rewinddir(_file->dir);
+}
+
+bool File::truncate(uint32_t size){
+  if( ! *this) return false;
+  fflush(_file->fp);
+  if(ftruncate(fileno(_file->fp), size)) return false;
+  _file->pos = std::min(_file->pos, size);
+  _file->size = size;
+  _file->dirty = true;
+  walk(_file->pos);
+  return true;
+}
+
+//********************************************************************************************************
+//      SDClass
+//********************************************************************************************************
+
+void SDClass::setRoot(const char* root){
+  _root = root;
+  ::mkdir(root, 0755);
+}
+
+std::string SDClass::hostPath(const char* path){
+  std::string result = _root;
+  if(*path != '/') result += '/';
+  return result + path;
+}
+
+bool SDClass::exists(const char* path){
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool SDClass::mkdir(const char* path){                                  // Makes parents too, as the library does
+  std::string dir = path;
+  for(size_t slash = dir.find('/', 1); slash != std::string::npos; slash = dir.find('/', slash + 1)){
+    ::mkdir(hostPath(dir.substr(0, slash).c_str()).c_str(), 0755);
+  }
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0 || exists(path);
+}
+
+File SDClass::open(const char* path, uint8_t mode){
+  static uint32_t nextId = 1;
+  File file;
+  std::string host = hostPath(path);
+  FILE* fp = nullptr;
+  if(mode == FILE_WRITE){
+    fp = fopen(host.c_str(), "r+b");
+    if( ! fp) fp = fopen(host.c_str(), "w+b");
+  } else {
+    fp = fopen(host.c_str(), "rb");
+  }
+  if( ! fp) return file;
+  setvbuf(fp, nullptr, _IONBF, 0);                                  // Handles share the card, not stdio buffers
+  SDstat.opens++;
+  for(const char* dir = path; dir; dir = strchr(dir + 1, '/')){     // Directory block per level
+    SDstat.blockReads++;
+  }
+  file._file = std::make_shared<File::hostFile>();
+  file._file->fp = fp;
+  file._file->id = nextId++;
+  file._file->name = path;
+  file._file->pos = 0;
+  file._file->cluster = 0;
+  struct stat st;
+  fstat(fileno(fp), &st);
+  file._file->size = st.st_size;
+  file._file->dirty = false;
+  file._file->dir = S_ISDIR(st.st_mode) ? opendir(host.c_str()) : nullptr;
+  if(mode == FILE_WRITE){
+    file.walk(file._file->size);
+    file._file->pos = file._file->size;
+  }
+  return file;
+}
+
+bool SDClass::remove(const char* path){
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool SDClass::rmdir(const char* path){
+  return ::rmdir(hostPath(path).c_str()) == 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*********************************************************************************************************
+ *
+ *      Prelude forced into every bench translation unit (-include).  It defines IotaWatt_h so
+ *      that the firmware's own IotaWatt.h - which drags in WiFi, the web server and the rest of
+ *      the device - is skipped, and declares just the globals the compiled sources reference.
+ *      The sampling globals are defined in host.cpp; the ADCs are the simulator in sampleADC.h.
+ *
+ * *******************************************************************************************************/
+
+#define IotaWatt_h
+
+#include <chrono>                           // Standard headers that use math log() must
+#include <random>                           // come ahead of the log() macro below.
+#include <vector>
+#include "Arduino.h"
+#include "SD.h"
+#include "IotaLog.h"
+#include "IotaInputChannel.h"
+#include "samplePower.h"
+#include "burst.h"
+
+#define LED_DUMPING_LOG "R.G.R..."
+
+#define T_SAMP 8                            // Trace modules
+#define T_POWER 9
+#define T_samplePhase 23
+
+#define ADC_BITS 12
+#define ADC_RANGE 4096
+#define Vadj_3 13                           // Voltage channel attenuation ratio
+#define MAX_SAMPLES 1000
+
+extern uint32_t lastCrossMs;
+extern uint32_t lastCycleStartUs;
+extern uint32_t lastCycleUs;
+extern uint32_t nextCrossMs;
+extern IotaInputChannel* *inputChannel;
+extern uint8_t  maxInputs;
+extern uint8_t  deviceMajorVersion;
+extern uint8_t  deviceMinorVersion;
+extern float    VrefVolts;
+extern float    frequency;
+extern float    samplesPerCycle;
+extern int16_t  cycleSamples;
+extern uint32_t sumVsq;
+extern uint32_t sumIsq;
+extern int64_t  sumVI;
+extern int64_t  sumVQ;
+extern int16_t  samples;
+extern uint16_t harmonicCycles;
+
+#include "sampleADC.h"
+
+class DateTime {
+  public:
+    DateTime(uint32_t t);
+    uint16_t year() const {return _year;}
+    uint8_t  month() const {return _month;}
+    uint8_t  day() const {return _day;}
+    uint8_t  hour() const {return _hour;}
+    uint8_t  minute() const {return _minute;}
+    uint8_t  second() const {return _second;}
+  private:
+    uint16_t _year;
+    uint8_t  _month, _day, _hour, _minute, _second;
+};
+
+uint32_t  UTCtime();
+uint32_t  localTime();
+void      setLedCycle(const char*);
+void      endLedCycle();
+void      hostLog(const char* format, ...) __attribute__ ((format (printf, 1, 2)));
+void      trace(const uint8_t module, const uint8_t id, const uint8_t det=0);
+
+#define log(format,...)  hostLog(format,##__VA_ARGS__)
@@ -0,0 +1,172 @@
+/*
+  sampleADC.cpp - waveform simulator standing in for the ADCs (see sampleADC.h).
+*/
+
+ADCsimulator ADCsim;
+
+#define ADCSIM_AREF_ADDR 8                  // Address of the voltage reference shunt (IotaInputChannel _aRef)
+
+static uint64_t simClock(){
+  return ADCsim.clockUs();
+}
+
+ADCsimulator::ADCsimulator()
+  :Hz(60)
+  ,drift(0)
+  ,conversionUs(13.0)
+  ,dropoutsPerSec(0)
+  ,dropoutUs(0)
+  ,aref(3.3)
+  ,conversions(0)
+  ,dropouts(0)
+  ,_clockUs(0)
+  ,_nextDropoutUs(0)
+  ,_startAddr(0)
+  ,_startValue(0)
+  ,_tapeMode(live)
+  ,_tapeStartUs(0)
+  ,_tapePos(0)
+  ,_gauss(0.0, 1.0)
+  ,_interval(1.0)
+{}
+
+void ADCsimulator::reset(uint32_t seed){
+  for(int i=0; i<ADCSIM_ADDRS; i++){
+    signal[i].clear();
+  }
+  _rng.seed(seed);
+  _clockUs = 0;
+  conversions = 0;
+  dropouts = 0;
+  _tapeMode = live;
+  scheduleDropout();
+  hostClock(simClock);
+}
+
+void ADCsimulator::scheduleDropout(){
+  _nextDropoutUs = dropoutsPerSec > 0 ? _clockUs + _interval(_rng) * 1e6 / dropoutsPerSec : 1e300;
+}
+
+double ADCsimulator::lineHz(){
+  return Hz + drift * _clockUs / 1e6;
+}
+
+double ADCsimulator::value(uint8_t addr){
+  const ADCsignal& sig = signal[addr % ADCSIM_ADDRS];
+  double secs = _clockUs / 1e6;
+  double theta = 2.0 * M_PI * (Hz * secs + drift * secs * secs / 2.0);
+  double v = sig.peak * sin(theta + sig.phase * M_PI / 180.0);
+  for(int n=2; n<ADCSIM_HARMONICS; n++){
+    if(sig.harmonic[n] != 0){
+      v += sig.peak * sig.harmonic[n] * sin(n * theta + sig.harmonicPhase[n] * M_PI / 180.0);
+    }
+  }
+  if(sig.noise > 0){
+    v += sig.noise * _gauss(_rng);
+  }
+  return v + sig.offset;
+}
+
+int16_t ADCsimulator::convert(uint8_t addr){
+  conversions++;
+  if(addr == ADCSIM_AREF_ADDR){
+    return lround(VrefVolts * ADC_RANGE / aref);
+  }
+  return constrain(lround(ADC_RANGE / 2 + value(addr)), 0, ADC_RANGE - 1);
+}
+
+void ADCsimulator::advance(double us){
+  _clockUs += us;
+  if(_clockUs >= _nextDropoutUs){                                   // Sampler interrupted
+    _clockUs += dropoutUs;
+    dropouts++;
+    scheduleDropout();
+  }
+}
+
+//********************************************************************************************************
+//      Record and replay.  tapeConvert is a conversion taking us: live, recorded or replayed.
+//********************************************************************************************************
+void ADCsimulator::record(){
+  _tapeValue.clear();
+  _tapeClock.clear();
+  _tapeStartUs = _clockUs;
+  _tapeMode = recording;
+}
+
+void ADCsimulator::replay(){
+  _clockUs = _tapeStartUs;
+  _tapePos = 0;
+  _tapeMode = replaying;
+}
+
+void ADCsimulator::stop(){
+  _tapeMode = live;
+}
+
+int16_t ADCsimulator::tapeConvert(uint8_t addr, double us){
+  if(_tapeMode == replaying && _tapePos < _tapeValue.size()){
+    _clockUs = _tapeClock[_tapePos];
+    return _tapeValue[_tapePos++];
+  }
+  int16_t reading = convert(addr);
+  advance(us);
+  if(_tapeMode == recording){
+    _tapeValue.push_back(reading);
+    _tapeClock.push_back(_clockUs);
+  }
+  return reading;
+}
+
+//********************************************************************************************************
+//      Analytic values - rms of a signal and mean product of two, excluding noise and offset.
+//********************************************************************************************************
+double ADCsimulator::rms(const ADCsignal& sig){
+  double sumSq = 1.0;
+  for(int n=2; n<ADCSIM_HARMONICS; n++){
+    sumSq += sig.harmonic[n] * sig.harmonic[n];
+  }
+  return sig.peak * sqrt(sumSq / 2.0);
+}
+
+double ADCsimulator::power(const ADCsignal& V, const ADCsignal& I){
+  double sum = cos((V.phase - I.phase) * M_PI / 180.0);
+  for(int n=2; n<ADCSIM_HARMONICS; n++){
+    sum += V.harmonic[n] * I.harmonic[n] * cos((V.harmonicPhase[n] - I.harmonicPhase[n]) * M_PI / 180.0);
+  }
+  return V.peak * I.peak * sum / 2.0;
+}
+
+double ADCsimulator::reactive(const ADCsignal& V, const ADCsignal& I){
+  ADCsignal Vdelayed = V;
+  Vdelayed.phase -= 90.0;
+  for(int n=2; n<ADCSIM_HARMONICS; n++){
+    Vdelayed.harmonicPhase[n] -= n * 90.0;
+  }
+  return power(Vdelayed, I);
+}
+
+//********************************************************************************************************
+//      The sampleADC.h calls.  A select mask is just a bit per ADC.  The conversion is done (and the
+//      clock run) by ADCstart, at the time it starts.
+//********************************************************************************************************
+void ADCbegin(){}
+
+uint32_t ADCselectMask(uint8_t addr){
+  return 1 << (addr >> 3);
+}
+
+void ADCstart(uint32_t selectMask, uint8_t port){
+  ADCsim._startAddr = (__builtin_ctz(selectMask) << 3) | (port & 0x07);
+  ADCsim._startValue = ADCsim.tapeConvert(ADCsim._startAddr, ADCsim.conversionUs);
+}
+
+int16_t ADCfinish(uint32_t /*selectMask*/){
+  return ADCsim._startValue;
+}
+
+void ADCdeselect(uint32_t /*selectMask*/){}
+
+int ADCread(uint8_t addr){
+  return ADCsim.tapeConvert(addr, ADCsim.conversionUs * 3);        // Through the SPI library
+}
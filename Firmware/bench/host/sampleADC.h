@@ -0,0 +1,88 @@
+#pragma once
+
+/*********************************************************************************************************
+ *
+ *      Host stand-in for the firmware's sampleADC.h: the same ADC calls, answered by a waveform
+ *      simulator rather than the MCP3208s.  Each input address is given a signal - fundamental, up to
+ *      ADCSIM_HARMONICS harmonics, noise and a DC offset, in ADC counts - and the simulator runs the
+ *      host's millis() and micros() from its own clock.  Every conversion samples the signal at the
+ *      time it starts and takes conversionUs, so the firmware's crossing detection, sample counts and
+ *      frequency measurement see the timing they would on the device.  Line frequency can drift, and
+ *      dropouts (the sampler being interrupted) skip dropoutUs of signal at random.
+ *
+ *      The analytic functions give what an ideal meter would report for the signals, in counts.
+ *
+ *      To time the sampling code without the cost of the simulation, record() the conversions of a
+ *      run, then replay() puts the clock back and serves the same readings at the same times.
+ *
+ * *******************************************************************************************************/
+
+#define ADCSIM_HARMONICS 16                 // Harmonic orders 2 through 15
+#define ADCSIM_ADDRS 16                     // Two ADCs of eight ports
+
+struct ADCsignal {
+      double  peak;                         // Fundamental peak, counts
+      double  phase;                        // Fundamental phase, degrees lead
+      double  harmonic[ADCSIM_HARMONICS];   // Peak of harmonic n as a fraction of fundamental
+      double  harmonicPhase[ADCSIM_HARMONICS]; // Phase of harmonic n, degrees lead (of its own cycle)
+      double  noise;                        // Gaussian noise, counts rms
+      double  offset;                       // DC offset from mid scale, counts
+      ADCsignal() {clear();}
+      void    clear() {memset(this, 0, sizeof(*this));}
+    };
+
+class ADCsimulator {
+  public:
+    ADCsignal signal[ADCSIM_ADDRS];         // By input address
+    double    Hz;                           // Line frequency at time zero
+    double    drift;                        // Change in line frequency, Hz per second
+    double    conversionUs;                 // Time per conversion
+    double    dropoutsPerSec;               // Mean rate of dropouts
+    double    dropoutUs;                    // Length of each
+    double    aref;                         // Reference voltage that getAref() should find
+    uint32_t  conversions;
+    uint32_t  dropouts;
+
+    ADCsimulator();
+    void      reset(uint32_t seed);         // Clock to zero, signals cleared
+    uint64_t  clockUs() {return _clockUs;}
+    double    lineHz();                     // Line frequency now
+    double    value(uint8_t addr);          // Signal (less mid scale) now, counts
+    int16_t   convert(uint8_t addr);        // A conversion starting now
+    void      advance(double us);           // Run the clock
+    void      record();                     // Start recording conversions
+    void      replay();                     // Back to start of recording and play it
+    void      stop();                       // Stop recording or playing
+
+    static double rms(const ADCsignal& signal);
+    static double power(const ADCsignal& V, const ADCsignal& I);
+    static double reactive(const ADCsignal& V, const ADCsignal& I);   // With V delayed a quarter cycle
+
+  private:
+    double    _clockUs;
+    double    _nextDropoutUs;
+    uint8_t   _startAddr;                   // Address of conversion in progress
+    int16_t   _startValue;                  // Its reading
+    enum {live, recording, replaying} _tapeMode;
+    std::vector<int16_t> _tapeValue;        // Recorded readings
+    std::vector<double>  _tapeClock;        // and clock after each
+    double    _tapeStartUs;
+    size_t    _tapePos;
+    int16_t   tapeConvert(uint8_t addr, double us);
+    std::mt19937 _rng;
+    std::normal_distribution<double> _gauss;
+    std::exponential_distribution<double> _interval;
+    void      scheduleDropout();
+    friend void ADCstart(uint32_t, uint8_t);
+    friend int16_t ADCfinish(uint32_t);
+    friend int ADCread(uint8_t);
+};
+
+extern ADCsimulator ADCsim;
+
+void      ADCbegin();
+uint32_t  ADCselectMask(uint8_t addr);
+void      ADCstart(uint32_t selectMask, uint8_t port);
+int16_t   ADCfinish(uint32_t selectMask);
+void      ADCdeselect(uint32_t selectMask);
+int       ADCread(uint8_t addr);
@@ -0,0 +1,753 @@
+/*********************************************************************************************************
+ *
+ *  iotaLogBench - host benchmark of the IotaLog storage engine.
+ *
+ *  Builds IotaLog.cpp unmodified against the file-backed SD stand-in in host/ and runs the
+ *  access patterns the firmware actually uses against synthetic logs:
+ *
+ *  curr  - 5 second log like currLog, with random outage holes, sized with setDays()
+ *          so that it wraps - or with -segment n, kept in segments of n days, the oldest
+ *          deleted as it fills.  Retention is then also changed with setDays().
+ *  hist  - 60 second log like histLog spanning several years with no holes.
+ *  rep   - damaged copies of a wrapped day of 5 second data, repaired, then the same damage in
+ *          -repairdays of 5 second data (default a year, 0 to skip).
+ *  tail  - uploaders reading back records as they are written, with and without setTail().
+ *
+ *  Records carry -channels inputs (default 15), stored with setChannels() as the firmware does.
+ *  -compress creates hist block compressed, as the firmware does histLog.  Uncompressed logs are
+ *  preallocated -prealloc bytes at a time (0 for none), as the firmware does currLog.
+ *  -cluster sets the FAT cluster size of the card model: smaller clusters make the cluster chains
+ *  of these logs as long as those of larger ones.
+ *
+ *  For each operation it reports wall time, SD calls (seeks, reads), bytes read, card blocks
+ *  transferred and FAT blocks read following cluster chains per operation, along with the log's own
+ *  readKeyIO() count.
+ *
+ *  usage: iotaLogBench [-dir path] [-currdays n] [-currkeep n] [-currholes n] [-segment n] [-histyears n] [-ops n] [-commit n] [-tail n] [-prealloc n] [-cluster n] [-channels n] [-compress] [-repairdays n] [-seed n] [-keep]
+ *
+ * *******************************************************************************************************/
+#include <chrono>
+#include <random>
+#include <vector>
+
+#define BENCH_EPOCH 1483228800UL            // 01/01/2017 00:00:00 UTC
+#define BENCH_REPAIR_MS 20                  // repair() slice, as dataLog
+
+struct benchConfig {
+  const char* dir = "/tmp/iotaLogBench";
+  uint32_t    currDays = 10;                // Days of 5 second data written
+  uint32_t    currKeep = 7;                 // setDays() for the 5 second log (< currDays wraps)
+  double      currHoles = 1.0;              // Outages per day in the 5 second log
+  uint32_t    segment = 0;                  // setSegmentDays() for the 5 second log (0 = one file)
+  uint32_t    histYears = 2;                // Years of 60 second data written
+  uint32_t    ops = 2000;                   // Operations per read test
+  uint32_t    commit = 8;                   // Records per group commit for the write test
+  uint32_t    tail = 300;                   // setTail() seconds for the tail test
+  uint32_t    prealloc = IOTALOG_EXTENT_BYTES;  // setPreallocate() bytes for uncompressed logs
+  uint32_t    cluster = SD_CLUSTER_SIZE;    // FAT cluster size
+  uint32_t    channels = 15;                // Inputs logged
+  bool        compress = false;             // Block compress the hist log
+  uint32_t    repairDays = 365;             // Days of 5 second data for the large repair test
+  uint32_t    seed = 1;
+  bool        keep = false;                 // Don't delete the logs at exit
+};
+
+static benchConfig config;
+static std::mt19937 rng;
+
+/*********************************************************************************************************
+ *  benchTimer - snapshot wall time, SD counters and readKeyIO at start, report the deltas at stop.
+ *  Work between pause() and resume() isn't counted.
+ *********************************************************************************************************/
+class benchTimer {
+  public:
+    benchTimer(IotaLog* log = nullptr) {start(log);}
+    void start(IotaLog* log = nullptr){
+      _log = log;
+      _keyIO = log ? log->readKeyIO() : 0;
+      _io = SDstat;
+      _start = std::chrono::steady_clock::now();
+    }
+    void pause(){
+      _pause = std::chrono::steady_clock::now();
+      _pauseIO = SDstat;
+      _pauseKeyIO = _log ? _log->readKeyIO() : 0;
+    }
+    void resume(){
+      _start += std::chrono::steady_clock::now() - _pause;
+      _io = _io + (SDstat - _pauseIO);
+      _keyIO += _log ? _log->readKeyIO() - _pauseKeyIO : 0;
+    }
+    void stop(const char* logName, const char* opName, uint32_t ops){
+      double usecs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _start).count();
+      SDstats io = SDstat - _io;
+      uint32_t keyIO = _log ? _log->readKeyIO() - _keyIO : 0;
+      if(ops == 0) ops = 1;
+      printf("%-5s %-18s %8u %10.2f %9.2f %9.2f %11.1f %9.2f %9.2f %9.2f %9.2f\n", logName, opName, ops,
+              usecs / ops, (double)io.seeks / ops, (double)io.reads / ops, (double)io.bytesRead / ops,
+              (double)io.blockReads / ops, (double)io.blockWrites / ops, (double)io.fatReads / ops, (double)keyIO / ops);
+    }
+    static void header(){
+      printf("%-5s %-18s %8s %10s %9s %9s %11s %9s %9s %9s %9s\n", "log", "operation", "ops",
+              "us/op", "seeks/op", "reads/op", "bytes/op", "blkrd/op", "blkwr/op", "fatrd/op", "keyIO/op");
+    }
+  private:
+    IotaLog*  _log;
+    uint32_t  _keyIO;
+    SDstats   _io;
+    std::chrono::steady_clock::time_point _start;
+    std::chrono::steady_clock::time_point _pause;
+    SDstats   _pauseIO;
+    uint32_t  _pauseKeyIO;
+};
+
+/*********************************************************************************************************
+ *  sameRecord - records match, to the fixed point resolution of a compressed log.
+ *********************************************************************************************************/
+static bool sameRecord(IotaLogRecord* a, IotaLogRecord* b){
+  if(a->UNIXtime != b->UNIXtime || a->serial != b->serial ||
+     fabs(a->logHours - b->logHours) > 1.0 / IOTALOG_HOURS_SCALE) return false;
+  for(int i=0; i<IOTALOG_CHANNELS; i++){
+    if(fabs(a->accum1[i] - b->accum1[i]) > 1.0 / IOTALOG_ACCUM_SCALE ||
+       fabs(a->accum2[i] - b->accum2[i]) > 1.0 / IOTALOG_ACCUM_SCALE) return false;
+  }
+  return true;
+}
+
+/*********************************************************************************************************
+ *  checkLog - read back the oldest records and the last record written while writing.
+ *  Reading the oldest records caches the pages that the next writes overwrite once the log wraps,
+ *  so stale cached data shows up here as a mismatch.
+ *********************************************************************************************************/
+static uint32_t checkLog(IotaLog* log, IotaLogRecord* check, IotaLogRecord* last){
+  uint32_t errors = 0;
+  int32_t serial = log->firstSerial();
+  for(int32_t i=0; i<2 * IOTALOG_PAGE_BYTES / log->recordSize() && serial + i <= log->lastSerial(); i++){
+    if(log->readSerial(check, serial + i) || check->serial != serial + i) errors++;
+  }
+  if(log->readSerial(check, log->lastSerial()) || ! sameRecord(check, last)) errors++;
+  return errors;
+}
+
+/*********************************************************************************************************
+ *  newLog - an IotaLog storing config.channels inputs.
+ *********************************************************************************************************/
+static IotaLog* newLog(uint32_t interval, uint32_t days, bool compress = false){
+  IotaLog* log = new IotaLog(interval, days);
+  log->setChannels((1UL << config.channels) - 1);
+  log->setCompress(compress);
+  log->setPreallocate(config.prealloc);
+  return log;
+}
+
+/*********************************************************************************************************
+ *  logPath - path of one of the files of a log, single file or segmented.
+ *  removeLog - delete a log's files.
+ *********************************************************************************************************/
+static String logPath(const char* path, const char* ext){
+  File dir = SD.open(path);
+  return String(path) + (dir.isDirectory() ? "/log." : ".") + ext;
+}
+
+static void removeLog(const char* path){
+  const char* ext[] = {"log", "hdr", "ndx", "bix"};
+  for(auto e : ext){
+    SD.remove(String(path) + "." + e);
+  }
+  File dir = SD.open(path);
+  if(dir.isDirectory()){
+    while(File file = dir.openNextFile()){
+      SD.remove(String(path) + "/" + file.name());
+    }
+    SD.rmdir(path);
+  }
+}
+
+/*********************************************************************************************************
+ *  buildLog - write a synthetic log.
+ *  Accumulators grow like real channels.  holesPerDay > 0 introduces outages of 1 to 360 minutes.
+ *********************************************************************************************************/
+static void buildLog(IotaLog* log, const char* name, uint32_t interval, uint32_t span, double holesPerDay){
+  IotaLogRecord* record = new IotaLogRecord;
+  IotaLogRecord* check = new IotaLogRecord;
+  uint32_t errors = 0;
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+  std::uniform_int_distribution<uint32_t> outage(1, 360);
+  double holeChance = holesPerDay * interval / 86400.0;
+  uint32_t records = 0;
+  uint32_t holes = 0;
+  benchTimer timer(log);
+  for(uint32_t key = BENCH_EPOCH; key < BENCH_EPOCH + span; key += interval){
+    if(chance(rng) < holeChance){
+      key += outage(rng) * 60;
+      key -= key % interval;
+      holes++;
+    }
+    double hours = (double)interval / 3600.0;
+    record->UNIXtime = key;
+    record->logHours += hours;
+    for(uint32_t i=0; i<config.channels; i++){
+      record->accum1[i] += (100.0 * (i + 1) + 50.0 * sin(key / 3600.0 + i)) * hours;
+      record->accum2[i] += (120.0 * (i + 1)) * hours;
+    }
+    log->write(record);
+    records++;
+    if(records % 1009 == 0){
+      errors += checkLog(log, check, record);
+    }
+  }
+  timer.stop(name, "write", records);
+  errors += checkLog(log, check, record);
+  delete record;
+  delete check;
+  printf("%-5s %u records, %u holes, %u byte records, file %u bytes, keys %u-%u, serials %d-%d, %u read-back errors\n", name,
+          records, holes, log->recordSize(), log->fileSize(), log->firstKey(), log->lastKey(), log->firstSerial(), log->lastSerial(), errors);
+}
+
+/*********************************************************************************************************
+ *  benchWrite - write a day and 3 records of 5 second data to a new log, flushing each record or with group commit,
+ *  then reopen it without end() - as after a crash - and report the records lost.  A compressed log (reported
+ *  as hist) is the history log catching up.
+ *********************************************************************************************************/
+static void benchWrite(uint32_t commit, bool compress = false){
+  SD.remove("bench/write.log");
+  SD.remove("bench/write.hdr");
+  SD.remove("bench/write.ndx");
+  SD.remove("bench/write.bix");
+  const char* name = compress ? "hist" : "write";
+  char opName[20];
+  snprintf(opName, sizeof(opName), commit > 1 ? "write commit %u" : "write", commit);
+  IotaLog* log = newLog(5, 1, compress);
+  log->begin("bench/write");
+  log->setCommit(commit, commit * 5);
+  IotaLogRecord* record = new IotaLogRecord;
+  IotaLogRecord* check = new IotaLogRecord;
+  uint32_t errors = 0;
+  uint32_t records = 0;
+  benchTimer timer(log);
+  for(uint32_t key = BENCH_EPOCH; key < BENCH_EPOCH + 86400 + 15; key += 5){
+    record->UNIXtime = key;
+    record->logHours += 5.0 / 3600.0;
+    log->write(record);
+    records++;
+    if(records % 1009 == 0){
+      errors += checkLog(log, check, record);
+    }
+  }
+  timer.stop(name, opName, records);
+  errors += checkLog(log, check, record);
+  int32_t lastSerial = log->lastSerial();
+  delete log;
+  log = newLog(5, 1, compress);
+  log->begin("bench/write");
+  printf("%-5s %s: %u read-back errors, %d records lost at restart\n", name, opName, errors, lastSerial - log->lastSerial());
+  delete log;
+  delete record;
+  delete check;
+  SD.remove("bench/write.log");
+  SD.remove("bench/write.hdr");
+  SD.remove("bench/write.ndx");
+  SD.remove("bench/write.bix");
+}
+
+/*********************************************************************************************************
+ *  benchRepair - damage a wrapped day of 5 second data the ways an SD card does, reopen it without
+ *  its header (as after a crash), and time begin() bringing it back.  Damage begin() doesn't see is
+ *  then found by reading the log and mended as dataLog does (repairFound).  The result is checked for
+ *  consecutive serials and keys, and compared with an undamaged copy: only the records replaced
+ *  should differ.
+ *********************************************************************************************************/
+static void writeRepairLog(const char* path, uint32_t records, uint32_t days = 1){
+  IotaLog* log = newLog(5, days);
+  log->begin(path);
+  IotaLogRecord* record = new IotaLogRecord;
+  memset(record->accum1, 0, sizeof(record->accum1));
+  memset(record->accum2, 0, sizeof(record->accum2));
+  for(uint32_t i=0; i<records; i++){
+    record->UNIXtime = BENCH_EPOCH + i * 5;
+    record->logHours += 5.0 / 3600.0;
+    for(uint32_t j=0; j<config.channels; j++){
+      record->accum1[j] += (100.0 * (j + 1) + 50.0 * sin(i / 720.0 + j)) * 5.0 / 3600.0;
+      record->accum2[j] += 120.0 * (j + 1) * 5.0 / 3600.0;
+    }
+    log->write(record);
+  }
+  log->end();
+  delete log;
+  delete record;
+}
+
+static void damage(const char* path, uint32_t pos, uint32_t len, bool garbage){
+  File file = SD.open(path, FILE_WRITE);
+  uint8_t* data = new uint8_t[len];
+  for(uint32_t i=0; i<len; i++){
+    data[i] = garbage ? rng() : 0;
+  }
+  file.seek(pos);
+  file.write(data, len);
+  file.close();
+  delete[] data;
+}
+
+/*********************************************************************************************************
+ *  repairFound - read records first to last as an uploader would, and mend any damage that turns up
+ *  in BENCH_REPAIR_MS slices.  Only the repair is timed, per slice.
+ *********************************************************************************************************/
+static void repairFound(IotaLog* log, const char* name, int32_t first, int32_t last){
+  IotaLogRecord* record = new IotaLogRecord;
+  benchTimer timer(log);
+  timer.pause();
+  uint32_t slices = 0;
+  for(int32_t serial=first; serial<=last; serial++){
+    log->readSerial(record, serial);
+    if(log->repairing()){
+      timer.resume();
+      do {
+        slices++;
+      } while(log->repair(BENCH_REPAIR_MS));
+      timer.pause();
+    }
+  }
+  timer.resume();
+  timer.stop("rep", name, slices);
+  delete record;
+}
+
+static void benchRepair(){
+  const uint32_t records = 17280 * 3 / 2;
+  struct {
+    const char* name;
+    double      where;                      // Fraction of file (< 0: newest record)
+    uint32_t    len;
+    bool        garbage;
+  } cases[] = {{"repair torn tail", -1, 0, false},
+               {"repair bad sector", 0.4, 512, true},
+               {"repair zeroed 4K", 0.7, 4096, false}};
+  writeRepairLog("bench/repref", records);
+  IotaLog* ref = newLog(5, 1);
+  ref->begin("bench/repref");
+  IotaLogRecord* record = new IotaLogRecord;
+  IotaLogRecord* check = new IotaLogRecord;
+  for(auto& c : cases){
+    SD.remove("bench/repair.log");
+    SD.remove("bench/repair.hdr");
+    SD.remove("bench/repair.ndx");
+    writeRepairLog("bench/repair", records);
+    uint32_t recordSize = ref->recordSize();
+    uint32_t size = ref->fileSize();
+    uint32_t pos;
+    uint32_t len = c.len;
+    if(c.where < 0){
+      pos = (ref->lastSerial() * recordSize) % size + recordSize / 2;
+      len = recordSize - recordSize / 2;
+    } else {
+      pos = (uint32_t)(size * c.where) & ~511;
+    }
+    damage("bench/repair.log", IOTALOG_FORMAT_SIZE + pos, len, c.garbage);
+    SD.remove("bench/repair.hdr");
+
+    benchTimer timer;
+    IotaLog* log = newLog(5, 1);
+    log->begin("bench/repair");
+    timer.stop("rep", c.name, 1);
+    repairFound(log, "repair found", log->firstSerial(), log->lastSerial());
+
+    uint32_t inconsistent = 0;
+    uint32_t differ = 0;
+    for(int32_t serial=log->firstSerial(); serial<=log->lastSerial(); serial++){
+      if(log->readSerial(record, serial) || record->serial != serial ||
+         (serial > log->firstSerial() && record->UNIXtime != check->UNIXtime + 5)) inconsistent++;
+      check->UNIXtime = record->UNIXtime;
+    }
+    for(int32_t serial=log->firstSerial(); serial<=log->lastSerial(); serial++){
+      log->readSerial(record, serial);
+      check->UNIXtime = record->UNIXtime;
+      if(ref->readKey(check) || check->UNIXtime != record->UNIXtime || 
+         memcmp(check->accum1, record->accum1, sizeof(record->accum1))) differ++;
+    }
+    printf("rep   %s: %u bytes damaged, %u records replaced, %u inconsistent, %d of %d kept\n", c.name, len,
+            differ, inconsistent, log->lastSerial() - log->firstSerial() + 1, ref->lastSerial() - ref->firstSerial() + 1);
+    delete log;
+  }
+  delete ref;
+  delete record;
+  delete check;
+  const char* files[] = {"bench/repair.log", "bench/repair.hdr", "bench/repair.ndx",
+                         "bench/repref.log", "bench/repref.hdr", "bench/repref.ndx"};
+  for(auto file : files){
+    SD.remove(file);
+  }
+}
+
+/*********************************************************************************************************
+ *  benchRepairYear - the same kinds of damage in -repairdays of 5 second data, where rewriting the
+ *  whole file would take the card many minutes: a bad sector found by a reader with the header
+ *  intact, then a torn newest record reopened without its header.  Each should cost about as much as
+ *  it does in a day of data.  The records around the damage are saved beforehand and checked after.
+ *********************************************************************************************************/
+static void checkYear(IotaLog* log, const char* name, std::vector<IotaLogRecord>& saved, uint32_t len){
+  IotaLogRecord* record = new IotaLogRecord;
+  uint32_t inconsistent = 0;
+  uint32_t differ = 0;
+  uint32_t prevKey = 0;
+  for(auto& check : saved){
+    if(log->readSerial(record, check.serial) || record->serial != check.serial ||
+       (prevKey && record->UNIXtime != prevKey + 5)) inconsistent++;
+    if(record->UNIXtime != check.UNIXtime || memcmp(record->accum1, check.accum1, sizeof(check.accum1))) differ++;
+    prevKey = record->UNIXtime;
+  }
+  printf("rep   %s: %u bytes damaged, %u records replaced, %u inconsistent of %u checked, %d records\n", name, len,
+          differ, inconsistent, (uint32_t)saved.size(), log->lastSerial() - log->firstSerial() + 1);
+  delete record;
+}
+
+static void saveYear(IotaLog* log, std::vector<IotaLogRecord>& saved, int32_t first, int32_t last){
+  saved.clear();
+  IotaLogRecord record;
+  for(int32_t serial=max(first, log->firstSerial()); serial<=min(last, log->lastSerial()); serial++){
+    log->readSerial(&record, serial);
+    saved.push_back(record);
+  }
+}
+
+static void benchRepairYear(){
+  if(config.repairDays == 0){
+    return;
+  }
+  const char* files[] = {"bench/repyear.log", "bench/repyear.hdr", "bench/repyear.ndx"};
+  for(auto file : files){
+    SD.remove(file);
+  }
+  writeRepairLog("bench/repyear", config.repairDays * 17280, config.repairDays);
+  const int32_t around = 256;
+  std::vector<IotaLogRecord> saved;
+
+        // A bad sector in the middle, found by a reader.
+
+  IotaLog* log = newLog(5, config.repairDays);
+  log->begin("bench/repyear");
+  uint32_t recordSize = log->recordSize();
+  uint32_t pos = (uint32_t)(log->fileSize() * 0.4) & ~511;
+  int32_t serial = log->firstSerial() + pos / recordSize;
+  saveYear(log, saved, serial - around, serial + around);
+  log->end();
+  delete log;
+  damage("bench/repyear.log", IOTALOG_FORMAT_SIZE + pos, 512, true);
+
+  benchTimer timer;
+  log = newLog(5, config.repairDays);
+  log->begin("bench/repyear");
+  timer.stop("rep", "year begin", 1);
+  repairFound(log, "year bad sector", serial - around, serial + around);
+  checkYear(log, "year bad sector", saved, 512);
+
+        // The newest record torn by a crash, reopened without the header.
+
+  serial = log->lastSerial();
+  pos = (uint32_t)(serial - log->firstSerial()) * recordSize;
+  saveYear(log, saved, serial - around, serial);
+  log->end();
+  delete log;
+  damage("bench/repyear.log", IOTALOG_FORMAT_SIZE + pos + recordSize / 2, recordSize - recordSize / 2, false);
+  SD.remove("bench/repyear.hdr");
+
+  timer.start();
+  log = newLog(5, config.repairDays);
+  log->begin("bench/repyear");
+  timer.stop("rep", "year torn tail", 1);
+  checkYear(log, "year torn tail", saved, recordSize - recordSize / 2);
+  delete log;
+
+  for(auto file : files){
+    SD.remove(file);
+  }
+}
+
+/*********************************************************************************************************
+ *  benchTail - steady state uploading: after each 5 second record is written, three uploaders
+ *  (influx, Emoncms, PVoutput-like) read back recent records through their own cursors.  Only the
+ *  reads are timed.  The log is primed with a day so that it has wrapped.
+ *********************************************************************************************************/
+static void benchTail(uint32_t tail){
+  SD.remove("bench/tail.log");
+  SD.remove("bench/tail.hdr");
+  SD.remove("bench/tail.ndx");
+  char opName[20];
+  snprintf(opName, sizeof(opName), "upload tail %u", tail);
+  IotaLog* log = newLog(5, 1);
+  log->begin("bench/tail");
+  log->setTail(tail);
+  IotaLogRecord* record = new IotaLogRecord;
+  IotaLogRecord* check = new IotaLogRecord;
+  uint32_t key = BENCH_EPOCH;
+  for(; key < BENCH_EPOCH + 86400; key += 5){
+    record->UNIXtime = key;
+    record->logHours += 5.0 / 3600.0;
+    log->write(record);
+  }
+  const int readers = 3;
+  const uint32_t lag[readers] = {5, 10, 60};          // Seconds behind the newest record
+  IotaLogCursor* cursor[readers];
+  for(int i=0; i<readers; i++){
+    cursor[i] = new IotaLogCursor(*log);
+  }
+  uint32_t errors = 0;
+  benchTimer timer(log);
+  for(uint32_t i=0; i<config.ops; i++, key += 5){
+    timer.pause();
+    record->UNIXtime = key;
+    record->logHours += 5.0 / 3600.0;
+    log->write(record);
+    timer.resume();
+    for(int j=0; j<readers; j++){
+      check->UNIXtime = key - lag[j] + 5;
+      if(cursor[j]->readKey(check) || check->serial != record->serial - (int32_t)((lag[j] - 5) / 5)) errors++;
+    }
+  }
+  timer.stop("tail", opName, config.ops * readers);
+  printf("%-5s %s: %u read errors\n", "tail", opName, errors);
+  for(int i=0; i<readers; i++){
+    delete cursor[i];
+  }
+  delete log;
+  delete record;
+  delete check;
+  SD.remove("bench/tail.log");
+  SD.remove("bench/tail.hdr");
+  SD.remove("bench/tail.ndx");
+}
+
+/*********************************************************************************************************
+ *  benchLog - open an existing log and run the read patterns against it.
+ *********************************************************************************************************/
+static void benchLog(const char* name, const char* path, uint32_t interval, uint32_t days, uint32_t step){
+  IotaLogRecord* record = new IotaLogRecord;
+  uint32_t ops = config.ops;
+
+      // begin() - cold open, as at startup, with the header and hole index and with neither,
+      // which scans the log and rebuilds the index.
+
+  String headerPath = logPath(path, "hdr");
+  String indexPath = logPath(path, "ndx");
+  String blockPath = logPath(path, "bix");
+  String segmentPath = String(path) + IOTALOG_SEGMENT_INDEX;
+  const int opens = 5;
+  benchTimer timer;
+  for(int scan=0; scan<2; scan++){
+    timer.start();
+    for(int i=0; i<opens; i++){
+      if(scan){
+        SD.remove(headerPath.c_str());
+        SD.remove(indexPath.c_str());
+        SD.remove(blockPath.c_str());
+        SD.remove(segmentPath.c_str());
+      }
+      IotaLog* log = newLog(interval, days);
+      try {
+        log->begin(path);
+      }
+      catch(hostRestart&) {
+        printf("%-5s begin() requested restart\n", name);
+      }
+      delete log;
+    }
+    timer.stop(name, scan ? "begin (rebuild)" : "begin", opens);
+  }
+
+  IotaLog* log = newLog(interval, days);
+  log->begin(path);
+  uint32_t firstKey = log->firstKey();
+  uint32_t lastKey = log->lastKey();
+  int32_t firstSerial = log->firstSerial();
+  int32_t lastSerial = log->lastSerial();
+  uint32_t keys = (lastKey - firstKey) / interval;
+
+      // readKey random - scattered single lookups.
+
+  std::uniform_int_distribution<uint32_t> randomKey(0, keys);
+  timer.start(log);
+  for(uint32_t i=0; i<ops; i++){
+    record->UNIXtime = firstKey + randomKey(rng) * interval;
+    log->readKey(record);
+  }
+  timer.stop(name, "readKey random", ops);
+
+      // readKey sweep - a graph across the whole log (~800 points).
+
+  uint32_t sweep = ((lastKey - firstKey) / 800 / interval + 1) * interval;
+  uint32_t count = 0;
+  timer.start(log);
+  for(uint32_t key=firstKey; key<=lastKey; key+=sweep){
+    record->UNIXtime = key;
+    log->readKey(record);
+    count++;
+  }
+  timer.stop(name, "readKey sweep", count);
+
+      // readKey catch-up - an uploader stepping through consecutive intervals.
+
+  uint32_t start = firstKey + randomKey(rng) * interval / 2;
+  timer.start(log);
+  for(uint32_t i=0; i<ops; i++){
+    record->UNIXtime = start + i * step;
+    log->readKey(record);
+  }
+  timer.stop(name, "readKey catch-up", ops);
+
+      // readRange - the same keys as one range, then the whole log checked against readKey().
+
+  timer.start(log);
+  count = log->readRange(record, start, start + (ops - 1) * step, step, [](IotaLogRecord*, int){return true;});
+  timer.stop(name, "readRange", count);
+
+  IotaLogCursor* checkCursor = new IotaLogCursor(*log);
+  IotaLogRecord* check = new IotaLogRecord;
+  uint32_t errors = 0;
+  count = log->readRange(record, firstKey - 7 * step, lastKey + 7 * step, 7 * step, [&](IotaLogRecord* record, int rtc){
+    check->UNIXtime = record->UNIXtime;
+    if(checkCursor->readKey(check) != rtc || ! sameRecord(check, record)) errors++;
+    return true;
+  });
+  printf("%-5s readRange: %u keys, %u differ from readKey\n", name, count, errors);
+  delete checkCursor;
+  delete check;
+
+      // readSerial random and sequential.
+
+  std::uniform_int_distribution<int32_t> randomSerial(firstSerial, lastSerial);
+  timer.start(log);
+  for(uint32_t i=0; i<ops; i++){
+    log->readSerial(record, randomSerial(rng));
+  }
+  timer.stop(name, "readSerial random", ops);
+
+  int32_t serial = firstSerial + (lastSerial - firstSerial) / 3;
+  timer.start(log);
+  for(uint32_t i=0; i<ops; i++){
+    log->readSerial(record, serial + i);
+  }
+  timer.stop(name, "readSerial seq", ops);
+
+      // readNext - forward scan.
+
+  log->readSerial(record, serial);
+  count = 0;
+  timer.start(log);
+  for(uint32_t i=0; i<ops; i++){
+    if(log->readNext(record)) break;
+    count++;
+  }
+  timer.stop(name, "readNext", count);
+
+      // Interleaved readers - three uploaders catching up from different points, one record
+      // each in turn, first all through the log's own cursor then each with its own.
+
+  const int readers = 3;
+  uint32_t readerKey[readers];
+  for(int shared=1; shared>=0; shared--){
+    IotaLogCursor* cursor[readers];
+    for(int i=0; i<readers; i++){
+      cursor[i] = shared ? nullptr : new IotaLogCursor(*log);
+      readerKey[i] = firstKey + (i + 1) * (lastKey - firstKey) / (readers + 1);
+      readerKey[i] -= readerKey[i] % interval;
+    }
+    timer.start(log);
+    for(uint32_t i=0; i<ops; i++){
+      int reader = i % readers;
+      record->UNIXtime = readerKey[reader];
+      if(shared) log->readKey(record);
+      else cursor[reader]->readKey(record);
+      readerKey[reader] += interval;
+    }
+    timer.stop(name, shared ? "interleave shared" : "interleave cursors", ops);
+    for(int i=0; i<readers; i++){
+      delete cursor[i];
+    }
+  }
+
+  delete log;
+  delete record;
+}
+
+/*********************************************************************************************************
+ *  benchRetention - halve the retention of a segmented log with setDays().
+ *********************************************************************************************************/
+static void benchRetention(const char* name, const char* path, uint32_t interval, uint32_t days){
+  IotaLog* log = newLog(interval, days);
+  log->begin(path);
+  int32_t firstSerial = log->firstSerial();
+  benchTimer timer(log);
+  log->setDays(days / 2);
+  timer.stop(name, "setDays", 1);
+  printf("%-5s setDays %u: %d records dropped, keys %u-%u, file %u bytes\n", name, days / 2,
+          log->firstSerial() - firstSerial, log->firstKey(), log->lastKey(), log->fileSize());
+  delete log;
+}
+
+int main(int argc, char** argv){
+  for(int i=1; i<argc; i++){
+    String arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i+1] : "";
+    if(arg == "-dir") {config.dir = value; i++;}
+    else if(arg == "-currdays") {config.currDays = atoi(value); i++;}
+    else if(arg == "-currkeep") {config.currKeep = atoi(value); i++;}
+    else if(arg == "-currholes") {config.currHoles = atof(value); i++;}
+    else if(arg == "-segment") {config.segment = atoi(value); i++;}
+    else if(arg == "-histyears") {config.histYears = atoi(value); i++;}
+    else if(arg == "-commit") {config.commit = atoi(value); i++;}
+    else if(arg == "-tail") {config.tail = atoi(value); i++;}
+    else if(arg == "-prealloc") {config.prealloc = atoi(value); i++;}
+    else if(arg == "-cluster") {config.cluster = atoi(value); i++;}
+    else if(arg == "-compress") {config.compress = true;}
+    else if(arg == "-channels") {config.channels = constrain(atoi(value), 1, IOTALOG_CHANNELS); i++;}
+    else if(arg == "-ops") {config.ops = atoi(value); i++;}
+    else if(arg == "-repairdays") {config.repairDays = atoi(value); i++;}
+    else if(arg == "-seed") {config.seed = atoi(value); i++;}
+    else if(arg == "-keep") {config.keep = true;}
+    else {
+      fprintf(stderr, "usage: %s [-dir path] [-currdays n] [-currkeep n] [-currholes n] [-segment n] [-histyears n] [-ops n] [-commit n] [-tail n] [-prealloc n] [-cluster n] [-channels n] [-compress] [-repairdays n] [-seed n] [-keep]\n", argv[0]);
+      return 1;
+    }
+  }
+  rng.seed(config.seed);
+  SD.setRoot(config.dir);
+  SD.setClusterSize(config.cluster);
+  removeLog("bench/curr");
+  removeLog("bench/hist");
+  Serial.quiet(true);
+
+  benchTimer::header();
+
+  benchWrite(1);
+  benchWrite(config.commit);
+  benchWrite(1, true);
+  benchWrite(config.commit, true);
+  benchRepair();
+  benchRepairYear();
+  benchTail(0);
+  benchTail(config.tail);
+
+  IotaLog* curr = newLog(5, config.currKeep);
+  curr->setSegmentDays(config.segment);
+  curr->begin("bench/curr");
+  buildLog(curr, "curr", 5, config.currDays * 86400, config.currHoles);
+  delete curr;
+
+  IotaLog* hist = newLog(60, 3652, config.compress);
+  hist->begin("bench/hist");
+  buildLog(hist, "hist", 60, config.histYears * 365 * 86400, 0.0);
+  delete hist;
+
+  benchLog("curr", "bench/curr", 5, config.currKeep, 10);
+  benchLog("hist", "bench/hist", 60, 3652, 60);
+  if(config.segment){
+    benchRetention("curr", "bench/curr", 5, config.currKeep);
+  }
+
+  if( ! config.keep){
+    removeLog("bench/curr");
+    removeLog("bench/hist");
+    SD.rmdir("bench");
+  }
+  return 0;
+}
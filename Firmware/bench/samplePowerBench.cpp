@@ -0,0 +1,629 @@
+/*********************************************************************************************************
+ *
+ *  samplePowerBench - host benchmark of the power sampling code.
+ *
+ *  Builds samplePower.cpp and iotaInputChannel.cpp unmodified against the ADC simulator in host/
+ *  (sampleADC.h) and samples a voltage channel and a power channel the way Loop does, alternately,
+ *  through a set of synthetic line conditions: 50 and 60Hz, lagging loads, harmonics, noise, DC
+ *  offset, frequency drift, dropouts, a light load, CT phase lead and 3 phase voltage references.
+ *  The readings are compared with the values an ideal meter would give for the simulated signals.
+ *  A few warmup cycles settle the offsets and phase estimate first.
+ *
+ *  For each case it reports cycles sampled, cycles rejected by sampleCycle, samples per cycle, host
+ *  time per power cycle, then the mean and worst error of Vrms, Irms and VA (percent), Watts and VAR
+ *  (percent of VA, so that a low power factor doesn't inflate them) and Hz (mHz).  True VAR is that
+ *  of the voltage delayed a quarter cycle, harmonics and all, as sampleCycle measures it.  The time is that of replaying
+ *  each power cycle's recorded conversions (ADCsimulator::replay), so it is the sampling code's alone.
+ *
+ *  Then it compares phase correction methods on one cycle of samples at 50 and 60Hz: the float
+ *  linear interpolation samplePower used to do, Q15 linear interpolation, and the Q15 fractional
+ *  delay filter (buildPhaseFIR) that sampleCycle uses.  For each it reports host time per sample
+ *  and the worst phase (degrees of the harmonic) and amplitude (percent) error of the delayed
+ *  fundamental, 5th and 15th harmonics over a range of fractional delays.
+ *
+ *  Then harmonic analysis (analyseHarmonics) of every cycle of a distorted load at 50 and 60Hz: the
+ *  mean and worst error of voltage and current THD (percent of fundamental, absolute) and of the 3rd
+ *  and 5th harmonic of current, and host time per analysis of a cycle of voltage and current.
+ *
+ *  Then it samples one to MAX_CYCLE_CTS power channels in the same cycle (samplePowers), each with
+ *  its own load lag and CT lead, and reports samples per cycle, host time per channel and the mean
+ *  and worst Watts error of each channel.
+ *
+ *  Last, a burst capture (burst.cpp) triggered by a step in load, with and without raw samples, to
+ *  SD in -dir, giving the Loop BENCH_LOOP_US between slices: cycles captured and rejected, mean and
+ *  worst time between cycles (line cycles), file bytes, SD writes, and watts before the step (true and as the burst header has it) and after it
+ *  (true, first and last cycle of the burst).
+ *
+ *  usage: samplePowerBench [-cycles n] [-conversion us] [-seed n] [-dir path]
+ *
+ * *******************************************************************************************************/
+#include <chrono>
+#include <random>
+
+#define BENCH_VCAL 12.0                     // Line volts per volt of VT calibration (VT)
+#define BENCH_ICAL 20.0                     // Power channel calibration (CT amps per ADC volt)
+#define BENCH_LOOP_US 20000                 // Web server and a service between burst slices
+
+struct benchConfig {
+  uint32_t    cycles = 300;                 // Power cycles sampled per case
+  uint32_t    warmup = 3;                   // Cycles sampled before those
+  double      conversionUs = 13.0;          // Time per ADC conversion
+  uint32_t    seed = 1;
+  const char* dir = "/tmp/samplePowerBench";  // SD root for burst files
+};
+
+static benchConfig config;
+
+/*********************************************************************************************************
+ *  benchCase - line conditions: volts and amps rms of the fundamental, amps lag in degrees and the
+ *  rest as ADCsimulator.  ctLead is a phase lead added by the CT (and configured as its correction),
+ *  vphase the phase the load's voltage lags the reference voltage (configured likewise).
+ *********************************************************************************************************/
+struct benchCase {
+  const char* name;
+  double      Hz;
+  double      volts;
+  double      amps;
+  double      lag;
+  double      drift = 0;
+  double      noise = 0;
+  double      Voffset = 0;
+  double      Ioffset = 0;
+  double      dropoutsPerSec = 0;
+  double      dropoutUs = 0;
+  bool        harmonics = false;
+  double      ctLead = 0;
+  double      vphase = 0;
+};
+
+/*********************************************************************************************************
+ *  benchError - running mean and worst of an error.
+ *********************************************************************************************************/
+struct benchError {
+  double      sum = 0;
+  double      worst = 0;
+  uint32_t    count = 0;
+  void        add(double error) {sum += error; count++; if(fabs(error) > fabs(worst)) worst = error;}
+  double      mean() {return count ? sum / count : 0;}
+};
+
+/*********************************************************************************************************
+ *  benchChannels - a voltage channel (0) and a power channel (1) on it, as getConfig sets them up.
+ *********************************************************************************************************/
+static void benchChannels(){
+  maxInputs = 15;
+  inputChannel = new IotaInputChannel*[maxInputs];
+  for(int i=0; i<maxInputs; i++){
+    inputChannel[i] = new IotaInputChannel(i);
+  }
+  inputChannel[0]->_type = channelTypeVoltage;
+  inputChannel[0]->active(true);
+  inputChannel[1]->_type = channelTypePower;
+  inputChannel[1]->_calibration = BENCH_ICAL;
+  inputChannel[1]->_vchannel = 0;
+  inputChannel[1]->active(true);
+  for(int i=2; i<=MAX_CYCLE_CTS; i++){                            // More on it for samplePowers
+    inputChannel[i]->_type = channelTypePower;
+    inputChannel[i]->_calibration = BENCH_ICAL;
+    inputChannel[i]->_vchannel = 0;
+    inputChannel[i]->active(true);
+  }
+  buildPhaseFIR();
+}
+
+/*********************************************************************************************************
+ *  runCase - sample a case for config.cycles power cycles and report it.
+ *********************************************************************************************************/
+static void runCase(const benchCase& test){
+  IotaInputChannel* Vchannel = inputChannel[0];
+  IotaInputChannel* Ichannel = inputChannel[1];
+  Vchannel->_calibration = test.volts / BENCH_VCAL;                  // A VT for the line voltage
+  Vchannel->_offset = Ichannel->_offset = ADC_RANGE / 2;
+  Ichannel->_phase = test.ctLead;
+  Ichannel->_vphase = test.vphase;
+  Vchannel->dataBucket.Hz = test.Hz;
+  frequency = test.Hz;
+
+  ADCsim.Hz = test.Hz;
+  ADCsim.drift = test.drift;
+  ADCsim.conversionUs = config.conversionUs;
+  ADCsim.dropoutsPerSec = test.dropoutsPerSec;
+  ADCsim.dropoutUs = test.dropoutUs;
+  ADCsim.reset(config.seed);
+
+  double Vratio = Vchannel->_calibration * Vadj_3 * getAref(0) / double(ADC_RANGE);
+  double Iratio = BENCH_ICAL * getAref(1) / double(ADC_RANGE);
+  ADCsignal& V = ADCsim.signal[Vchannel->_addr];
+  ADCsignal& I = ADCsim.signal[Ichannel->_addr];
+  V.peak = test.volts * sqrt(2.0) / Vratio;
+  I.peak = test.amps * sqrt(2.0) / Iratio;
+  I.phase = -test.vphase - test.lag + test.ctLead;
+  V.noise = I.noise = test.noise;
+  V.offset = test.Voffset;
+  I.offset = test.Ioffset;
+  if(test.harmonics){
+    V.harmonic[3] = 0.03;
+    V.harmonic[5] = 0.02;
+    I.harmonic[3] = 0.30;
+    I.harmonicPhase[3] = 20;
+    I.harmonic[5] = 0.15;
+    I.harmonicPhase[5] = -40;
+    I.harmonic[7] = 0.08;
+    I.harmonic[9] = 0.05;
+  }
+  double trueVrms = Vratio * ADCsimulator::rms(V);
+  double trueIrms = Iratio * ADCsimulator::rms(I);
+  ADCsignal Vload = V;                                              // What the load sees
+  ADCsignal Iload = I;
+  Vload.phase -= test.vphase;
+  Iload.phase -= test.ctLead;
+  double trueWatts = Vratio * Iratio * ADCsimulator::power(Vload, Iload);
+  double trueVAR = Vratio * Iratio * ADCsimulator::reactive(Vload, Iload);
+  double trueVA = trueVrms * trueIrms;
+
+  for(uint32_t cycle=0; cycle<config.warmup; cycle++){
+    samplePower(0, 0);
+    samplePower(1, 0);
+  }
+
+  benchError Verror, Ierror, Werror, VARerror, VAerror, Hzerror;
+  uint32_t rejects = 0;
+  uint32_t sampleCount = 0;
+  double usecs = 0;
+  for(uint32_t cycle=0; cycle<config.cycles; cycle++){
+    int16_t before = cycleSamples;
+    samplePower(0, 0);
+    if(cycleSamples != before){
+      Verror.add(100.0 * (Vchannel->dataBucket.volts - trueVrms) / trueVrms);
+      Hzerror.add(1000.0 * (Vchannel->dataBucket.Hz - ADCsim.lineHz()));
+    }
+    before = cycleSamples;
+    ADCsim.record();
+    samplePower(1, 0);
+    ADCsim.stop();
+    bool rejected = cycleSamples == before;
+    double watts = Ichannel->dataBucket.watts;
+    double VA = Ichannel->dataBucket.VA;
+    double VAR = Ichannel->dataBucket.value4;
+    double Irms = Iratio * sqrt((double)sumIsq / samples);
+    int16_t cycleSampleCount = samples;
+
+    ADCsim.replay();                                              // Again for the time
+    auto start = std::chrono::steady_clock::now();
+    samplePower(1, 0);
+    usecs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    ADCsim.stop();
+    if(rejected){
+      rejects++;
+      continue;
+    }
+    sampleCount += cycleSampleCount;
+    Ierror.add(100.0 * (Irms - trueIrms) / trueIrms);
+    Werror.add(100.0 * (watts - trueWatts) / trueVA);
+    VARerror.add(100.0 * (VAR - trueVAR) / trueVA);
+    VAerror.add(100.0 * (VA - trueVA) / trueVA);
+  }
+  uint32_t good = config.cycles - rejects;
+  printf("%-12s %6u %6u %7.1f %8.2f  %6.3f %6.3f  %6.3f %6.3f  %6.3f %6.3f  %6.3f %6.3f  %6.3f %6.3f  %6.1f %6.1f\n",
+          test.name, config.cycles, rejects, good ? (double)sampleCount / good : 0.0, usecs / config.cycles,
+          Verror.mean(), Verror.worst, Ierror.mean(), Ierror.worst, Werror.mean(), Werror.worst,
+          VARerror.mean(), VARerror.worst, VAerror.mean(), VAerror.worst, Hzerror.mean(), Hzerror.worst);
+}
+
+/*********************************************************************************************************
+ *  Phase correction methods.  Each sums V delayed by shift + fraction samples times I over a cycle of
+ *  samples, wrapping around the cycle, as the sampling code does.  fraction is in 0-1.
+ *********************************************************************************************************/
+static int64_t floatLinear(const int16_t* V, const int16_t* I, int n, int shift, double fraction){
+  float stepFraction = fraction;
+  int64_t sumVI = 0;
+  int Vindex = (n + shift) % n;
+  for(int i=0; i<n; i++){
+    int16_t rawV = V[Vindex];
+    rawV += int(stepFraction * (V[Vindex + 1] - V[Vindex]));                 // V[n] is V[0]
+    sumVI += rawV * I[i];
+    Vindex = (Vindex + 1) % n;
+  }
+  return sumVI;
+}
+
+static int64_t Q15linear(const int16_t* V, const int16_t* I, int n, int shift, double fraction){
+  int32_t Q15 = fraction * 32768.0;
+  int64_t sumVI = 0;
+  for(int i=0; i<n; i++){
+    int Vindex = i + shift;
+    if(Vindex >= n) Vindex -= n;
+    int16_t rawV = V[Vindex];
+    rawV += (Q15 * (V[Vindex + 1] - rawV) + 16384) >> 15;
+    sumVI += rawV * I[i];
+  }
+  return sumVI;
+}
+
+static int64_t Q15FIR(const int16_t* V, const int16_t* I, int n, int shift, double fraction){
+  const int16_t* coef = phaseFIR + int(fraction * PHASE_FIR_STEPS) * PHASE_FIR_TAPS;
+  int32_t coef0 = coef[0], coef1 = coef[1], coef2 = coef[2], coef3 = coef[3];
+  int64_t sumVI = 0;
+  for(int i=0; i<n; i++){
+    int Vindex = i + shift;
+    if(Vindex >= n) Vindex -= n;
+    const int16_t* Vp = V + Vindex;                                             // V[-1] is V[n-1]
+    int32_t rawV = coef0 * Vp[-1] + coef1 * Vp[0] + coef2 * Vp[1] + coef3 * Vp[2];
+    sumVI += ((rawV + 16384) >> 15) * I[i];
+  }
+  return sumVI;
+}
+
+/*********************************************************************************************************
+ *  benchPhase - time and accuracy of a phase correction method with n samples per cycle.
+ *  Accuracy is measured by correlating the corrected voltage with a sine and a cosine (I) of each
+ *  harmonic.
+ *********************************************************************************************************/
+static void benchPhase(const char* name, int64_t (*method)(const int16_t*, const int16_t*, int, int, double),
+                       double Hz, int n){
+  const int harmonics[] = {1, 5, 15};
+  const int shift = 3;
+  const double peak = 1800;
+  std::vector<int16_t> Vbuf(n + 3);
+  std::vector<int16_t> Isin(n), Icos(n);
+  int16_t* V = Vbuf.data() + 1;
+
+  printf("%-12s %4.0f %5d", name, Hz, n);
+  for(int harmonic : harmonics){
+    double worstPhase = 0, worstAmp = 0;
+    double omega = 2.0 * M_PI * harmonic / n;
+    for(int i=-1; i<n+2; i++){
+      V[i] = lround(peak * sin(omega * i));
+    }
+    for(int i=0; i<n; i++){
+      Isin[i] = lround(16384 * sin(omega * i));
+      Icos[i] = lround(16384 * cos(omega * i));
+    }
+    for(double fraction=0.05; fraction<1.0; fraction+=0.1){
+      double a = method(V, Isin.data(), n, shift, fraction) / (16384.0 * n / 2);
+      double b = method(V, Icos.data(), n, shift, fraction) / (16384.0 * n / 2);
+      double phase = atan2(b, a) * 180.0 / M_PI;
+      double expected = omega * (shift + fraction) * 180.0 / M_PI;
+      double phaseError = remainder(phase - expected, 360.0);
+      double ampError = 100.0 * (sqrt(a * a + b * b) - peak) / peak;
+      if(fabs(phaseError) > fabs(worstPhase)) worstPhase = phaseError;
+      if(fabs(ampError) > fabs(worstAmp)) worstAmp = ampError;
+    }
+    printf("  %8.4f %7.3f", worstPhase, worstAmp);
+  }
+
+  const int reps = 20000;
+  volatile int64_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(int rep=0; rep<reps; rep++){
+    sum += method(V, Isin.data(), n, shift + (rep & 1), 0.05 + (rep & 7) * 0.1);
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("  %8.2f\n", ns / reps / n);
+}
+
+/*********************************************************************************************************
+ *  benchCTs - sample count power channels per cycle with samplePowers and report it.
+ *********************************************************************************************************/
+static void benchCTs(double Hz, double volts, int count){
+  const double lag[MAX_CYCLE_CTS] = {30.0, 0.0, 60.0};
+  const double ctLead[MAX_CYCLE_CTS] = {1.5, 3.0, 0.5};
+  IotaInputChannel* Vchannel = inputChannel[0];
+  Vchannel->_calibration = volts / BENCH_VCAL;
+  Vchannel->_offset = ADC_RANGE / 2;
+  Vchannel->dataBucket.Hz = Hz;
+  frequency = Hz;
+  ADCsim.Hz = Hz;
+  ADCsim.drift = 0;
+  ADCsim.conversionUs = config.conversionUs;
+  ADCsim.dropoutsPerSec = 0;
+  ADCsim.reset(config.seed);
+
+  double Vratio = Vchannel->_calibration * Vadj_3 * getAref(0) / double(ADC_RANGE);
+  double Iratio = BENCH_ICAL * getAref(1) / double(ADC_RANGE);
+  ADCsignal& V = ADCsim.signal[Vchannel->_addr];
+  V.peak = volts * sqrt(2.0) / Vratio;
+  int channels[MAX_CYCLE_CTS];
+  double trueWatts[MAX_CYCLE_CTS];
+  double trueVA[MAX_CYCLE_CTS];
+  for(int i=0; i<count; i++){
+    IotaInputChannel* Ichannel = inputChannel[i + 1];
+    channels[i] = i + 1;
+    Ichannel->_offset = ADC_RANGE / 2;
+    Ichannel->_phase = ctLead[i];
+    Ichannel->_vphase = 0;
+    ADCsignal& I = ADCsim.signal[Ichannel->_addr];
+    I.peak = 10.0 * sqrt(2.0) / Iratio;
+    I.phase = ctLead[i] - lag[i];
+    ADCsignal Iload = I;
+    Iload.phase -= ctLead[i];
+    trueWatts[i] = Vratio * Iratio * ADCsimulator::power(V, Iload);
+    trueVA[i] = Vratio * ADCsimulator::rms(V) * Iratio * ADCsimulator::rms(I);
+  }
+
+  for(uint32_t cycle=0; cycle<config.warmup; cycle++){
+    samplePowers(channels, count);
+  }
+
+  benchError Werror[MAX_CYCLE_CTS];
+  uint32_t rejects = 0;
+  uint32_t sampleCount = 0;
+  double usecs = 0;
+  for(uint32_t cycle=0; cycle<config.cycles; cycle++){
+    int16_t before = cycleSamples;
+    ADCsim.record();
+    samplePowers(channels, count);
+    ADCsim.stop();
+    bool rejected = cycleSamples == before;
+    double watts[MAX_CYCLE_CTS];
+    for(int i=0; i<count; i++){
+      watts[i] = inputChannel[i + 1]->dataBucket.watts;
+    }
+    int16_t cycleSampleCount = samples;
+
+    ADCsim.replay();
+    auto start = std::chrono::steady_clock::now();
+    samplePowers(channels, count);
+    usecs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    ADCsim.stop();
+    if(rejected){
+      rejects++;
+      continue;
+    }
+    sampleCount += cycleSampleCount;
+    for(int i=0; i<count; i++){
+      Werror[i].add(100.0 * (watts[i] - trueWatts[i]) / trueVA[i]);
+    }
+  }
+  uint32_t good = config.cycles - rejects;
+  printf("%4.0f %3d %6u %7.1f %8.2f", Hz, count, rejects, good ? (double)sampleCount / good : 0.0,
+          usecs / config.cycles / count);
+  for(int i=0; i<count; i++){
+    printf("  %6.3f %6.3f", Werror[i].mean(), Werror[i].worst);
+  }
+  printf("\n");
+}
+
+/*********************************************************************************************************
+ *  benchHarmonics - analyse every cycle of a distorted load and report it.
+ *********************************************************************************************************/
+static void benchHarmonics(double Hz, double volts){
+  IotaInputChannel* Vchannel = inputChannel[0];
+  IotaInputChannel* Ichannel = inputChannel[1];
+  Vchannel->_calibration = volts / BENCH_VCAL;
+  Vchannel->_offset = Ichannel->_offset = ADC_RANGE / 2;
+  Ichannel->_phase = 0;
+  Ichannel->_vphase = 0;
+  Vchannel->dataBucket.Hz = Hz;
+  frequency = Hz;
+  ADCsim.Hz = Hz;
+  ADCsim.drift = 0;
+  ADCsim.conversionUs = config.conversionUs;
+  ADCsim.dropoutsPerSec = 0;
+  ADCsim.reset(config.seed);
+
+  double Vratio = Vchannel->_calibration * Vadj_3 * getAref(0) / double(ADC_RANGE);
+  double Iratio = BENCH_ICAL * getAref(1) / double(ADC_RANGE);
+  ADCsignal& V = ADCsim.signal[Vchannel->_addr];
+  ADCsignal& I = ADCsim.signal[Ichannel->_addr];
+  V.peak = volts * sqrt(2.0) / Vratio;
+  I.peak = 10.0 * sqrt(2.0) / Iratio;
+  I.phase = -30;
+  V.noise = I.noise = 1.0;
+  V.harmonic[3] = 0.03;
+  V.harmonic[5] = 0.02;
+  I.harmonic[2] = 0.02;
+  I.harmonic[3] = 0.30;
+  I.harmonicPhase[3] = 20;
+  I.harmonic[5] = 0.15;
+  I.harmonicPhase[5] = -40;
+  I.harmonic[7] = 0.08;
+  I.harmonic[9] = 0.05;
+  I.harmonic[13] = 0.02;
+  double trueTHD[2] = {0, 0};
+  for(int n=2; n<=HARMONIC_ORDERS; n++){
+    trueTHD[0] += V.harmonic[n] * V.harmonic[n];
+    trueTHD[1] += I.harmonic[n] * I.harmonic[n];
+  }
+  trueTHD[0] = 100.0 * sqrt(trueTHD[0]);
+  trueTHD[1] = 100.0 * sqrt(trueTHD[1]);
+
+  harmonicCycles = 1;
+  for(uint32_t cycle=0; cycle<config.warmup; cycle++){
+    samplePower(1, 0);
+  }
+  benchError VTHD, ITHD, I3, I5;
+  uint32_t rejects = 0;
+  for(uint32_t cycle=0; cycle<config.cycles; cycle++){
+    int16_t before = cycleSamples;
+    samplePower(1, 0);
+    if(cycleSamples == before){
+      rejects++;
+      continue;
+    }
+    VTHD.add(Vchannel->dataBucket.value3 - trueTHD[0]);
+    ITHD.add(Ichannel->dataBucket.value3 - trueTHD[1]);
+    I3.add(Ichannel->_harmonic[0] - 100.0 * I.harmonic[3]);
+    I5.add(Ichannel->_harmonic[1] - 100.0 * I.harmonic[5]);
+  }
+
+  int16_t* capture = new int16_t[MAX_SAMPLES * 2];                 // Another cycle, for the time
+  sampleCycle(Vchannel, Ichannel, 1, capture);
+  const int runs = 200;
+  auto start = std::chrono::steady_clock::now();
+  for(int run=0; run<runs; run++){
+    harmonicAnalysis(Vchannel, Ichannel, capture);
+  }
+  double usecs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+  delete[] capture;
+  harmonicCycles = 0;
+
+  printf("%4.0f %6u %7d  %6.3f %6.3f  %6.3f %6.3f  %6.3f %6.3f  %6.3f %6.3f  %8.2f\n", Hz, rejects, samples,
+          VTHD.mean(), VTHD.worst, ITHD.mean(), ITHD.worst, I3.mean(), I3.worst, I5.mean(), I5.worst, usecs);
+}
+
+/*********************************************************************************************************
+ *  benchBurst - step the load on channel 1 and capture the burst it triggers, then read it back.
+ *********************************************************************************************************/
+static void benchBurst(double Hz, double volts, bool raw){
+  IotaInputChannel* Vchannel = inputChannel[0];
+  IotaInputChannel* Ichannel = inputChannel[1];
+  Vchannel->_calibration = volts / BENCH_VCAL;
+  Vchannel->_offset = Ichannel->_offset = ADC_RANGE / 2;
+  Vchannel->dataBucket.Hz = Hz;
+  Ichannel->_phase = Ichannel->_vphase = 0;
+  frequency = Hz;
+  ADCsim.Hz = Hz;
+  ADCsim.drift = 0;
+  ADCsim.conversionUs = config.conversionUs;
+  ADCsim.dropoutsPerSec = 0;
+  ADCsim.reset(config.seed);
+
+  double Vratio = Vchannel->_calibration * Vadj_3 * getAref(0) / double(ADC_RANGE);
+  double Iratio = BENCH_ICAL * getAref(1) / double(ADC_RANGE);
+  ADCsignal& V = ADCsim.signal[Vchannel->_addr];
+  ADCsignal& I = ADCsim.signal[Ichannel->_addr];
+  V.peak = volts * sqrt(2.0) / Vratio;
+  I.peak = 2.0 * sqrt(2.0) / Iratio;
+  I.phase = -20;
+  double wattsBefore = Vratio * Iratio * ADCsimulator::power(V, I);
+
+  for(uint32_t cycle=0; cycle<config.warmup; cycle++){
+    samplePower(0, 0);
+    samplePower(1, 0);
+  }
+  burstConfig(1, 500, 2, raw);                                          // Armed once settled
+  ADCsim.advance(BURST_HOLDOFF_MS * 1000.0);
+  for(int cycle=0; cycle<10; cycle++){
+    samplePower(0, 0);
+    samplePower(1, 0);
+  }
+  I.peak = 20.0 * sqrt(2.0) / Iratio;                                  // The step
+  double wattsAfter = Vratio * Iratio * ADCsimulator::power(V, I);
+  for(int cycle=0; cycle<10 && burstPending < 0; cycle++){
+    samplePower(1, 0);
+  }
+  if(burstPending < 0){
+    printf("%4.0f %4s  not triggered\n", Hz, raw ? "yes" : "no");
+    return;
+  }
+  SDstat = SDstats();
+  while(burstCapture()){                                               // A slice, then the Loop's turn
+    ADCsim.advance(BENCH_LOOP_US);
+  }
+
+  File dir = SD.open(BURST_DIR);
+  File file = dir.openNextFile();
+  if( ! file){
+    printf("%4.0f %4s  no file\n", Hz, raw ? "yes" : "no");
+    return;
+  }
+  String path = String(BURST_DIR) + "/" + file.name();
+  uint32_t bytes = file.size();
+  burstHeader header;
+  file.read(&header, sizeof(header));
+  uint32_t cycles = 0, rejects = 0, firstUs = 0, lastUs = 0, worstUs = 0;
+  float firstWatts = 0, lastWatts = 0;
+  burstCycle cycle;
+  while(file.read(&cycle, sizeof(cycle)) == sizeof(cycle)){
+    if(cycles++ == 0){
+      firstUs = cycle.us;
+      firstWatts = cycle.watts;
+    }
+    else worstUs = max(worstUs, cycle.us - lastUs);
+    lastUs = cycle.us;
+    lastWatts = cycle.watts;
+    if(cycle.rtc) rejects++;
+    if(cycle.samples){
+      file.seek(file.position() + cycle.samples * 2 * sizeof(int16_t));
+    }
+  }
+  file.close();
+  dir.close();
+  SD.remove(path.c_str());
+  double spacing = cycles > 1 ? (lastUs - firstUs) / 1e6 * Hz / (cycles - 1) : 0;
+  printf("%4.0f %4s %6u %6u %6.2f %6.2f %8u %6u  %7.1f %7.1f  %7.1f %7.1f %7.1f\n", Hz, raw ? "yes" : "no",
+          cycles, rejects, spacing, worstUs / 1e6 * Hz, bytes, SDstat.writes, wattsBefore, header.wattsBefore,
+          wattsAfter, firstWatts, lastWatts);
+}
+
+int main(int argc, char** argv){
+  for(int i=1; i<argc; i++){
+    String arg = argv[i];
+    const char* value = (i + 1 < argc) ? argv[i+1] : "";
+    if(arg == "-cycles") {config.cycles = atoi(value); i++;}
+    else if(arg == "-conversion") {config.conversionUs = atof(value); i++;}
+    else if(arg == "-seed") {config.seed = atoi(value); i++;}
+    else if(arg == "-dir") {config.dir = value; i++;}
+    else {
+      fprintf(stderr, "usage: %s [-cycles n] [-conversion us] [-seed n] [-dir path]\n", argv[0]);
+      return 1;
+    }
+  }
+  Serial.quiet(true);
+  benchChannels();
+
+  benchCase cases[] = {
+    {"60Hz pf 1",   60.0, 120.0, 10.0,  0.0},
+    {"50Hz pf 1",   50.0, 230.0, 10.0,  0.0},
+    {"60Hz lag 30", 60.0, 120.0, 10.0, 30.0},
+    {"50Hz lag 60", 50.0, 230.0, 10.0, 60.0},
+    {"harmonics",   60.0, 120.0, 10.0, 10.0, 0, 0, 0, 0, 0, 0, true},
+    {"noise",       60.0, 120.0, 10.0, 30.0, 0, 3.0},
+    {"offset",      60.0, 120.0, 10.0, 30.0, 0, 0, 15, -12},
+    {"drift",       59.9, 120.0, 10.0, 30.0, 0.05},
+    {"dropouts",    60.0, 120.0, 10.0, 30.0, 0, 0, 0, 0, 2.0, 3000},
+    {"light load",  60.0, 120.0,  0.2, 30.0},
+    {"CT lead 3",   60.0, 120.0, 10.0, 30.0, 0, 0, 0, 0, 0, 0, false, 3.0},
+    {"3 phase 120", 50.0, 230.0, 10.0, 30.0, 0, 0, 0, 0, 0, 0, false, 0, 120},
+    {"3 phase 240", 60.0, 120.0, 10.0, 30.0, 0, 0, 0, 0, 0, 0, false, 1.5, 240},
+  };
+
+  printf("%-12s %6s %6s %7s %8s  %13s  %13s  %13s  %13s  %13s  %13s\n", "", "", "", "samples", "us per",
+          "Vrms %", "Irms %", "Watts %VA", "VAR %VA", "VA %", "Hz mHz");
+  printf("%-12s %6s %6s %7s %8s  %6s %6s  %6s %6s  %6s %6s  %6s %6s  %6s %6s  %6s %6s\n", "case", "cycles", "reject",
+          "/cycle", "cycle", "mean", "worst", "mean", "worst", "mean", "worst", "mean", "worst", "mean", "worst",
+          "mean", "worst");
+  for(const benchCase& test : cases){
+    runCase(test);
+  }
+
+  printf("\n%-12s %4s %5s  %16s  %16s  %16s  %8s\n", "phase", "", "", "fundamental", "5th", "15th", "ns per");
+  printf("%-12s %4s %5s  %8s %7s  %8s %7s  %8s %7s  %8s\n", "correction", "Hz", "/cycle",
+          "phase", "amp %", "phase", "amp %", "phase", "amp %", "sample");
+  for(double Hz : {60.0, 50.0}){
+    int n = lround(1e6 / Hz / (2.0 * config.conversionUs));                  // Pairs per cycle
+    benchPhase("float linear", floatLinear, Hz, n);
+    benchPhase("Q15 linear", Q15linear, Hz, n);
+    benchPhase("Q15 FIR", Q15FIR, Hz, n);
+  }
+
+  printf("\n%4s %6s %7s  %13s  %13s  %13s  %13s  %8s\n", "", "", "", "V THD", "I THD", "I 3rd %", "I 5th %",
+          "us per");
+  printf("%4s %6s %7s  %6s %6s  %6s %6s  %6s %6s  %6s %6s  %8s\n", "Hz", "reject", "samples",
+          "mean", "worst", "mean", "worst", "mean", "worst", "mean", "worst", "analysis");
+  benchHarmonics(60.0, 120.0);
+  benchHarmonics(50.0, 230.0);
+
+  printf("\n%4s %3s %6s %7s %8s  %13s  %13s  %13s\n", "", "", "", "samples", "us per",
+          "CT 1 W %VA", "CT 2 W %VA", "CT 3 W %VA");
+  printf("%4s %3s %6s %7s %8s  %6s %6s  %6s %6s  %6s %6s\n", "Hz", "CTs", "reject", "/cycle", "channel",
+          "mean", "worst", "mean", "worst", "mean", "worst");
+  for(double Hz : {60.0, 50.0}){
+    for(int count=1; count<=MAX_CYCLE_CTS; count++){
+      benchCTs(Hz, Hz == 60.0 ? 120.0 : 230.0, count);
+    }
+  }
+
+  SD.setRoot(config.dir);
+  printf("\n%4s %4s %6s %6s  %13s %8s %6s  %15s  %23s\n", "", "", "", "", "line cycles", "", "SD",
+          "watts before", "watts after");
+  printf("%4s %4s %6s %6s %6s %6s %8s %6s  %7s %7s  %7s %7s %7s\n", "Hz", "raw", "cycles", "reject",
+          "mean", "worst", "bytes", "writes", "true", "header", "true", "first", "last");
+  for(double Hz : {60.0, 50.0}){
+    for(bool raw : {false, true}){
+      benchBurst(Hz, Hz == 60.0 ? 120.0 : 230.0, raw);
+    }
+  }
+  return 0;
+}